@@ -0,0 +1,172 @@
+#ifndef TPM_VAULT_BENCH_HPP
+#define TPM_VAULT_BENCH_HPP
+
+#include "tpm_vault.hpp"
+
+#include <string>
+#include <vector>
+#include <ostream>
+
+namespace tpm_vault {
+
+class TpmManager;
+
+/**
+ * @brief Параметры прогона `tpm-vault bench`
+ */
+struct BenchOptions {
+    unsigned iterations = 10;                              ///< Циклов create/open/close на размер
+    std::vector<size_t> sizes{TpmVault::DEFAULT_SIZE};     ///< Размеры образов
+    VaultOptions vault;                                    ///< Параметры создаваемых хранилищ
+
+    /// Профили ФС "тип/профиль", для каждого — отдельный прогон; пусто — vault.fs_type/fs_profile
+    std::vector<std::string> filesystems;
+
+    bool fio = false;                                      ///< Замер fio на каждом открытом хранилище
+};
+
+/**
+ * @brief Распределение длительности одного шага, мс
+ */
+struct PhaseStats {
+    std::string operation;  ///< "create", "open" или "close"
+    std::string phase;      ///< Шаг операции или "total"
+    size_t samples = 0;
+    double min_ms = 0;
+    double p50_ms = 0;
+    double p95_ms = 0;
+    double p99_ms = 0;
+    double max_ms = 0;
+};
+
+/**
+ * @brief Медиана одного задания fio по итерациям
+ */
+struct IoStats {
+    std::string job;      ///< "seq-write", "seq-read", "rand-write", "rand-read"
+    size_t samples = 0;
+    double mib_s = 0;     ///< Пропускная способность, МиБ/с
+    double iops = 0;
+};
+
+/**
+ * @brief Результаты для одного размера образа и профиля ФС
+ */
+struct BenchReport {
+    size_t size = 0;
+    std::string filesystem;          ///< "тип/профиль"
+    unsigned iterations = 0;
+    std::vector<PhaseStats> phases;  ///< В порядке выполнения шагов
+    std::vector<IoStats> io;         ///< Пусто без --fio
+};
+
+/**
+ * @brief Замер create/open/close по шагам на одноразовых хранилищах
+ *
+ * Хранилища создаются в текущей директории под именами
+ * "bench-<pid>-<n>" и удаляются вместе с объектами в TPM после
+ * каждой итерации, в том числе при ошибке. С fio между open и close
+ * на смонтированном хранилище выполняются последовательные (1 МиБ)
+ * и случайные (4 КиБ) запись и чтение с O_DIRECT.
+ */
+class VaultBenchmark {
+public:
+    /**
+     * @brief Конструктор
+     * @param vault Координатор, через который выполняются операции
+     */
+    explicit VaultBenchmark(TpmVault& vault);
+
+    /**
+     * @brief Выполняет прогон
+     * @param options Параметры прогона
+     * @return Отчёт для каждого размера из options.sizes
+     * @throws VaultError при ошибке любой операции
+     */
+    std::vector<BenchReport> run(const BenchOptions& options);
+
+    /**
+     * @brief Печатает отчёты таблицей
+     */
+    static void print_table(std::ostream& out, const std::vector<BenchReport>& reports);
+
+    /**
+     * @brief Печатает отчёты в JSON
+     */
+    static void print_json(std::ostream& out, const std::vector<BenchReport>& reports);
+
+    /**
+     * @brief Считает min/p50/p95/p99/max по выборке (перцентили по ближайшему рангу)
+     * @param samples_ms Длительности в миллисекундах
+     */
+    static PhaseStats summarize(const std::string& operation, const std::string& phase,
+                                std::vector<double> samples_ms);
+
+private:
+    /**
+     * @brief Удаляет хранилище, созданное итерацией
+     * @param name Имя хранилища
+     */
+    void discard(const std::string& name);
+
+    TpmVault& vault_;
+};
+
+/**
+ * @brief Параметры прогона `tpm-vault bench --lookup`
+ */
+struct LookupBenchOptions {
+    unsigned iterations = 100;                          ///< Проверок каждого вида на размер
+    std::vector<size_t> counts{10, 100, 1000, 10000};   ///< Число объектов в хранилище ключей
+};
+
+/**
+ * @brief Результаты для одного числа объектов
+ */
+struct LookupReport {
+    size_t objects = 0;
+    unsigned iterations = 0;
+    std::vector<PhaseStats> methods;  ///< operation — способ, phase — "hit", "miss" или "load"
+};
+
+/**
+ * @brief Замер TpmManager::exists при растущем числе sealed objects
+ *
+ * Хранилище ключей дополняется объектами "bench-lookup-<pid>-<n>" до каждого
+ * размера из counts, после чего сравниваются полный Fapi_List ("list"),
+ * точный запрос по пути ("direct") и индекс имён ("index"). Созданные
+ * объекты удаляются в конце прогона, в том числе при ошибке.
+ */
+class LookupBenchmark {
+public:
+    /**
+     * @brief Конструктор
+     * @param tpm Менеджер TPM, в хранилище ключей которого создаются объекты
+     */
+    explicit LookupBenchmark(TpmManager& tpm);
+
+    /**
+     * @brief Выполняет прогон
+     * @param options Параметры прогона
+     * @return Отчёт для каждого размера из options.counts по возрастанию
+     * @throws VaultError при ошибке TPM
+     */
+    std::vector<LookupReport> run(const LookupBenchOptions& options);
+
+    /**
+     * @brief Печатает отчёты таблицей
+     */
+    static void print_table(std::ostream& out, const std::vector<LookupReport>& reports);
+
+    /**
+     * @brief Печатает отчёты в JSON
+     */
+    static void print_json(std::ostream& out, const std::vector<LookupReport>& reports);
+
+private:
+    TpmManager& tpm_;
+};
+
+} // namespace tpm_vault
+
+#endif // TPM_VAULT_BENCH_HPP
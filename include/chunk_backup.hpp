@@ -0,0 +1,85 @@
+#ifndef TPM_VAULT_CHUNK_BACKUP_HPP
+#define TPM_VAULT_CHUNK_BACKUP_HPP
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+namespace tpm_vault {
+
+/**
+ * @brief Итог backup или restore
+ */
+struct BackupStats {
+    uint64_t size = 0;         ///< Размер образа
+    size_t chunk_size = 0;     ///< Размер блока
+    size_t chunks = 0;         ///< Всего блоков
+    size_t zero = 0;           ///< Нулевые блоки (дыры): не хранятся и не пишутся
+    size_t unchanged = 0;      ///< Совпали с прошлым манифестом (backup)
+    size_t deduplicated = 0;   ///< Уже были в хранилище блоков (backup)
+    size_t written = 0;        ///< Записаны в хранилище блоков (backup) или в образ (restore)
+    uint64_t bytes_written = 0;
+    size_t pruned = 0;         ///< Удалены блоки, на которые больше нет ссылок (backup)
+};
+
+/**
+ * @brief Инкрементальные копии образов блоками фиксированного размера
+ *
+ * Каталог копий:
+ *   <dir>/<name>.manifest   — размер образа, размер блока и SHA-256 каждого блока
+ *   <dir>/chunks/ab/ab...   — блоки по хешу содержимого, общие для всех образов
+ *
+ * Образ шифрован, поэтому ключ не нужен: блоки сравниваются как есть.
+ * Нулевые блоки (дыры тонкого и невыделенного образа) в манифесте
+ * отмечены "0" и не хранятся. Блоки читаются и хешируются параллельно
+ * в WorkerPool; SHA-256 считает libcrypto (SHA-NI/AVX2 там, где есть).
+ */
+class ChunkBackup {
+public:
+    /// Размер блока по умолчанию
+    static constexpr size_t DEFAULT_CHUNK_SIZE = 1024 * 1024;
+
+    /// Допустимые размеры блока: кратны 4K; буфер такого размера у каждого потока
+    static constexpr size_t MIN_CHUNK_SIZE = 4096;
+    static constexpr size_t MAX_CHUNK_SIZE = 64 * 1024 * 1024;
+
+    /**
+     * @brief Копирует изменившиеся блоки образа и пишет новый манифест
+     *
+     * Блок с тем же хешем, что в прошлом манифесте, не проверяется;
+     * остальные пишутся, если их ещё нет в хранилище. После атомарной
+     * замены манифеста удаляются блоки прошлой копии, на которые
+     * не ссылается ни один манифест каталога. Всё это — под LOCK_EX
+     * на <dir>/chunks: параллельная копия другого хранилища не удалит
+     * блок, который эта копия сочла уже сохранённым.
+     *
+     * @param image_fd Образ, открытый на чтение
+     * @param dir Каталог копий (создаётся)
+     * @param name Имя хранилища
+     * @param chunk_size Размер блока (при смене все блоки считаются новыми)
+     * @throws VaultError при недопустимом размере блока, ошибке ввода-вывода или OpenSSL
+     */
+    static BackupStats backup(int image_fd, const std::string& dir, const std::string& name,
+                              size_t chunk_size);
+
+    /**
+     * @brief Собирает образ из последней копии
+     *
+     * Хеш каждого блока проверяется; нулевые блоки остаются дырами.
+     *
+     * @param dir Каталог копий
+     * @param name Имя хранилища
+     * @param image_fd Пустой файл образа, открытый на запись
+     * @throws VaultError если манифеста нет, блок отсутствует или повреждён
+     */
+    static BackupStats restore(const std::string& dir, const std::string& name, int image_fd);
+
+    /**
+     * @brief Путь к манифесту копии хранилища
+     */
+    static std::string manifest_path(const std::string& dir, const std::string& name);
+};
+
+} // namespace tpm_vault
+
+#endif // TPM_VAULT_CHUNK_BACKUP_HPP
@@ -0,0 +1,96 @@
+#ifndef TPM_VAULT_CIPHER_BENCHMARK_HPP
+#define TPM_VAULT_CIPHER_BENCHMARK_HPP
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+
+namespace tpm_vault {
+
+/**
+ * @brief Шифр-кандидат для LUKS2
+ */
+struct CipherCandidate {
+    std::string spec;        ///< Спецификация dm-crypt (например, "aes-xts-plain64")
+    std::string kernel_alg;  ///< Имя skcipher в crypto API ядра (например, "xts(aes)")
+    size_t key_size;         ///< Размер ключа тома в байтах
+    size_t iv_size;          ///< Размер IV в байтах
+};
+
+/**
+ * @brief Результат замера одного шифра
+ */
+struct CipherBenchResult {
+    std::string spec;           ///< Спецификация dm-crypt
+    size_t key_size = 0;        ///< Размер ключа тома в байтах
+    bool available = false;     ///< Шифр поддерживается ядром
+    double encrypt_mib_s = 0;   ///< Скорость шифрования, МиБ/с
+    double decrypt_mib_s = 0;   ///< Скорость расшифровки, МиБ/с
+};
+
+/**
+ * @brief Замер скорости шифров через crypto API ядра (AF_ALG)
+ *
+ * Шифрует буфер посекторно теми же реализациями skcipher, которые
+ * затем использует dm-crypt, — аналог `cryptsetup benchmark`.
+ */
+class CipherBenchmark {
+public:
+    /**
+     * @brief Список шифров, из которых выбирает режим --cipher auto
+     */
+    static const std::vector<CipherCandidate>& candidates();
+
+    /**
+     * @brief Замеряет все кандидаты
+     * @param sector_size Размер сектора dm-crypt (одна операция шифрования)
+     * @param duration Длительность замера каждого направления для каждого шифра
+     * @return Результаты в порядке candidates()
+     */
+    static std::vector<CipherBenchResult> run(uint32_t sector_size,
+                                              std::chrono::milliseconds duration);
+
+    /**
+     * @brief Выбирает шифр по результатам замера
+     *
+     * aes-xts-plain64 остаётся выбором по умолчанию, пока другой шифр
+     * не быстрее него хотя бы на PREFERENCE_MARGIN (например, на CPU без AES-NI).
+     * Если замер не удался целиком (AF_ALG отключён), тоже выбирается aes-xts-plain64.
+     *
+     * @param results Результаты run()
+     * @return Выбранный шифр
+     */
+    static const CipherCandidate& pick(const std::vector<CipherBenchResult>& results);
+    
+    /**
+     * @brief Размер ключа тома для шифра
+     * @param spec Спецификация dm-crypt
+     * @return Размер в байтах (64 для XTS, 32 для остальных режимов)
+     */
+    static size_t key_size_for(const std::string& spec);
+
+    /**
+     * @brief Разбирает спецификацию dm-crypt на шифр и режим
+     * @param spec Например, "xchacha12,aes-adiantum-plain64"
+     * @param cipher Шифр ("xchacha12,aes")
+     * @param mode Режим ("adiantum-plain64")
+     * @throws VaultError при некорректной спецификации
+     */
+    static void split_spec(const std::string& spec, std::string& cipher, std::string& mode);
+
+private:
+    /// Во сколько раз альтернатива должна обгонять aes-xts, чтобы её выбрали
+    static constexpr double PREFERENCE_MARGIN = 1.2;
+
+    /**
+     * @brief Замеряет одно направление одного шифра
+     * @return МиБ/с или отрицательное значение, если шифр недоступен
+     */
+    static double measure(const CipherCandidate& candidate, bool encrypt,
+                          uint32_t sector_size, std::chrono::milliseconds duration);
+};
+
+} // namespace tpm_vault
+
+#endif // TPM_VAULT_CIPHER_BENCHMARK_HPP
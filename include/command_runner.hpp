@@ -0,0 +1,73 @@
+#ifndef TPM_VAULT_COMMAND_RUNNER_HPP
+#define TPM_VAULT_COMMAND_RUNNER_HPP
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+
+namespace tpm_vault {
+
+/**
+ * @brief Параметры запуска внешней команды
+ */
+struct CommandOptions {
+    /// Данные для stdin (например, ключ из SecureBuffer); nullptr — /dev/null
+    const std::vector<uint8_t>* stdin_data = nullptr;
+
+    /// Предельное время выполнения; 0 — без ограничения
+    std::chrono::milliseconds timeout{0};
+};
+
+/**
+ * @brief Результат внешней команды
+ */
+struct CommandResult {
+    int exit_code = -1;                  ///< Код возврата (128 + сигнал, если процесс убит)
+    std::string out;                     ///< Весь stdout
+    std::string err;                     ///< Весь stderr
+    std::chrono::microseconds wall_time{0};  ///< Время от запуска до завершения
+};
+
+/**
+ * @brief Запуск внешних утилит без оболочки
+ *
+ * Процесс создаётся posix_spawnp с готовым вектором argv, поэтому
+ * аргументы не разбираются shell и не требуют экранирования. stdout и
+ * stderr читаются целиком через poll() большими блоками, stdin пишется
+ * из буфера вызывающего без копирования. По истечении таймаута процесс
+ * получает SIGKILL. Каждый запуск — спан трассировки "exec" с командной
+ * строкой.
+ */
+class CommandRunner {
+public:
+    /**
+     * @brief Выполняет команду и возвращает результат при любом коде возврата
+     * @param argv Программа (ищется в PATH) и её аргументы
+     * @param options Параметры запуска
+     * @return Код возврата, вывод и время выполнения
+     * @throws VaultError если процесс не удалось запустить или истёк таймаут
+     */
+    static CommandResult run(const std::vector<std::string>& argv,
+                             const CommandOptions& options = CommandOptions());
+
+    /**
+     * @brief Выполняет команду и требует нулевой код возврата
+     * @param what Описание операции для сообщения об ошибке
+     * @param argv Программа и её аргументы
+     * @param options Параметры запуска
+     * @return Результат (stdout, время выполнения)
+     * @throws VaultError вида "<what>: <программа> exited with N after T ms — <stderr>"
+     */
+    static CommandResult check(const std::string& what, const std::vector<std::string>& argv,
+                               const CommandOptions& options = CommandOptions());
+
+    /**
+     * @brief Формирует командную строку для сообщений и трассировки
+     */
+    static std::string describe(const std::vector<std::string>& argv);
+};
+
+} // namespace tpm_vault
+
+#endif // TPM_VAULT_COMMAND_RUNNER_HPP
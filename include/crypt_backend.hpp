@@ -0,0 +1,170 @@
+#ifndef TPM_VAULT_CRYPT_BACKEND_HPP
+#define TPM_VAULT_CRYPT_BACKEND_HPP
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <chrono>
+#include <unordered_map>
+
+namespace tpm_vault {
+
+/**
+ * @brief Параметры шифрования тома
+ *
+ * Исторически называются LuksOptions; шифр, размер сектора и профиль
+ * производительности применяются и к тому без заголовка (DmCryptManager).
+ */
+struct LuksOptions {
+    /**
+     * Быстрая разблокировка. Ключ из TPM — это уже 512 случайных бит,
+     * и растягивать его Argon2id бессмысленно. Поэтому он сам становится
+     * мастер-ключом тома, keyslot и digest используют PBKDF2 с минимальным
+     * числом итераций, а открытие активирует том напрямую по мастер-ключу.
+     */
+    bool fast_unlock = false;
+
+    /**
+     * Профиль производительности dm-crypt:
+     *  - "default"    — поведение ядра по умолчанию;
+     *  - "latency"    — без очередей kcryptd (no_read_workqueue, no_write_workqueue);
+     *  - "throughput" — same_cpu_crypt, submit_from_crypt_cpus.
+     * Флаги профиля записываются в заголовок LUKS2 как постоянные.
+     */
+    std::string perf_profile = "default";
+
+    /// Маска CPU для очереди kcryptd (hex, как в /sys/.../cpumask), пусто — не менять.
+    /// Только для несвязанной очереди (профили default, latency): с same_cpu_crypt
+    /// очередь привязана к CPU и в sysfs не видна
+    std::string cpu_mask;
+
+    /// Шифр в формате dm-crypt ("aes-xts-plain64", "xchacha12,aes-adiantum-plain64")
+    std::string cipher = "aes-xts-plain64";
+
+    /// Размер сектора шифрования (512..4096), 0 — по умолчанию libcryptsetup
+    uint32_t sector_size = 0;
+};
+
+/**
+ * @brief Интерфейс шифрованного тома, через который работает TpmVault
+ *
+ * Реализации: LuksManager (LUKS2 через libcryptsetup) и DmCryptManager
+ * (dm-crypt без заголовка через ioctl device-mapper). Оба создают
+ * устройство /dev/mapper/<mapper_name>.
+ */
+class CryptBackend {
+public:
+    virtual ~CryptBackend() = default;
+
+    /**
+     * @brief Подготавливает устройство под шифрованный том
+     * @param device Путь к устройству (например, /dev/loop0)
+     * @param key Ключ из TPM (512 бит / 64 байта)
+     * @param options Параметры тома
+     * @throws VaultError при ошибке
+     */
+    virtual void format(const std::string& device, const std::vector<uint8_t>& key,
+                        const LuksOptions& options = LuksOptions()) = 0;
+
+    /**
+     * @brief Активирует том как /dev/mapper/<mapper_name>
+     * @param device Путь к устройству
+     * @param mapper_name Имя для device mapper (без /dev/mapper/)
+     * @param key Ключ из TPM
+     * @param options Параметры тома, выбранные при создании
+     * @throws VaultError при ошибке
+     */
+    virtual void open(const std::string& device, const std::string& mapper_name,
+                      const std::vector<uint8_t>& key, const LuksOptions& options = LuksOptions()) = 0;
+
+    /**
+     * @brief Деактивирует том
+     * @param mapper_name Имя device mapper
+     * @throws VaultError при ошибке
+     */
+    virtual void close(const std::string& mapper_name) = 0;
+
+    /**
+     * @brief Расширяет активный том до текущего размера устройства под ним
+     * @param device Путь к устройству (уже увеличенному)
+     * @param mapper_name Имя device mapper
+     * @param key Ключ из TPM; используется, только если resize_needs_key()
+     * @param options Параметры тома
+     * @throws VaultError при ошибке
+     */
+    virtual void resize(const std::string& device, const std::string& mapper_name,
+                        const std::vector<uint8_t>& key, const LuksOptions& options) = 0;
+
+    /**
+     * @brief Нужен ли resize() ключ из TPM для этого активного тома
+     *
+     * По умолчанию нужен: таблица загружается заново вместе с ключом тома.
+     *
+     * @param device Путь к устройству
+     * @param mapper_name Имя device mapper
+     * @throws VaultError при ошибке запроса состояния тома
+     */
+    virtual bool resize_needs_key(const std::string& device, const std::string& mapper_name) {
+        (void)device;
+        (void)mapper_name;
+        return true;
+    }
+
+    /**
+     * @brief Освобождает ресурсы, удерживаемые между вызовами
+     *
+     * Вызывается перед отключением loop-устройства.
+     */
+    virtual void release() {}
+
+    /**
+     * @brief Время вывода ключа при последнем format() или open()
+     */
+    std::chrono::microseconds last_kdf_time() const { return last_kdf_time_; }
+
+    /**
+     * @brief Проверяет, активирован ли том
+     * @param mapper_name Имя device mapper
+     * @return true если /dev/mapper/<mapper_name> существует
+     */
+    bool is_open(const std::string& mapper_name);
+
+    /**
+     * @brief Возвращает путь к mapper устройству
+     * @param mapper_name Имя device mapper
+     * @return Полный путь /dev/mapper/<mapper_name>
+     */
+    static std::string get_mapper_path(const std::string& mapper_name);
+
+    /**
+     * @brief Снимок всех активных томов device mapper за один проход
+     *
+     * Читает /sys/block/dm-N/dm/name и /sys/block/dm-N/dev: без
+     * открытия устройств и без ioctl на каждый том.
+     *
+     * @return Имя device mapper → номер устройства (dev_t)
+     */
+    static std::unordered_map<std::string, uint64_t> scan_active();
+
+    /**
+     * @brief Формирует имя mapper для хранилища
+     * @param vault_name Имя хранилища
+     * @return Имя вида "tpm-vault-<name>"
+     */
+    static std::string get_mapper_name(const std::string& vault_name);
+
+protected:
+    /**
+     * @brief Привязывает очередь kcryptd открытого тома к набору CPU
+     * @param mapper_name Имя device mapper
+     * @param cpu_mask Маска CPU в шестнадцатеричном виде
+     * @throws VaultError если ядро не экспортирует очередь в sysfs
+     */
+    static void apply_cpu_mask(const std::string& mapper_name, const std::string& cpu_mask);
+
+    std::chrono::microseconds last_kdf_time_{0};
+};
+
+} // namespace tpm_vault
+
+#endif // TPM_VAULT_CRYPT_BACKEND_HPP
@@ -0,0 +1,84 @@
+#ifndef TPM_VAULT_DAEMON_HPP
+#define TPM_VAULT_DAEMON_HPP
+
+#include <string>
+#include <vector>
+#include <functional>
+
+namespace tpm_vault {
+
+/**
+ * @brief Фоновый процесс tpm-vault с постоянным контекстом FAPI
+ *
+ * Держит один TpmVault (и с ним Fapi_Initialize, provisioning и импорт
+ * политики PCR) между запросами и выполняет команды CLI, присланные
+ * через Unix-сокет.
+ *
+ * Протокол — один запрос на соединение:
+ *   запрос:  "<cwd>\t<command>\t<arg>...\n"
+ *   ответ:   "<exit code>\t<stdout bytes>\t<stderr bytes>\n<stdout><stderr>"
+ *
+ * Запросы обрабатываются строго по очереди, поэтому обращения к TPM
+ * сериализованы. Принимаются только соединения от процессов с uid 0.
+ */
+class VaultDaemon {
+public:
+    /// Путь к сокету по умолчанию
+    static constexpr const char* SOCKET_PATH = "/run/tpm-vault.sock";
+
+    /**
+     * @brief Обработчик команды: аргументы после имени программы → код возврата
+     *
+     * Вывод обработчика в std::cout и std::cerr перехватывается и
+     * отправляется клиенту.
+     */
+    using Handler = std::function<int(const std::vector<std::string>& args)>;
+
+    /**
+     * @brief Конструктор
+     * @param socket_path Путь к Unix-сокету
+     * @param handler Исполнитель команд
+     */
+    VaultDaemon(const std::string& socket_path, Handler handler);
+
+    /**
+     * @brief Принимает запросы до SIGTERM или SIGINT
+     * @throws VaultError если сокет не удалось создать или на нём уже отвечает другой демон
+     */
+    void run();
+
+private:
+    /**
+     * @brief Обслуживает одно соединение
+     * @param client_fd Сокет клиента
+     */
+    void serve(int client_fd);
+
+    std::string socket_path_;
+    Handler handler_;
+};
+
+/**
+ * @brief Клиентская сторона: пересылка команды запущенному демону
+ */
+class DaemonClient {
+public:
+    /**
+     * @brief Выполняет команду через демон
+     *
+     * Вывод демона печатается в std::cout и std::cerr.
+     *
+     * @param socket_path Путь к сокету
+     * @param args Аргументы после имени программы
+     * @param exit_code Код возврата команды
+     * @return false, если демон не запущен или аргументы либо текущий каталог
+     *         нельзя передать (тогда команду следует выполнить в своём процессе)
+     * @throws VaultError если демон оборвал соединение посреди ответа
+     */
+    static bool forward(const std::string& socket_path, const std::vector<std::string>& args,
+                        int& exit_code);
+};
+
+} // namespace tpm_vault
+
+#endif // TPM_VAULT_DAEMON_HPP
@@ -0,0 +1,97 @@
+#ifndef TPM_VAULT_DM_CRYPT_MANAGER_HPP
+#define TPM_VAULT_DM_CRYPT_MANAGER_HPP
+
+#include "crypt_backend.hpp"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace tpm_vault {
+
+/**
+ * @brief Том dm-crypt без заголовка (аналог `cryptsetup open --type plain`)
+ *
+ * Таблица с целью crypt загружается напрямую ioctl-запросами к
+ * /dev/mapper/control: DM_DEV_CREATE → DM_TABLE_LOAD → DM_DEV_SUSPEND.
+ * На устройстве нет ни заголовка, ни keyslot: ключом тома служит ключ
+ * из TPM, а шифр и размер сектора хранятся в метаданных <name>.vault.
+ * Без метаданных данные тома расшифровать невозможно.
+ */
+class DmCryptManager : public CryptBackend {
+public:
+    /**
+     * @brief Проверяет параметры тома
+     *
+     * Заголовка нет, поэтому на устройство ничего не записывается.
+     *
+     * @throws VaultError если размер устройства не кратен сектору шифрования
+     */
+    void format(const std::string& device, const std::vector<uint8_t>& key,
+                const LuksOptions& options = LuksOptions()) override;
+
+    /**
+     * @brief Создаёт и активирует устройство dm-crypt
+     *
+     * Если udev не создал /dev/mapper/<mapper_name>, узел создаётся вручную.
+     *
+     * @throws VaultError при ошибке ioctl device-mapper
+     */
+    void open(const std::string& device, const std::string& mapper_name,
+              const std::vector<uint8_t>& key, const LuksOptions& options = LuksOptions()) override;
+
+    /**
+     * @brief Удаляет устройство dm-crypt (DM_DEV_REMOVE)
+     * @throws VaultError если устройство занято
+     */
+    void close(const std::string& mapper_name) override;
+
+    /**
+     * @brief Загружает таблицу на весь размер устройства и переключается на неё
+     *
+     * DM_TABLE_LOAD в неактивный слот, затем resume: ядро приостанавливает
+     * устройство и меняет таблицу без закрытия тома.
+     *
+     * @throws VaultError при ошибке ioctl device-mapper
+     */
+    void resize(const std::string& device, const std::string& mapper_name,
+                const std::vector<uint8_t>& key, const LuksOptions& options) override;
+
+    /**
+     * @brief Возвращает необязательные параметры цели crypt для профиля
+     * @param profile Имя профиля (см. LuksOptions::perf_profile)
+     * @return Параметры через пробел, например "no_read_workqueue no_write_workqueue"
+     * @throws VaultError для неизвестного профиля
+     */
+    static std::string get_profile_args(const std::string& profile);
+
+private:
+    /**
+     * @brief Формирует строку параметров цели crypt
+     * @return "<cipher> <hex key> 0 <major:minor> 0 [<n> <opt>...]"
+     */
+    static std::string build_table(const std::string& device, const std::vector<uint8_t>& key,
+                                   const LuksOptions& options);
+
+    /**
+     * @brief Загружает таблицу crypt на весь размер устройства в неактивный слот
+     * @param control_fd Дескриптор /dev/mapper/control
+     * @throws VaultError при ошибке ioctl
+     */
+    static void load_table(int control_fd, const std::string& device, const std::string& mapper_name,
+                           const std::vector<uint8_t>& key, const LuksOptions& options);
+
+    /**
+     * @brief Создаёт узел /dev/mapper/<mapper_name>, если его нет
+     * @param mapper_name Имя device mapper
+     * @param dev Номер устройства из ответа ядра
+     */
+    void ensure_node(const std::string& mapper_name, uint64_t dev);
+
+    /// UUID тома с префиксом, по которому cryptsetup распознаёт plain-устройства
+    static std::string make_uuid(const std::string& mapper_name);
+};
+
+} // namespace tpm_vault
+
+#endif // TPM_VAULT_DM_CRYPT_MANAGER_HPP
@@ -0,0 +1,98 @@
+#ifndef TPM_VAULT_FS_PROFILE_HPP
+#define TPM_VAULT_FS_PROFILE_HPP
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace tpm_vault {
+
+/**
+ * @brief Геометрия открытого шифрованного тома, под которую размечается ФС
+ */
+struct DeviceGeometry {
+    uint32_t sector_size = 512;  ///< Логический сектор (сектор шифрования dm-crypt)
+    uint64_t size = 0;           ///< Размер тома в байтах
+};
+
+/**
+ * @brief Профиль файловой системы хранилища
+ *
+ * Задаёт команду mkfs и параметры монтирования. Тип и имя профиля
+ * сохраняются в метаданных (fs.type, fs.profile), так что параметры
+ * монтирования применяются при каждом открытии.
+ */
+struct FsProfile {
+    std::string fs_type;                     ///< Тип ФС: mkfs.<fs_type> и тип для монтирования
+    std::string name;                        ///< Имя профиля (--fs-profile)
+    std::string description;                 ///< Однострочное описание для справки
+    std::vector<std::string> mount_options;  ///< Параметры MountManager::mount
+
+    /// Аргументы mkfs после имени программы, без устройства
+    std::vector<std::string> (*mkfs_args)(const DeviceGeometry& geometry);
+};
+
+/**
+ * @brief Встроенные профили файловых систем
+ *
+ * ext4: default (mkfs.ext4 без параметров, как раньше) и tuned;
+ * xfs: default и large-files; btrfs: default и compress (zstd);
+ * f2fs: default.
+ */
+class FsProfiles {
+public:
+    /// Тип ФС и профиль хранилищ, созданных без --fs/--fs-profile
+    static constexpr const char* DEFAULT_TYPE = "ext4";
+    static constexpr const char* DEFAULT_PROFILE = "default";
+
+    /**
+     * @brief Все профили в порядке вывода справки
+     */
+    static const std::vector<FsProfile>& all();
+
+    /**
+     * @brief Находит профиль
+     * @param fs_type Тип ФС
+     * @param name Имя профиля
+     * @throws VaultError с перечнем допустимых значений
+     */
+    static const FsProfile& find(const std::string& fs_type, const std::string& name);
+
+    /**
+     * @brief Формирует командную строку mkfs для устройства
+     * @param profile Профиль
+     * @param device Открытый шифрованный том (/dev/mapper/...)
+     * @throws VaultError если геометрию устройства не удалось получить
+     */
+    static std::vector<std::string> mkfs_command(const FsProfile& profile, const std::string& device);
+
+    /**
+     * @brief Умеет ли файловая система расти смонтированной
+     * @return false для f2fs (resize.f2fs работает только с размонтированной)
+     */
+    static bool grows_online(const std::string& fs_type);
+
+    /**
+     * @brief Формирует команду, растягивающую ФС на всё устройство
+     *
+     * ext4 — resize2fs, xfs — xfs_growfs, btrfs — btrfs filesystem resize max,
+     * f2fs — resize.f2fs.
+     *
+     * @param fs_type Тип ФС
+     * @param device Шифрованный том
+     * @param mount_point Точка монтирования (xfs_growfs и btrfs работают с ней)
+     * @throws VaultError для неизвестного типа
+     */
+    static std::vector<std::string> grow_command(const std::string& fs_type, const std::string& device,
+                                                 const std::string& mount_point);
+
+    /**
+     * @brief Читает размер сектора и размер блочного устройства
+     * @throws VaultError при ошибке ioctl
+     */
+    static DeviceGeometry geometry(const std::string& device);
+};
+
+} // namespace tpm_vault
+
+#endif // TPM_VAULT_FS_PROFILE_HPP
@@ -0,0 +1,82 @@
+#ifndef TPM_VAULT_IMAGE_TRANSFER_HPP
+#define TPM_VAULT_IMAGE_TRANSFER_HPP
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+namespace tpm_vault {
+
+/**
+ * @brief Итог копирования образа
+ */
+struct TransferStats {
+    std::string method;       ///< "reflink", "copy_file_range", "read/write" или "stream"
+    uint64_t size = 0;        ///< Размер образа
+    uint64_t data_bytes = 0;  ///< Передано данных (дыры не считаются; для reflink — 0)
+    size_t extents = 0;       ///< Число экстентов с данными
+};
+
+/**
+ * @brief Копирование образов хранилищ с сохранением дыр
+ *
+ * Копия файла — FICLONE, если источник и приёмник на одной ФС с reflink
+ * (btrfs, XFS), иначе copy_file_range по экстентам, найденным
+ * SEEK_DATA/SEEK_HOLE. Поток для канала (ssh, pipe) — тот же обход
+ * экстентов в простом формате, все числа little-endian:
+ *
+ *   "TPMVIMG" 0x01 | u64 размер образа | u64 длина метаданных | метаданные
+ *   { u64 смещение | u64 длина | данные }...
+ *   u64 размер образа | u64 0            — конец потока
+ *
+ * Дескрипторы открывает вызывающий: политика создания файлов (O_EXCL,
+ * удаление при ошибке) остаётся в TpmVault.
+ */
+class ImageTransfer {
+public:
+    /// Путь, означающий stdout для экспорта и stdin для импорта
+    static constexpr const char* STDIO = "-";
+
+    /**
+     * @brief Копирует образ между файлами
+     * @param src_fd Образ, открытый на чтение
+     * @param dst_fd Пустой файл, открытый на запись
+     * @throws VaultError при ошибке ввода-вывода
+     */
+    static TransferStats copy(int src_fd, int dst_fd);
+
+    /**
+     * @brief Пишет образ и метаданные в поток
+     * @param src_fd Образ, открытый на чтение
+     * @param metadata Текст метаданных (VaultMetadata::serialize)
+     * @param out_fd Канал или файл
+     * @throws VaultError при ошибке ввода-вывода
+     */
+    static TransferStats write_stream(int src_fd, const std::string& metadata, int out_fd);
+
+    /**
+     * @brief Читает поток в файл образа
+     *
+     * Дыры не записываются; файл получает полный размер образа.
+     *
+     * @param in_fd Канал или файл
+     * @param dst_fd Пустой файл, открытый на запись
+     * @param metadata Текст метаданных из потока
+     * @throws VaultError при обрыве или повреждении потока
+     */
+    static TransferStats read_stream(int in_fd, int dst_fd, std::string& metadata);
+
+private:
+    /**
+     * @brief Копирует диапазон между файлами через copy_file_range
+     * @return false, если ядро или ФС этого не умеют (ничего не скопировано)
+     */
+    static bool copy_range(int src_fd, int dst_fd, uint64_t offset, uint64_t length);
+
+    /// Копирует диапазон через pread/pwrite
+    static void copy_range_buffered(int src_fd, int dst_fd, uint64_t offset, uint64_t length);
+};
+
+} // namespace tpm_vault
+
+#endif // TPM_VAULT_IMAGE_TRANSFER_HPP
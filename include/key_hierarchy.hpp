@@ -0,0 +1,60 @@
+#ifndef TPM_VAULT_KEY_HIERARCHY_HPP
+#define TPM_VAULT_KEY_HIERARCHY_HPP
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace tpm_vault {
+
+class SecureBuffer;
+
+/**
+ * @brief Вывод ключей хранилищ из корневого секрета хоста
+ *
+ * Корневой секрет запечатан в TPM один раз на хост (TpmManager::seal_root),
+ * а ключ каждого хранилища получается как
+ *   HKDF-SHA512(root, salt, INFO) → KEY_SIZE байт,
+ * где salt — случайная соль хранилища из его метаданных (key.salt).
+ * Одно извлечение корня из TPM открывает любое число хранилищ.
+ */
+class KeyHierarchy {
+public:
+    /// Размер корневого секрета (512 бит)
+    static constexpr size_t ROOT_SIZE = 64;
+
+    /// Размер соли хранилища (256 бит)
+    static constexpr size_t SALT_SIZE = 32;
+
+    /// Контекст HKDF (info): меняется вместе со схемой вывода
+    static constexpr const char* INFO = "tpm-vault/volume-key/v1";
+
+    /**
+     * @brief Выводит ключ хранилища
+     * @param root Корневой секрет
+     * @param salt Соль хранилища
+     * @param key Буфер результата; заполняется целиком
+     * @throws VaultError при ошибке OpenSSL
+     */
+    static void derive(const SecureBuffer& root, const std::vector<uint8_t>& salt, SecureBuffer& key);
+
+    /**
+     * @brief Генерирует соль для нового хранилища
+     */
+    static std::vector<uint8_t> new_salt();
+
+    /**
+     * @brief Кодирует соль для метаданных (hex)
+     */
+    static std::string encode_salt(const std::vector<uint8_t>& salt);
+
+    /**
+     * @brief Разбирает соль из метаданных
+     * @throws VaultError если строка не hex длиной SALT_SIZE байт
+     */
+    static std::vector<uint8_t> decode_salt(const std::string& hex);
+};
+
+} // namespace tpm_vault
+
+#endif // TPM_VAULT_KEY_HIERARCHY_HPP
@@ -3,14 +3,72 @@
 
 #include <string>
 #include <vector>
+#include <cstdint>
+#include <unordered_map>
 
 namespace tpm_vault {
 
+/**
+ * @brief Сведения о подключённом loop-устройстве
+ */
+struct LoopDeviceInfo {
+    std::string device;         ///< Путь к устройству (/dev/loopN)
+    std::string backing_file;   ///< Путь к файлу образа (из sysfs)
+    uint64_t backing_dev = 0;   ///< st_dev файла образа
+    uint64_t backing_inode = 0; ///< st_ino файла образа
+    uint64_t rdev = 0;          ///< Номер самого loop-устройства (0, если не открылось)
+};
+
+/**
+ * @brief Настройки ввода-вывода loop-устройства
+ * 
+ * Нулевые значения означают "оставить как есть".
+ */
+struct LoopOptions {
+    /// Прямой ввод-вывод (LO_FLAGS_DIRECT_IO): шифротекст образа не дублируется в page cache
+    bool direct_io = false;
+    
+    /// Логический размер блока (512..4096), для direct I/O обычно 4096
+    uint32_t block_size = 0;
+    
+    /// Упреждающее чтение очереди, КиБ (queue/read_ahead_kb)
+    uint32_t read_ahead_kb = 0;
+    
+    /// Глубина очереди запросов (queue/nr_requests)
+    uint32_t nr_requests = 0;
+};
+
+/**
+ * @brief Идентификатор файла образа: устройство и inode
+ * 
+ * Inode уникален только в пределах одной файловой системы,
+ * поэтому в ключ входит и номер устройства.
+ */
+struct BackingId {
+    uint64_t dev;
+    uint64_t inode;
+    
+    bool operator==(const BackingId& other) const {
+        return dev == other.dev && inode == other.inode;
+    }
+};
+
+struct BackingIdHash {
+    size_t operator()(const BackingId& id) const {
+        return std::hash<uint64_t>()(id.inode) ^ (std::hash<uint64_t>()(id.dev) << 1);
+    }
+};
+
+/// Подключённые loop-устройства, проиндексированные по файлу образа
+using LoopMap = std::unordered_map<BackingId, LoopDeviceInfo, BackingIdHash>;
+
 /**
  * @brief Менеджер для работы с loop-устройствами
  * 
- * Использует утилиту losetup для подключения/отключения
- * файлов-образов как блочных устройств.
+ * Подключает и отключает файлы-образы как блочные устройства
+ * напрямую через ioctl: свободное устройство захватывается через
+ * /dev/loop-control (LOOP_CTL_GET_FREE) и настраивается одним
+ * вызовом LOOP_CONFIGURE, без запуска losetup.
  */
 class LoopManager {
 public:
@@ -22,10 +80,11 @@ public:
     /**
      * @brief Подключает файл как loop-устройство
      * @param image_path Путь к файлу образа
+     * @param options Настройки ввода-вывода (применяются только к новому устройству)
      * @return Путь к созданному loop-устройству (например, /dev/loop0)
      * @throws VaultError при ошибке подключения
      */
-    std::string attach(const std::string& image_path);
+    std::string attach(const std::string& image_path, const LoopOptions& options = LoopOptions());
     
     /**
      * @brief Отключает loop-устройство
@@ -34,6 +93,17 @@ public:
      */
     void detach(const std::string& loop_device);
     
+    /**
+     * @brief Перечитывает размер файла образа (LOOP_SET_CAPACITY)
+     * 
+     * Устройство остаётся подключённым, вышестоящие устройства
+     * (dm-crypt) видят новый размер сразу.
+     * 
+     * @param loop_device Путь к loop-устройству
+     * @throws VaultError при ошибке ioctl
+     */
+    void refresh_capacity(const std::string& loop_device);
+    
     /**
      * @brief Находит loop-устройство для файла
      * @param image_path Путь к файлу образа
@@ -41,11 +111,62 @@ public:
      */
     std::string find_loop_for_file(const std::string& image_path);
     
+    /**
+     * @brief Проверяет, что loop-устройство привязано именно к этому файлу
+     * 
+     * Один LOOP_GET_STATUS64 вместо обхода всех устройств: для устройства,
+     * записанного в реестре хранилищ.
+     * 
+     * @param loop_device Путь к loop-устройству
+     * @param image_path Путь к файлу образа
+     * @return false, если устройство свободно, отсутствует или привязано к другому файлу
+     */
+    bool is_bound_to(const std::string& loop_device, const std::string& image_path);
+    
     /**
      * @brief Получает список всех подключённых loop-устройств
-     * @return Вектор пар (loop-устройство, файл)
+     * @return Вектор пар (loop-устройство, файл), упорядоченный по номеру устройства
      */
     std::vector<std::pair<std::string, std::string>> list_attached();
+    
+    /**
+     * @brief Сканирует все подключённые loop-устройства за один проход
+     * 
+     * Читает /sys/block/loopN/loop/backing_file и уточняет
+     * устройство/inode образа через LOOP_GET_STATUS64.
+     * Дочерние процессы не запускаются.
+     * 
+     * @return Карта (устройство, inode образа) -> сведения о loop-устройстве
+     */
+    LoopMap scan();
+
+private:
+    /// Сколько раз повторять захват, если свободное устройство заняли параллельно
+    static constexpr int MAX_ATTACH_ATTEMPTS = 16;
+    
+    /**
+     * @brief Привязывает открытый файл к loop-устройству
+     * 
+     * Использует LOOP_CONFIGURE (Linux 5.8+), на старых ядрах
+     * откатывается на LOOP_SET_FD + LOOP_SET_STATUS64.
+     * 
+     * @param loop_fd Дескриптор loop-устройства
+     * @param file_fd Дескриптор файла образа
+     * @param image_path Путь к образу (записывается в lo_file_name)
+     * @param options Флаги direct I/O и размер блока
+     * @return true при успехе, false если устройство уже занято (EBUSY)
+     * @throws VaultError при прочих ошибках
+     */
+    bool configure(int loop_fd, int file_fd, const std::string& image_path,
+                   const LoopOptions& options);
+    
+    /**
+     * @brief Настраивает очередь запросов через sysfs
+     * @param loop_device Путь к loop-устройству
+     * @param options Значения read_ahead_kb и nr_requests
+     * @throws VaultError при ошибке записи в sysfs
+     */
+    void tune_queue(const std::string& loop_device, const LoopOptions& options);
 };
 
 } // namespace tpm_vault
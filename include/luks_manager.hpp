@@ -1,70 +1,196 @@
 #ifndef TPM_VAULT_LUKS_MANAGER_HPP
 #define TPM_VAULT_LUKS_MANAGER_HPP
 
+#include "crypt_backend.hpp"
+
 #include <string>
 #include <vector>
 #include <cstdint>
 
+// Forward declaration для дескриптора libcryptsetup
+struct crypt_device;
+
 namespace tpm_vault {
 
 /**
  * @brief Менеджер для работы с LUKS2 контейнерами
- * 
- * Выполняет операции через внешние команды cryptsetup.
- * Ключ передаётся через stdin для безопасности.
+ *
+ * Работает через libcryptsetup в том же процессе: ключ не покидает
+ * адресное пространство, а ошибки приходят как коды возврата
+ * библиотеки вместе с её сообщениями.
+ *
+ * Дескриптор crypt_device последнего отформатированного или открытого
+ * устройства удерживается до release(), поэтому последовательность
+ * format → open → close в TpmVault::create разбирает заголовок LUKS2
+ * и опрашивает устройство только один раз.
  */
-class LuksManager {
+class LuksManager : public CryptBackend {
 public:
     /**
      * @brief Конструктор
      */
     LuksManager() = default;
-    
+
+    /**
+     * @brief Деструктор - освобождает удерживаемый дескриптор
+     */
+    ~LuksManager() override;
+
+    // Запрещаем копирование
+    LuksManager(const LuksManager&) = delete;
+    LuksManager& operator=(const LuksManager&) = delete;
+
     /**
      * @brief Форматирует устройство как LUKS2
+     *
+     * В обычном режиме мастер-ключ тома генерируется библиотекой, а переданный
+     * ключ записывается в keyslot как парольная фраза (как при
+     * `cryptsetup luksFormat --key-file -`). В режиме fast_unlock переданный
+     * ключ сам становится мастер-ключом тома.
+     *
      * @param device Путь к устройству (например, /dev/loop0)
      * @param key Ключ шифрования (512 бит / 64 байта)
+     * @param options Параметры контейнера
      * @throws VaultError при ошибке форматирования
      */
-    void format(const std::string& device, const std::vector<uint8_t>& key);
-    
+    void format(const std::string& device, const std::vector<uint8_t>& key,
+                const LuksOptions& options = LuksOptions()) override;
+
     /**
      * @brief Открывает LUKS контейнер
+     *
+     * Сразу после format() активирует том по мастер-ключу из
+     * удерживаемого дескриптора, без повторного вычисления KDF.
+     *
      * @param device Путь к устройству
      * @param mapper_name Имя для device mapper (без /dev/mapper/)
      * @param key Ключ шифрования
+     * @param options Параметры контейнера, выбранные при форматировании
      * @throws VaultError при ошибке открытия
      */
-    void open(const std::string& device, const std::string& mapper_name, 
-              const std::vector<uint8_t>& key);
-    
+    void open(const std::string& device, const std::string& mapper_name,
+              const std::vector<uint8_t>& key, const LuksOptions& options = LuksOptions()) override;
+
     /**
      * @brief Закрывает LUKS контейнер
      * @param mapper_name Имя device mapper
      * @throws VaultError при ошибке закрытия
      */
-    void close(const std::string& mapper_name);
-    
+    void close(const std::string& mapper_name) override;
+
     /**
-     * @brief Проверяет, открыт ли контейнер
-     * @param mapper_name Имя device mapper
-     * @return true если контейнер открыт
+     * @brief Расширяет открытый LUKS-том (crypt_resize, как cryptsetup resize)
+     *
+     * Если ключ тома загружен в keyring ядра, его сначала извлекает keyslot
+     * (или проверяет digest при fast unlock): без ключа таблицу не перезагрузить.
+     *
+     * @throws VaultError при ошибке
      */
-    bool is_open(const std::string& mapper_name);
-    
+    void resize(const std::string& device, const std::string& mapper_name,
+                const std::vector<uint8_t>& key, const LuksOptions& options) override;
+
     /**
-     * @brief Возвращает путь к mapper устройству
-     * @param mapper_name Имя device mapper
-     * @return Полный путь /dev/mapper/<mapper_name>
+     * @brief Ключ нужен, только если ключ тома загружен в keyring ядра
+     *
+     * Иначе crypt_resize берёт ключ из активной таблицы.
+     */
+    bool resize_needs_key(const std::string& device, const std::string& mapper_name) override;
+
+    /**
+     * @brief Освобождает удерживаемый дескриптор crypt_device
+     *
+     * Вызывается перед отключением loop-устройства.
+     */
+    void release() override;
+
+    /**
+     * @brief Добавляет keyslot с новой парольной фразой
+     * @param device Путь к устройству
+     * @param key Действующий ключ (парольная фраза существующего keyslot)
+     * @param new_key Ключ для нового keyslot
+     * @throws VaultError при ошибке
+     */
+    void add_passphrase(const std::string& device, const std::vector<uint8_t>& key,
+                        const std::vector<uint8_t>& new_key);
+
+    /**
+     * @brief Удаляет keyslot, который открывается ключом
+     * @param device Путь к устройству
+     * @param key Парольная фраза удаляемого keyslot
+     * @throws VaultError если ключ не подходит ни к одному keyslot
+     */
+    void remove_passphrase(const std::string& device, const std::vector<uint8_t>& key);
+
+    /**
+     * @brief Уничтожает все keyslot заголовка, ключ не нужен
+     *
+     * Область keyslot затирается (crypt_keyslot_destroy), поэтому
+     * прежний ключ больше не извлекает ключ тома. Открытый том
+     * остаётся доступным до закрытия.
+     *
+     * @param device Путь к устройству
+     * @return Число уничтоженных keyslot
+     * @throws VaultError при ошибке
      */
-    static std::string get_mapper_path(const std::string& mapper_name);
+    int destroy_keyslots(const std::string& device);
+
+    /**
+     * @brief Возвращает флаги активации для профиля производительности
+     * @param profile Имя профиля
+     * @return Комбинация CRYPT_ACTIVATE_* флагов
+     * @throws VaultError для неизвестного профиля
+     */
+    static uint32_t get_profile_flags(const std::string& profile);
     
     /**
-     * @brief Формирует имя mapper для хранилища
-     * @param vault_name Имя хранилища
-     * @return Имя вида "tpm-vault-<name>"
+     * @brief Выбирает наибольший размер сектора шифрования, допустимый для устройства
+     *
+     * Сектор 4096 байт возможен, если логический блок устройства не больше
+     * 4096 байт, а его размер кратен 4096.
+     *
+     * @param device Путь к блочному устройству
+     * @return 4096 или 512
+     * @throws VaultError если устройство не удалось опросить
+     */
+    static uint32_t max_sector_size(const std::string& device);
+
+private:
+    /**
+     * @brief Возвращает дескриптор для устройства с загруженным заголовком
+     * @param device Путь к устройству
+     * @return Удерживаемый дескриптор (повторно используется для того же устройства)
+     * @throws VaultError если устройство не содержит LUKS2
      */
-    static std::string get_mapper_name(const std::string& vault_name);
+    struct crypt_device* acquire(const std::string& device);
+
+    /**
+     * @brief Создаёт дескриптор устройства без загрузки заголовка
+     * @param device Путь к устройству
+     * @throws VaultError при ошибке инициализации
+     */
+    void init_device(const std::string& device);
+
+    /**
+     * @brief Формирует сообщение об ошибке с кодом libcryptsetup
+     * @param what Описание операции
+     * @param rc Отрицательный errno, возвращённый библиотекой
+     * @return Сообщение вида "<what>: <strerror> (rc) — <последняя ошибка библиотеки>"
+     */
+    std::string error_message(const std::string& what, int rc) const;
+
+    /**
+     * @brief Callback журнала libcryptsetup, запоминает последнюю ошибку
+     */
+    static void log_callback(int level, const char* msg, void* usrptr);
+
+    /// Минимум итераций PBKDF2, допускаемый libcryptsetup
+    static constexpr uint32_t FAST_PBKDF2_ITERATIONS = 1000;
+
+    struct crypt_device* cd_ = nullptr;
+    std::string cd_device_;     ///< Устройство, к которому относится cd_
+    std::string cd_mapper_;     ///< Имя mapper, активированного через cd_
+    bool volume_key_known_ = false; ///< cd_ хранит мастер-ключ после format()
+    std::string last_error_;
 };
 
 } // namespace tpm_vault
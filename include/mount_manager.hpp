@@ -0,0 +1,85 @@
+#ifndef TPM_VAULT_MOUNT_MANAGER_HPP
+#define TPM_VAULT_MOUNT_MANAGER_HPP
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+namespace tpm_vault {
+
+/**
+ * @brief Монтирование файловых систем хранилищ без запуска mount/umount
+ *
+ * Монтирует через fsopen/fsconfig/fsmount/move_mount (Linux 5.2+): все
+ * параметры передаются до создания суперблока, ошибки приходят с текстом
+ * из журнала контекста ФС. На ядрах и glibc без этого API используется
+ * mount(2). Размонтирование — umount2.
+ */
+class MountManager {
+public:
+    /**
+     * @brief Конструктор
+     */
+    MountManager() = default;
+
+    /**
+     * @brief Монтирует устройство
+     * @param device Блочное устройство (например, /dev/mapper/tpm-vault-x)
+     * @param target Существующий каталог
+     * @param fs_type Тип файловой системы ("ext4", ...)
+     * @param options Параметры вида "key=value" или "flag"; ro, nosuid, nodev,
+     *        noexec и *atime относятся к точке монтирования, остальные — к ФС
+     * @throws VaultError при ошибке, с сообщением ядра, если оно есть
+     */
+    void mount(const std::string& device, const std::string& target, const std::string& fs_type,
+               const std::vector<std::string>& options = {});
+
+    /**
+     * @brief Размонтирует каталог; ничего не делает, если он не точка монтирования
+     * @param target Точка монтирования
+     * @throws VaultError при ошибке (например, EBUSY)
+     */
+    void unmount(const std::string& target);
+
+    /**
+     * @brief Проверяет, является ли каталог корнем монтирования
+     *
+     * Берёт STATX_ATTR_MOUNT_ROOT из statx (Linux 5.8+), иначе ищет путь
+     * в /proc/self/mountinfo за один проход.
+     *
+     * @param target Абсолютный путь
+     * @return true если смонтирован
+     */
+    bool is_mounted(const std::string& target);
+
+    /**
+     * @brief Снимок таблицы монтирования за один проход /proc/self/mountinfo
+     *
+     * Для нескольких монтирований в одну точку остаётся верхнее (последнее).
+     *
+     * @return Точка монтирования → номер устройства (dev_t) из поля major:minor
+     */
+    std::unordered_map<std::string, uint64_t> mount_table();
+
+private:
+    /**
+     * @brief Монтирует через fsopen API
+     * @param options Параметры файловой системы для fsconfig
+     * @param flags Флаги MS_* точки монтирования (ro, nosuid, noatime, ...)
+     * @return false, если API недоступен (ENOSYS)
+     * @throws VaultError при прочих ошибках
+     */
+    bool mount_fs_context(const std::string& device, const std::string& target,
+                          const std::string& fs_type, const std::vector<std::string>& options,
+                          unsigned long flags);
+
+    /**
+     * @brief Ищет точку монтирования в /proc/self/mountinfo
+     */
+    bool find_in_mountinfo(const std::string& target);
+};
+
+} // namespace tpm_vault
+
+#endif // TPM_VAULT_MOUNT_MANAGER_HPP
@@ -5,6 +5,7 @@
 #include <vector>
 #include <cstdint>
 #include <memory>
+#include <unordered_set>
 
 // Forward declaration для FAPI контекста
 struct FAPI_CONTEXT;
@@ -36,6 +37,12 @@ public:
     
     /**
      * @brief Выполняет provisioning TPM (создание иерархии)
+     * 
+     * После успеха записывает отметку PROVISIONED_MARKER; пока она есть,
+     * Fapi_Provision не вызывается. Если отметка устарела (TPM очищен)
+     * и seal() не находит родительский ключ, provisioning выполняется
+     * заново.
+     * 
      * @throws VaultError при ошибке (кроме "уже provisioned")
      */
     void provision();
@@ -65,10 +72,59 @@ public:
     
     /**
      * @brief Проверяет существование sealed object
+     * 
+     * Запрашивает у FAPI описание объекта по точному пути (без обхода
+     * хранилища ключей); при включённом индексе — ищет имя в нём.
+     * 
      * @param name Имя хранилища
      * @return true если объект существует
+     * @throws VaultError при ошибке FAPI, отличной от "объекта нет"
      */
     bool exists(const std::string& name);
+    
+    /**
+     * @brief Проверяет существование через полный Fapi_List "/HS/SRK"
+     * 
+     * Прежний способ, время которого растёт с числом объектов;
+     * оставлен для сравнения в `bench --lookup`.
+     * 
+     * @param name Имя хранилища
+     */
+    bool exists_by_list(const std::string& name);
+    
+    /**
+     * @brief Включает индекс имён для exists()
+     * 
+     * Индекс строится одним Fapi_List при первом обращении и далее
+     * обновляется seal() и remove() этого экземпляра. Объекты, созданные
+     * или удалённые другими процессами, в нём не видны.
+     * 
+     * @param enabled Включить (false — сбросить индекс)
+     */
+    void set_index_enabled(bool enabled);
+    
+    /**
+     * @brief Запечатывает корневой секрет хоста
+     * 
+     * Один объект на хост, из которого выводятся ключи хранилищ
+     * с key.source=derived (см. KeyHierarchy).
+     * 
+     * @param data Корневой секрет (максимум 128 байт)
+     * @throws VaultError при ошибке запечатывания
+     */
+    void seal_root(const std::vector<uint8_t>& data);
+    
+    /**
+     * @brief Извлекает корневой секрет хоста
+     * @return Корневой секрет
+     * @throws VaultError если его нет или PCR изменились
+     */
+    std::vector<uint8_t> unseal_root();
+    
+    /**
+     * @brief Проверяет, запечатан ли корневой секрет хоста
+     */
+    bool has_root();
 
 private:
     /**
@@ -83,17 +139,62 @@ private:
      */
     std::string get_policy_path() const;
     
+    /**
+     * @brief Вызывает Fapi_Provision и записывает отметку
+     */
+    void run_provision();
+    
     /**
      * @brief Импортирует политику PCR если ещё не импортирована
      */
     void ensure_pcr_policy();
     
+    /**
+     * @brief Создаёт sealed object по пути FAPI, заменяя существующий
+     */
+    void seal_object(const std::string& path, const std::vector<uint8_t>& data);
+    
+    /**
+     * @brief Извлекает данные sealed object
+     * @param path Путь FAPI
+     * @param owner Чей это объект — для сообщения об ошибке
+     */
+    std::vector<uint8_t> unseal_object(const std::string& path, const std::string& owner);
+    
+    /**
+     * @brief Удаляет sealed object
+     * @param path Путь FAPI
+     * @param owner Чей это объект — для сообщения об ошибке
+     */
+    void remove_object(const std::string& path, const std::string& owner);
+    
+    /**
+     * @brief Проверяет наличие объекта по пути FAPI (Fapi_GetDescription)
+     */
+    bool object_exists(const std::string& path);
+    
+    /**
+     * @brief Возвращает пути всех объектов под /HS/SRK без префикса профиля
+     */
+    std::vector<std::string> list_objects();
+    
     FAPI_CONTEXT* ctx_;
     bool policy_imported_;
+    bool provision_skipped_ = false;  ///< provision() поверил отметке
+    
+    bool index_enabled_ = false;
+    bool index_loaded_ = false;
+    std::unordered_set<std::string> index_;  ///< Пути sealed objects хранилищ
+    
+    /// Отметка о выполненном provisioning
+    static const char* PROVISIONED_MARKER;
     
     // PCR policy JSON для sha256:0,7
     static const char* PCR_POLICY_JSON;
     static const char* POLICY_PATH;
+    
+    /// Путь корневого секрета хоста
+    static const char* ROOT_PATH;
 };
 
 } // namespace tpm_vault
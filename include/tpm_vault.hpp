@@ -1,16 +1,27 @@
 #ifndef TPM_VAULT_HPP
 #define TPM_VAULT_HPP
 
+#include "loop_manager.hpp"
+#include "luks_manager.hpp"
+#include "vault_registry.hpp"
+
 #include <string>
 #include <memory>
 #include <vector>
+#include <chrono>
+#include <functional>
 
 namespace tpm_vault {
 
 // Forward declarations
 class TpmManager;
-class LuksManager;
-class LoopManager;
+class DmCryptManager;
+class MountManager;
+class VaultMetadata;
+class SecureBuffer;
+struct CipherBenchResult;
+struct TransferStats;
+struct BackupStats;
 
 /**
  * @brief Информация об открытом хранилище
@@ -21,6 +32,79 @@ struct VaultInfo {
     std::string loop_device;    ///< Loop-устройство
     std::string mapper_device;  ///< Device mapper устройство
     std::string mount_point;    ///< Точка монтирования
+    uint64_t loop_rdev = 0;     ///< Номер loop-устройства (dev_t)
+    uint64_t mapper_rdev = 0;   ///< Номер устройства device mapper (dev_t)
+    uint64_t total_bytes = 0;   ///< Ёмкость файловой системы (statvfs)
+    uint64_t used_bytes = 0;    ///< Занято
+    uint64_t available_bytes = 0; ///< Доступно непривилегированным пользователям
+};
+
+/**
+ * @brief Результат операции над одним хранилищем из нескольких
+ */
+struct VaultResult {
+    std::string name;   ///< Имя хранилища
+    std::string error;  ///< Текст ошибки, пусто при успехе
+    
+    bool ok() const { return error.empty(); }
+};
+
+/**
+ * @brief Длительность одного шага create(), open() или close()
+ */
+struct PhaseTiming {
+    std::string phase;                   ///< Имя шага ("attach", "format", "seal", ...)
+    std::chrono::microseconds duration;  ///< Время выполнения шага
+};
+
+/**
+ * @brief Параметры хранилища, выбираемые при создании
+ * 
+ * Сохраняются в файле метаданных <name>.vault рядом с образом
+ * и повторно применяются при каждом открытии.
+ */
+struct VaultOptions {
+    LoopOptions loop;   ///< Настройки ввода-вывода loop-устройства
+    LuksOptions luks;   ///< Параметры шифрованного тома
+    
+    /// Реализация тома: "luks2" (LuksManager) или "raw" (DmCryptManager, без заголовка)
+    std::string backend = "luks2";
+    
+    /// Источник ключа: "sealed" (свой sealed object в TPM) или "derived" (HKDF от корня хоста)
+    std::string key_source = "sealed";
+    
+    /// Соль вывода ключа в hex (для key_source = "derived"); create() генерирует её сам
+    std::string key_salt;
+    
+    /// Имя sealed object в TPM, если оно не совпадает с именем хранилища
+    /// (хранилище взято из пула — ключ остался под идентификатором пула)
+    std::string seal_name;
+    
+    /// Тонкий образ: размер задаётся ftruncate, место выделяется по мере записи
+    bool sparse = false;
+    
+    /// Файловая система и её профиль (FsProfiles): mkfs при создании, параметры монтирования
+    std::string fs_type = "ext4";
+    std::string fs_profile = "default";
+};
+
+/**
+ * @brief Хранилище, заранее подготовленное в пуле (pool fill)
+ */
+struct PoolEntry {
+    std::string id;        ///< Имя хранилища в пуле (".pool-<hex>")
+    std::string spec;      ///< Размер и параметры create(), под которые оно подготовлено
+    size_t size = 0;       ///< Размер образа
+    VaultOptions options;  ///< Параметры из метаданных
+};
+
+/**
+ * @brief Состояние пула текущего каталога
+ */
+struct PoolStatus {
+    std::vector<PoolEntry> entries;  ///< Готовые хранилища
+    uint64_t hits = 0;               ///< create(), взявшие хранилище из пула
+    uint64_t misses = 0;             ///< create(), не нашедшие подходящего
 };
 
 /**
@@ -37,9 +121,33 @@ public:
     /// Размер ключа шифрования (512 бит = 64 байта)
     static constexpr size_t KEY_SIZE = 64;
     
+    /// Значение LuksOptions::cipher, включающее выбор шифра по замеру
+    static constexpr const char* CIPHER_AUTO = "auto";
+    
+    /// Значения VaultOptions::backend
+    static constexpr const char* BACKEND_LUKS2 = "luks2";
+    static constexpr const char* BACKEND_RAW = "raw";
+    
+    /// Значения VaultOptions::key_source
+    static constexpr const char* KEY_SEALED = "sealed";
+    static constexpr const char* KEY_DERIVED = "derived";
+    
+    /// Префикс имён хранилищ пула: <prefix><hex>.img и .vault в текущем каталоге
+    static constexpr const char* POOL_PREFIX = ".pool-";
+    
+    /// Счётчики попаданий в пул (создаётся pool_fill)
+    static constexpr const char* POOL_STATS = ".pool.stats";
+    
+    /// Случайная часть идентификатора хранилища пула
+    static constexpr size_t POOL_ID_BYTES = 8;
+    
     /**
      * @brief Конструктор
-     * @throws VaultError при ошибке инициализации TPM
+     * 
+     * TPM не затрагивается: контекст FAPI создаётся при первой операции,
+     * которой нужен ключ.
+     * 
+     * @throws VaultError без прав root
      */
     TpmVault();
     
@@ -48,13 +156,55 @@ public:
      */
     ~TpmVault();
     
+    /**
+     * @brief Сразу инициализирует контекст FAPI и provisioning
+     * 
+     * Для демона: первый запрос не должен платить за инициализацию.
+     * 
+     * @throws VaultError при ошибке инициализации TPM
+     */
+    void prepare_tpm();
+    
     /**
      * @brief Создаёт новое зашифрованное хранилище
+     * 
+     * Если в пуле есть хранилище того же размера и с теми же параметрами,
+     * оно переименовывается в <name> (ключ остаётся в TPM под идентификатором
+     * пула, см. VaultOptions::seal_name). Иначе образ размечается с нуля.
+     * 
      * @param name Имя хранилища (без расширения)
      * @param size Размер образа в байтах
+     * @param options Параметры хранилища
      * @throws VaultError при ошибке создания
      */
-    void create(const std::string& name, size_t size = DEFAULT_SIZE);
+    void create(const std::string& name, size_t size = DEFAULT_SIZE,
+                const VaultOptions& options = VaultOptions());
+    
+    /**
+     * @brief Готовит хранилища в пуле текущего каталога
+     * 
+     * Каждое проходит полный путь create(): образ, LUKS2 или raw, mkfs,
+     * ключ в TPM под идентификатором пула.
+     * 
+     * @param size Размер образа
+     * @param options Параметры, с которыми create() сможет их забрать
+     * @param count Сколько готовых хранилищ с такими параметрами должно быть
+     * @return Сколько подготовлено сейчас
+     * @throws VaultError при ошибке подготовки
+     */
+    size_t pool_fill(size_t size, const VaultOptions& options, size_t count);
+    
+    /**
+     * @brief Готовые хранилища пула и счётчики попаданий
+     */
+    PoolStatus pool_status() const;
+    
+    /**
+     * @brief Удаляет готовые хранилища пула и их ключи из TPM
+     * @return Число удалённых
+     * @throws VaultError при ошибке TPM
+     */
+    size_t pool_drain();
     
     /**
      * @brief Открывает существующее хранилище
@@ -63,6 +213,18 @@ public:
      */
     void open(const std::string& name);
     
+    /**
+     * @brief Открывает несколько хранилищ
+     * 
+     * Ключи извлекаются из TPM по очереди в вызывающем потоке, а подключение
+     * loop, активация тома и монтирование уже расшифрованных хранилищ идут
+     * параллельно в пуле потоков. Ошибка одного хранилища не прерывает остальные.
+     * 
+     * @param names Имена хранилищ
+     * @return Результат для каждого имени в том же порядке
+     */
+    std::vector<VaultResult> open_many(const std::vector<std::string>& names);
+    
     /**
      * @brief Закрывает хранилище
      * @param name Имя хранилища
@@ -70,73 +232,470 @@ public:
      */
     void close(const std::string& name);
     
+    /**
+     * @brief Закрывает несколько хранилищ параллельно
+     * @param names Имена хранилищ
+     * @return Результат для каждого имени в том же порядке
+     */
+    std::vector<VaultResult> close_many(const std::vector<std::string>& names);
+    
+    /**
+     * @brief Увеличивает хранилище
+     * 
+     * Образ дорастает fallocate (или ftruncate для тонкого), loop-устройство
+     * перечитывает размер (LOOP_SET_CAPACITY), том dm-crypt перезагружается
+     * с новой длиной, файловая система растёт смонтированной. Открытое
+     * хранилище остаётся открытым; закрытое открывается на время роста
+     * и закрывается. Шаги — в last_phases().
+     * 
+     * Размер, равный текущему размеру образа, допустим: так завершается
+     * прерванный рост.
+     * 
+     * @param name Имя хранилища
+     * @param new_size Новый размер образа в байтах
+     * @throws VaultError если размер меньше текущего или при ошибке шага
+     */
+    void grow(const std::string& name, size_t new_size);
+    
+    /**
+     * @brief Копирует образ и метаданные закрытого хранилища
+     * 
+     * Файл копируется reflink или copy_file_range с сохранением дыр
+     * (ImageTransfer); метаданные ложатся рядом (<dest>.vault).
+     * Ключ не копируется: sealed object остаётся в TPM этого хоста.
+     * 
+     * @param name Имя хранилища
+     * @param destination Путь к копии образа, каталог для <name>.img
+     *                    или "-" — поток в stdout
+     * @throws VaultError если хранилище открыто, приёмник существует или при ошибке
+     */
+    TransferStats export_vault(const std::string& name, const std::string& destination);
+    
+    /**
+     * @brief Создаёт хранилище из копии образа или потока
+     * 
+     * Метаданные берутся из <source>.vault или из потока. Обычный
+     * (не тонкий) образ после копирования снова получает всё место.
+     * 
+     * @param source Путь к образу или "-" — поток из stdin
+     * @param name Имя нового хранилища
+     * @throws VaultError если хранилище открыто, <name>.img существует или при ошибке;
+     *         частично записанный образ удаляется
+     */
+    TransferStats import_vault(const std::string& source, const std::string& name);
+    
+    /**
+     * @brief Инкрементальная копия образа закрытого хранилища
+     * 
+     * Пишутся только блоки, изменившиеся с прошлой копии (ChunkBackup),
+     * метаданные копируются в <dir>/<name>.vault. Ключ не нужен.
+     * 
+     * @param name Имя хранилища
+     * @param dir Каталог копий
+     * @param chunk_size Размер блока
+     * @throws VaultError если хранилище открыто или при ошибке
+     */
+    BackupStats backup(const std::string& name, const std::string& dir, size_t chunk_size);
+    
+    /**
+     * @brief Восстанавливает хранилище из последней копии в каталоге
+     * @param dir Каталог копий
+     * @param name Имя хранилища
+     * @throws VaultError если хранилище открыто, <name>.img существует,
+     *         блок копии отсутствует или повреждён; частично записанный образ удаляется
+     */
+    BackupStats restore(const std::string& dir, const std::string& name);
+    
     /**
      * @brief Возвращает список открытых хранилищ
-     * @return Вектор информации о хранилищах
+     *
+     * Кандидаты — записи реестра и образы *.img текущей директории,
+     * подключённые к loop (хранилища, открытые до появления реестра).
+     * Каждый сверяется с одним снимком loop-устройств, /sys/block/dm-*
+     * и mountinfo; для открытых — statvfs точки монтирования.
+     *
+     * @param everywhere Все хранилища реестра, а не только текущей директории
+     * @return Открытые хранилища, по имени
      */
-    std::vector<VaultInfo> list();
+    std::vector<VaultInfo> list(bool everywhere = false);
     
     /**
-     * @brief Удаляет sealed object из TPM
+     * @brief Уничтожает ключ хранилища
+     * 
+     * Для собственного ключа удаляет sealed object из TPM. Для выводимого
+     * уничтожает keyslot заголовка LUKS2 и затем соль из метаданных: корень
+     * хоста общий и остаётся, а копии соли есть в резервных копиях и экспорте.
+     * 
      * @param name Имя хранилища
-     * @throws VaultError при ошибке
+     * @throws VaultError при ошибке; для выводимого ключа raw-тома или
+     *         fast unlock (ключ тома не защищён keyslot, уничтожить нечего)
      * 
      * @note Файл образа не удаляется. После wipe открыть
      *       существующий образ будет невозможно.
      */
     void wipe(const std::string& name);
+    
+    /**
+     * @brief Переводит хранилище с собственного sealed object на выводимый ключ
+     * 
+     * В заголовок LUKS2 добавляется keyslot для ключа, выведенного из корня
+     * хоста, затем в метаданные записывается соль, удаляется прежний keyslot
+     * и sealed object хранилища. Хранилище может быть открыто.
+     * 
+     * @param name Имя хранилища
+     * @throws VaultError для raw и fast unlock (ключ TPM там — мастер-ключ тома)
+     *         или при ошибке
+     */
+    void migrate_key(const std::string& name);
+    
+    /**
+     * @brief Время вывода ключа LUKS при последнем create() или open()
+     * @return Длительность создания keyslot (create) или активации тома (open);
+     *         для тома без заголовка — время ioctl-запросов device-mapper
+     */
+    std::chrono::microseconds last_kdf_time() const;
+    
+    /**
+     * @brief Длительности шагов последнего create(), open(), close() или grow()
+     * @return Шаги в порядке выполнения (при ошибке — завершённые до неё)
+     */
+    const std::vector<PhaseTiming>& last_phases() const;
+    
+    /**
+     * @brief Загружает параметры хранилища из метаданных
+     * @param name Имя хранилища
+     * @return Параметры (по умолчанию, если метаданных нет)
+     */
+    VaultOptions load_options(const std::string& name) const;
+    
+    /**
+     * @brief Возвращает путь к точке монтирования (рядом с образом, см. get_image_path)
+     * @param name Имя хранилища
+     * @return "<cwd>/<n>" или точка монтирования из реестра
+     */
+    std::string get_mount_path(const std::string& name) const;
 
 private:
+    /**
+     * @brief Возвращает менеджер TPM, создавая его при первом обращении
+     * @throws VaultError при ошибке инициализации TPM
+     */
+    TpmManager& tpm();
+    
     /**
      * @brief Возвращает путь к файлу образа
+     * 
+     * Образ из текущей директории; если его здесь нет, а в реестре
+     * записан существующий образ с этим именем — путь из реестра.
+     * 
      * @param name Имя хранилища
      * @return Путь вида "./<n>.img"
      */
     std::string get_image_path(const std::string& name) const;
     
     /**
-     * @brief Возвращает путь к точке монтирования
+     * @brief Ищет хранилище в реестре, если в текущей директории его нет
      * @param name Имя хранилища
-     * @return Путь вида "./<n>"
+     * @param entry Запись реестра
+     * @return true, если образа нет здесь, а образ из записи существует
      */
-    std::string get_mount_path(const std::string& name) const;
+    bool find_registered(const std::string& name, RegistryEntry& entry) const;
+    
+    /**
+     * @brief Записывает хранилище в реестр (если образ существует)
+     * @param name Имя хранилища
+     * @param loop_device Loop-устройство открытого хранилища (пусто — закрыто)
+     * @throws VaultError при ошибке записи
+     */
+    void register_vault(const std::string& name, const std::string& loop_device);
+    
+    /**
+     * @brief Находит loop-устройство хранилища
+     * 
+     * Устройство из реестра проверяется одним ioctl; обход всех
+     * loop-устройств — только если записи нет или она устарела.
+     * 
+     * @return Путь к устройству или пустая строка
+     */
+    std::string find_loop(const std::string& name, const std::string& image_path);
+    
+    /**
+     * @brief Возвращает путь к файлу метаданных
+     * @param name Имя хранилища
+     * @return Путь вида "./<n>.vault"
+     */
+    std::string get_metadata_path(const std::string& name) const;
     
     /**
-     * @brief Создаёт файл образа указанного размера
-     * @param path Путь к файлу
+     * @brief Сохраняет параметры хранилища в метаданные
+     * @param name Имя хранилища
+     * @param options Параметры
+     */
+    void save_options(const std::string& name, const VaultOptions& options) const;
+    
+    /**
+     * @brief Возвращает реализацию тома, выбранную для хранилища
+     * @param options Параметры хранилища
+     * @return LuksManager или DmCryptManager
+     * @throws VaultError для неизвестного значения backend
+     */
+    CryptBackend& backend_for(const VaultOptions& options);
+    
+    /**
+     * @brief Создаёт отдельный экземпляр реализации тома
+     * 
+     * Для параллельных задач: LuksManager хранит состояние между вызовами.
+     * 
+     * @param options Параметры хранилища
+     * @throws VaultError для неизвестного значения backend
+     */
+    static std::unique_ptr<CryptBackend> make_backend(const VaultOptions& options);
+    
+    /// Обратный вызов по завершении шага операции (см. last_phases())
+    using PhaseMark = std::function<void(const char* phase)>;
+    
+    /**
+     * @brief Образ, ключ и ФС хранилища — медленный путь create()
+     * @param name Имя хранилища (или хранилища пула)
+     * @param size Размер образа в байтах
+     * @param options Параметры (seal_name — под каким именем запечатать ключ)
+     * @throws VaultError при ошибке; созданные файлы удаляются
+     */
+    void build(const std::string& name, size_t size, const VaultOptions& options);
+    
+    /**
+     * @brief Строка параметров create(), по которой хранилище пула подходит запросу
+     */
+    static std::string pool_spec(size_t size, const VaultOptions& options);
+    
+    /**
+     * @brief Готовые хранилища пула в текущем каталоге
+     */
+    std::vector<PoolEntry> pool_entries() const;
+    
+    /**
+     * @brief Забирает подходящее хранилище из пула под именем name
+     * @return false, если подходящего нет
+     * @throws VaultError при ошибке переименования
+     */
+    bool claim_pooled(const std::string& name, size_t size, const VaultOptions& options);
+    
+    /**
+     * @brief Увеличивает счётчик попаданий или промахов, если пул заведён
+     */
+    void count_pool_claim(bool hit);
+    
+    /**
+     * @brief Проверяет, что хранилище существует и ещё не открыто
+     * @throws VaultError иначе
+     */
+    void check_can_open(const std::string& name);
+    
+    /**
+     * @brief Проверяет, что хранилища нет среди открытых (list())
+     * @throws VaultError иначе
+     */
+    void check_closed(const std::string& name);
+    
+    /**
+     * @brief Имя sealed object хранилища: seal_name из метаданных или имя хранилища
+     */
+    static std::string seal_name_of(const std::string& name, const VaultOptions& options);
+    
+    /**
+     * @brief Извлекает мастер-ключ хранилища из TPM
+     * @param name Имя sealed object
+     * @param key Буфер размером KEY_SIZE
+     * @throws VaultError при ошибке TPM
+     */
+    void unseal_key(const std::string& name, SecureBuffer& key);
+    
+    /**
+     * @brief Возвращает корневой секрет хоста
+     * 
+     * Извлекается из TPM один раз за верхнеуровневую операцию
+     * (RootKeyScope) и стирается по её завершении; демон между
+     * запросами корень не держит.
+     * 
+     * @param create Создать и запечатать корень, если его ещё нет
+     * @throws VaultError при ошибке TPM
+     */
+    const SecureBuffer& root_key(bool create);
+    
+    /**
+     * @brief Держит корень хоста до конца верхнеуровневой операции
+     * 
+     * Вложенные области (create → build) корень не трогают;
+     * внешняя при выходе стирает его.
+     */
+    class RootKeyScope {
+    public:
+        explicit RootKeyScope(TpmVault& vault) : vault_(vault) { ++vault_.root_scopes_; }
+        ~RootKeyScope() {
+            if (--vault_.root_scopes_ == 0) {
+                vault_.root_key_.reset();
+            }
+        }
+        RootKeyScope(const RootKeyScope&) = delete;
+        RootKeyScope& operator=(const RootKeyScope&) = delete;
+    private:
+        TpmVault& vault_;
+    };
+    
+    /**
+     * @brief Получает мастер-ключ хранилища из его источника
+     * @param name Имя хранилища
+     * @param options Параметры хранилища (key_source, key_salt)
+     * @param key Буфер размером KEY_SIZE
+     * @param mark Отметка шагов (может быть пустой)
+     * @throws VaultError при ошибке TPM или неизвестном источнике
+     */
+    void load_key(const std::string& name, const VaultOptions& options, SecureBuffer& key,
+                  const PhaseMark& mark);
+    
+    /**
+     * @brief Подключает образ, активирует том, монтирует файловую систему
+     *        и записывает устройства в реестр
+     * 
+     * При ошибке откатывает выполненные шаги.
+     * 
+     * @param name Имя хранилища
+     * @param options Параметры хранилища
+     * @param crypt Реализация тома
+     * @param key Мастер-ключ
+     * @param mark Отметка шагов (может быть пустой)
+     * @return Время активации тома
+     * @throws VaultError при ошибке
+     */
+    std::chrono::microseconds activate(const std::string& name, const VaultOptions& options,
+                                       CryptBackend& crypt, SecureBuffer& key, const PhaseMark& mark);
+    
+    /**
+     * @brief Размонтирует, закрывает том, отключает loop и отмечает закрытие в реестре
+     * 
+     * Выполняет все шаги даже после ошибки одного из них.
+     * 
+     * @param name Имя хранилища
+     * @param crypt Реализация тома
+     * @param mark Отметка шагов (может быть пустой)
+     * @throws VaultError первая из возникших ошибок
+     */
+    void deactivate(const std::string& name, CryptBackend& crypt, const PhaseMark& mark);
+    
+    /**
+     * @brief Подбирает шифр и размер сектора для режима --cipher auto
+     * @param device Loop-устройство, на котором будет создан контейнер
+     * @param luks Параметры LUKS, дополняются выбранными значениями
+     * @return Результаты замера шифров
+     */
+    std::vector<CipherBenchResult> select_cipher(const std::string& device, LuksOptions& luks);
+    
+    /**
+     * @brief Записывает результаты замера шифров в метаданные
+     * @param name Имя хранилища
+     * @param results Результаты замера
+     */
+    void record_cipher_benchmark(const std::string& name,
+                                 const std::vector<CipherBenchResult>& results) const;
+    
+    /**
+     * @brief Создаёт файл образа ровно указанного размера
+     * 
+     * Место выделяется fallocate(2); если файловая система его не умеет
+     * (NFS, overlayfs), файл заполняется нулями. Тонкий образ только
+     * получает размер через ftruncate.
+     * 
+     * @param path Путь к файлу (не должен существовать)
      * @param size Размер в байтах
+     * @param sparse Не выделять место заранее
+     * @throws VaultError при ошибке; частично созданный файл удаляется
      */
-    void create_image_file(const std::string& path, size_t size);
+    void create_image_file(const std::string& path, size_t size, bool sparse);
     
     /**
-     * @brief Создаёт файловую систему ext4
-     * @param device Путь к устройству
+     * @brief Увеличивает файл образа до нового размера
+     * 
+     * Новый хвост выделяется так же, как в create_image_file().
+     * 
+     * @param path Путь к существующему образу
+     * @param old_size Текущий размер
+     * @param new_size Новый размер (не меньше текущего)
+     * @param sparse Не выделять место заранее
+     * @throws VaultError при ошибке; размер образа возвращается к прежнему
+     */
+    void extend_image_file(const std::string& path, size_t old_size, size_t new_size, bool sparse);
+    
+    /**
+     * @brief Выделяет место под диапазон файла образа
+     * @param fd Дескриптор образа, открытого на запись
+     * @param path Путь к образу (для сообщений об ошибках)
+     * @param offset Начало диапазона; после вызова размер файла не меньше offset + length
+     * @param length Длина диапазона
+     * @param sparse Только ftruncate
+     * @throws VaultError при ошибке
      */
-    void create_filesystem(const std::string& device);
+    void allocate_image(int fd, const std::string& path, size_t offset, size_t length, bool sparse);
     
     /**
-     * @brief Монтирует файловую систему
+     * @brief Создаёт файл образа и заполняет его
+     * @param path Путь к файлу (не должен существовать)
+     * @param fill Запись содержимого в открытый дескриптор
+     * @throws VaultError при ошибке; частично записанный файл удаляется
+     */
+    void write_image_file(const std::string& path, const std::function<void(int fd)>& fill);
+    
+    /**
+     * @brief Выделяет место под дыры скопированного образа (fallocate без записи)
+     * 
+     * Для обычного образа после import/restore; ФС без fallocate пропускается.
+     * 
+     * @param fd Дескриптор образа
+     * @param path Путь к образу (для сообщений об ошибках)
+     * @param size Размер образа
+     * @throws VaultError при нехватке места или другой ошибке
+     */
+    void fill_image_holes(int fd, const std::string& path, uint64_t size);
+    
+    /**
+     * @brief Создаёт файловую систему по профилю хранилища
      * @param device Путь к устройству
-     * @param mount_point Точка монтирования
+     * @param options Параметры хранилища (fs_type, fs_profile)
      */
-    void mount_filesystem(const std::string& device, const std::string& mount_point);
+    void create_filesystem(const std::string& device, const VaultOptions& options);
     
     /**
-     * @brief Размонтирует файловую систему
+     * @brief Монтирует файловую систему с параметрами её профиля
+     * @param device Путь к устройству
      * @param mount_point Точка монтирования
+     * @param options Параметры хранилища (fs_type, fs_profile)
      */
-    void unmount_filesystem(const std::string& mount_point);
+    void mount_filesystem(const std::string& device, const std::string& mount_point,
+                          const VaultOptions& options);
     
     /**
-     * @brief Проверяет, смонтирована ли точка
-     * @param mount_point Путь к точке монтирования
-     * @return true если смонтирована
+     * @brief Растягивает файловую систему на весь том
+     * 
+     * ext4, XFS и btrfs растут смонтированными; f2fs на время
+     * resize.f2fs размонтируется.
+     * 
+     * @param device Путь к устройству
+     * @param mount_point Точка монтирования (файловая система смонтирована)
+     * @param options Параметры хранилища (fs_type, fs_profile)
      */
-    bool is_mounted(const std::string& mount_point);
+    void grow_filesystem(const std::string& device, const std::string& mount_point,
+                         const VaultOptions& options);
     
-    std::unique_ptr<TpmManager> tpm_;
+    std::unique_ptr<TpmManager> tpm_;  ///< Создаётся в tpm()
     std::unique_ptr<LuksManager> luks_;
+    std::unique_ptr<DmCryptManager> dm_crypt_;
     std::unique_ptr<LoopManager> loop_;
+    std::unique_ptr<MountManager> mount_;
+    std::unique_ptr<SecureBuffer> root_key_;  ///< Только внутри RootKeyScope
+    int root_scopes_ = 0;
+    VaultRegistry registry_;
+    
+    std::chrono::microseconds kdf_time_{0};
+    std::vector<PhaseTiming> phases_;
 };
 
 } // namespace tpm_vault
@@ -0,0 +1,93 @@
+#ifndef TPM_VAULT_TRACE_HPP
+#define TPM_VAULT_TRACE_HPP
+
+#include <string>
+#include <chrono>
+#include <atomic>
+#include <cstdint>
+
+namespace tpm_vault {
+
+/**
+ * @brief Сборщик трассировки в формате Chrome trace event
+ *
+ * Включается путём к файлу (переменная TPM_VAULT_TRACE или опция --trace).
+ * Спаны копятся в памяти и записываются в файл при finish(); результат
+ * открывается в Perfetto или chrome://tracing.
+ */
+class Tracer {
+public:
+    /// Переменная окружения с путём к файлу трассировки
+    static constexpr const char* ENV_VAR = "TPM_VAULT_TRACE";
+
+    /**
+     * @brief Включает трассировку
+     * @param path Файл, в который finish() запишет события
+     */
+    static void start(const std::string& path);
+
+    /**
+     * @brief Записывает накопленные события и выключает трассировку
+     * @throws VaultError если файл не удалось записать
+     */
+    static void finish();
+
+    /**
+     * @brief Включена ли трассировка
+     */
+    static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Добавляет завершённый спан
+     * @param name Имя спана
+     * @param detail Дополнительные сведения (команда, путь FAPI), может быть пустым
+     * @param start Начало спана
+     * @param end Конец спана
+     */
+    static void record(const char* name, const std::string& detail,
+                       std::chrono::steady_clock::time_point start,
+                       std::chrono::steady_clock::time_point end);
+
+private:
+    static std::atomic<bool> enabled_;
+};
+
+/**
+ * @brief RAII-спан: замеряет время от конструктора до деструктора
+ *
+ * При выключенной трассировке стоит одну проверку флага.
+ * Имя должно быть строковым литералом, detail — жить до конца спана.
+ */
+class TraceSpan {
+public:
+    explicit TraceSpan(const char* name)
+        : TraceSpan(name, empty_detail()) {}
+
+    TraceSpan(const char* name, const std::string& detail)
+        : name_(name), detail_(detail), active_(Tracer::enabled()) {
+        if (active_) {
+            start_ = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~TraceSpan() {
+        if (active_) {
+            Tracer::record(name_, detail_, start_, std::chrono::steady_clock::now());
+        }
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    static const std::string& empty_detail();
+
+    const char* name_;
+    const std::string& detail_;
+    bool active_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+} // namespace tpm_vault
+
+#endif // TPM_VAULT_TRACE_HPP
@@ -56,6 +56,36 @@ private:
     std::vector<uint8_t> data_;
 };
 
+/**
+ * @brief RAII-обёртка над файловым дескриптором
+ */
+class UniqueFd {
+public:
+    UniqueFd() = default;
+    explicit UniqueFd(int fd) : fd_(fd) {}
+    ~UniqueFd();
+    
+    // Запрещаем копирование
+    UniqueFd(const UniqueFd&) = delete;
+    UniqueFd& operator=(const UniqueFd&) = delete;
+    
+    // Разрешаем перемещение
+    UniqueFd(UniqueFd&& other) noexcept;
+    UniqueFd& operator=(UniqueFd&& other) noexcept;
+    
+    int get() const { return fd_; }
+    bool valid() const { return fd_ >= 0; }
+    
+    /**
+     * @brief Закрывает текущий дескриптор и принимает новый
+     * @param fd Новый дескриптор (-1 чтобы просто закрыть)
+     */
+    void reset(int fd = -1);
+
+private:
+    int fd_ = -1;
+};
+
 /**
  * @brief Парсит размер с суффиксом (M, G)
  * @param size_str Строка с размером (например, "100M", "1G")
@@ -71,6 +101,13 @@ size_t parse_size(const std::string& size_str);
  */
 std::string format_size(size_t bytes);
 
+/**
+ * @brief Экранирует строку для вставки в JSON
+ * @param s Исходная строка
+ * @return Строка без кавычек по краям
+ */
+std::string json_escape(const std::string& s);
+
 /**
  * @brief Генерирует криптографически стойкие случайные байты
  * @param size Количество байт
@@ -106,22 +143,6 @@ bool directory_exists(const std::string& path);
  */
 void ensure_directory(const std::string& path);
 
-/**
- * @brief Выполняет внешнюю команду
- * @param cmd Команда для выполнения
- * @param stdin_data Данные для передачи в stdin (опционально)
- * @return Код возврата команды
- */
-int execute_command(const std::string& cmd, const std::vector<uint8_t>* stdin_data = nullptr);
-
-/**
- * @brief Выполняет команду и возвращает stdout
- * @param cmd Команда для выполнения
- * @return Вывод команды
- * @throws VaultError при ошибке выполнения
- */
-std::string execute_command_output(const std::string& cmd);
-
 /**
  * @brief Получает текущую рабочую директорию
  * @return Путь к текущей директории
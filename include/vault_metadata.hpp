@@ -0,0 +1,72 @@
+#ifndef TPM_VAULT_VAULT_METADATA_HPP
+#define TPM_VAULT_VAULT_METADATA_HPP
+
+#include <string>
+#include <map>
+#include <cstdint>
+
+namespace tpm_vault {
+
+/**
+ * @brief Метаданные хранилища, сохраняемые рядом с образом
+ *
+ * Файл <name>.vault — текстовый, по одной паре "ключ=значение"
+ * на строку. Хранит параметры, выбранные при создании, чтобы
+ * повторно применять их при каждом открытии. Секретов не содержит.
+ */
+class VaultMetadata {
+public:
+    /**
+     * @brief Загружает метаданные из файла
+     * @param path Путь к файлу метаданных
+     * @return Метаданные (пустые, если файла нет)
+     * @throws VaultError при ошибке разбора
+     */
+    static VaultMetadata load(const std::string& path);
+
+    /**
+     * @brief Атомарно сохраняет метаданные (запись во временный файл + rename)
+     * @param path Путь к файлу метаданных
+     * @throws VaultError при ошибке записи
+     */
+    void save(const std::string& path) const;
+
+    /**
+     * @brief Разбирает метаданные из текста в формате файла
+     * @param text Содержимое файла метаданных
+     * @param origin Откуда текст (для сообщения об ошибке)
+     * @throws VaultError при ошибке разбора
+     */
+    static VaultMetadata parse(const std::string& text, const std::string& origin);
+
+    /**
+     * @brief Текст файла метаданных (то, что записывает save())
+     */
+    std::string serialize() const;
+
+    /**
+     * @brief Формирует путь к файлу метаданных по пути к образу
+     * @param image_path Путь вида ".../<name>.img"
+     * @return Путь вида ".../<name>.vault"
+     */
+    static std::string path_for_image(const std::string& image_path);
+
+    bool has(const std::string& key) const;
+    std::string get(const std::string& key, const std::string& default_value = "") const;
+    uint64_t get_uint(const std::string& key, uint64_t default_value = 0) const;
+    bool get_bool(const std::string& key, bool default_value = false) const;
+
+    void set(const std::string& key, const std::string& value);
+    void set_uint(const std::string& key, uint64_t value);
+    void set_bool(const std::string& key, bool value);
+    void erase(const std::string& key);
+
+    bool empty() const { return values_.empty(); }
+
+private:
+    std::map<std::string, std::string> values_;
+};
+
+} // namespace tpm_vault
+
+#endif // TPM_VAULT_VAULT_METADATA_HPP
@@ -0,0 +1,97 @@
+#ifndef TPM_VAULT_VAULT_REGISTRY_HPP
+#define TPM_VAULT_VAULT_REGISTRY_HPP
+
+#include "vault_metadata.hpp"
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace tpm_vault {
+
+/**
+ * @brief Запись реестра об одном хранилище
+ */
+struct RegistryEntry {
+    std::string name;           ///< Имя хранилища
+    std::string image_path;     ///< Абсолютный путь к образу
+    std::string mount_point;    ///< Точка монтирования
+    std::string mapper_name;    ///< Имя device mapper
+    std::string loop_device;    ///< Loop-устройство открытого хранилища (пусто, если закрыто)
+    uint64_t loop_rdev = 0;     ///< Номер loop-устройства (dev_t)
+    uint64_t mapper_rdev = 0;   ///< Номер устройства device mapper (dev_t)
+    uint64_t backing_dev = 0;   ///< st_dev образа
+    uint64_t backing_inode = 0; ///< st_ino образа
+    VaultMetadata options;      ///< Копия метаданных <name>.vault на момент записи
+
+    bool is_open() const { return !loop_device.empty(); }
+};
+
+/**
+ * @brief Реестр хранилищ хоста: имя → образ, точка монтирования, устройства
+ *
+ * Один файл на хранилище: <dir>/vaults/<name>.entry в формате
+ * VaultMetadata (запись во временный файл + rename). Поиск по имени —
+ * чтение одного файла, без обхода каталогов и loop-устройств.
+ *
+ * Реестр — подсказка, а не источник истины: параметры хранилища
+ * по-прежнему читаются из <name>.vault рядом с образом, а устройства
+ * из записи перед использованием сверяются с ядром.
+ */
+class VaultRegistry {
+public:
+    /// Каталог реестра по умолчанию
+    static constexpr const char* DEFAULT_DIR = "/var/lib/tpm-vault";
+
+    /// Переменная окружения, переопределяющая каталог реестра
+    static constexpr const char* ENV_VAR = "TPM_VAULT_REGISTRY";
+
+    /**
+     * @brief Конструктор
+     * @param directory Каталог реестра (создаётся при первой записи)
+     */
+    explicit VaultRegistry(std::string directory = default_directory());
+
+    /**
+     * @brief Каталог реестра: TPM_VAULT_REGISTRY или DEFAULT_DIR
+     */
+    static std::string default_directory();
+
+    /**
+     * @brief Ищет запись по имени
+     * @param name Имя хранилища
+     * @param entry Заполняется найденной записью
+     * @return false, если записи нет (или имя не может быть именем файла)
+     * @throws VaultError если файл записи повреждён
+     */
+    bool find(const std::string& name, RegistryEntry& entry) const;
+
+    /**
+     * @brief Атомарно создаёт или заменяет запись
+     * @throws VaultError при недопустимом имени или ошибке записи
+     */
+    void record(const RegistryEntry& entry);
+
+    /**
+     * @brief Удаляет запись; ничего не делает, если её нет
+     * @throws VaultError при ошибке удаления
+     */
+    void remove(const std::string& name);
+
+    /**
+     * @brief Все записи реестра
+     * @throws VaultError если файл записи повреждён
+     */
+    std::vector<RegistryEntry> entries() const;
+
+private:
+    /// Путь к файлу записи; пустой для имён, которые нельзя сделать именем файла
+    std::string entry_path(const std::string& name) const;
+
+    static RegistryEntry from_metadata(const std::string& name, const VaultMetadata& metadata);
+
+    std::string directory_;
+};
+
+} // namespace tpm_vault
+
+#endif // TPM_VAULT_VAULT_REGISTRY_HPP
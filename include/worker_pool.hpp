@@ -0,0 +1,61 @@
+#ifndef TPM_VAULT_WORKER_POOL_HPP
+#define TPM_VAULT_WORKER_POOL_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace tpm_vault {
+
+/**
+ * @brief Фиксированный пул потоков для независимых задач
+ *
+ * Задачи выполняются в порядке постановки. Исключение задачи
+ * передаётся через future, возвращённый submit(). Деструктор
+ * дожидается всех поставленных задач.
+ */
+class WorkerPool {
+public:
+    /**
+     * @brief Запускает потоки
+     * @param threads Число потоков (не меньше 1)
+     */
+    explicit WorkerPool(size_t threads);
+
+    /**
+     * @brief Дожидается очереди и останавливает потоки
+     */
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    /**
+     * @brief Ставит задачу в очередь
+     * @param task Задача
+     * @return future, завершающийся вместе с задачей
+     */
+    std::future<void> submit(std::function<void()> task);
+
+    /**
+     * @brief Размер пула для jobs задач: не больше числа CPU
+     */
+    static size_t size_for(size_t jobs);
+
+private:
+    void worker();
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::packaged_task<void()>> queue_;
+    bool stopping_ = false;
+    std::vector<std::thread> threads_;
+};
+
+} // namespace tpm_vault
+
+#endif // TPM_VAULT_WORKER_POOL_HPP
@@ -0,0 +1,449 @@
+#include "bench.hpp"
+#include "command_runner.hpp"
+#include "tpm_manager.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <unistd.h>
+
+namespace tpm_vault {
+
+namespace {
+
+/**
+ * @brief Выборки длительностей по (операция, шаг) в порядке появления
+ */
+class SampleSet {
+public:
+    void add(const std::string& operation, const std::string& phase, double ms) {
+        for (auto& entry : entries_) {
+            if (entry.operation == operation && entry.phase == phase) {
+                entry.samples.push_back(ms);
+                return;
+            }
+        }
+        entries_.push_back({operation, phase, {ms}});
+    }
+
+    void add_phases(const std::string& operation, const std::vector<PhaseTiming>& phases) {
+        for (const auto& p : phases) {
+            add(operation, p.phase, p.duration.count() / 1000.0);
+        }
+    }
+
+    std::vector<PhaseStats> summarize() const {
+        std::vector<PhaseStats> result;
+        for (const auto& entry : entries_) {
+            result.push_back(VaultBenchmark::summarize(entry.operation, entry.phase, entry.samples));
+        }
+        return result;
+    }
+
+private:
+    struct Entry {
+        std::string operation;
+        std::string phase;
+        std::vector<double> samples;
+    };
+    std::vector<Entry> entries_;
+};
+
+double elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * @brief Задание fio; задания выполняются по очереди над одним файлом,
+ *        первое раскладывает его
+ */
+struct FioJob {
+    const char* name;
+    const char* rw;
+    const char* bs;
+};
+
+constexpr FioJob FIO_JOBS[] = {
+    {"seq-write", "write", "1M"},
+    {"seq-read", "read", "1M"},
+    {"rand-write", "randwrite", "4k"},
+    {"rand-read", "randread", "4k"},
+};
+
+/// Предел длительности одного задания
+constexpr std::chrono::seconds FIO_RUNTIME{10};
+
+/// Предел файла fio: не больше четверти хранилища
+constexpr size_t FIO_MAX_FILE = 256 * 1024 * 1024;
+
+struct FioResult {
+    std::string job;
+    double mib_s;
+    double iops;
+};
+
+/**
+ * @brief Выполняет FIO_JOBS в каталоге смонтированного хранилища
+ * @throws VaultError если fio не запустился или не выдал результатов
+ */
+std::vector<FioResult> run_fio(const std::string& directory, size_t vault_size) {
+    size_t file_size = std::min(FIO_MAX_FILE, vault_size / 4);
+    file_size -= file_size % (1024 * 1024);
+
+    std::vector<std::string> argv = {
+        "fio", "--minimal", "--directory=" + directory, "--filename=fio.dat",
+        "--size=" + std::to_string(file_size), "--ioengine=psync", "--direct=1", "--end_fsync=1",
+        "--runtime=" + std::to_string(FIO_RUNTIME.count()),
+        // Наполовину сжимаемые данные, иначе профиль со сжатием не отличить от остальных
+        "--buffer_compress_percentage=50", "--refill_buffers",
+    };
+    for (const auto& job : FIO_JOBS) {
+        argv.push_back(std::string("--name=") + job.name);
+        argv.push_back(std::string("--rw=") + job.rw);
+        argv.push_back(std::string("--bs=") + job.bs);
+        argv.push_back("--stonewall");
+    }
+
+    CommandOptions run_options;
+    run_options.timeout = FIO_RUNTIME * (std::size(FIO_JOBS) + 2);
+    CommandResult result = CommandRunner::check("fio failed in " + directory, argv, run_options);
+    std::remove((directory + "/fio.dat").c_str());
+
+    // Строка terse v3 на задание: имя — поле 2, КиБ/с и IOPS чтения — 6 и 7, записи — 47 и 48
+    std::vector<FioResult> results;
+    std::istringstream lines(result.out);
+    for (std::string line; std::getline(lines, line); ) {
+        std::vector<std::string> fields;
+        std::istringstream parts(line);
+        for (std::string field; std::getline(parts, field, ';'); ) {
+            fields.push_back(field);
+        }
+        if (fields.size() < 49 || fields[0] != "3") {
+            continue;
+        }
+        try {
+            double kib_s = std::stod(fields[6]) + std::stod(fields[47]);
+            double iops = std::stod(fields[7]) + std::stod(fields[48]);
+            results.push_back({fields[2], kib_s / 1024.0, iops});
+        } catch (const std::exception&) {
+            throw VaultError("Malformed fio output: " + line);
+        }
+    }
+    if (results.empty()) {
+        throw VaultError("fio produced no terse results in " + directory);
+    }
+    return results;
+}
+
+} // namespace
+
+VaultBenchmark::VaultBenchmark(TpmVault& vault)
+    : vault_(vault) {
+}
+
+PhaseStats VaultBenchmark::summarize(const std::string& operation, const std::string& phase,
+                                     std::vector<double> samples_ms) {
+    PhaseStats stats;
+    stats.operation = operation;
+    stats.phase = phase;
+    stats.samples = samples_ms.size();
+    if (samples_ms.empty()) {
+        return stats;
+    }
+
+    std::sort(samples_ms.begin(), samples_ms.end());
+    auto percentile = [&](double p) {
+        size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * samples_ms.size()));
+        return samples_ms[rank > 0 ? rank - 1 : 0];
+    };
+
+    stats.min_ms = samples_ms.front();
+    stats.p50_ms = percentile(50);
+    stats.p95_ms = percentile(95);
+    stats.p99_ms = percentile(99);
+    stats.max_ms = samples_ms.back();
+    return stats;
+}
+
+void VaultBenchmark::discard(const std::string& name) {
+    std::string base = get_current_directory() + "/" + name;
+
+    try { vault_.close(name); } catch (...) {}
+    try { vault_.wipe(name); } catch (...) {}
+    std::remove((base + ".img").c_str());
+    std::remove((base + ".vault").c_str());
+    ::rmdir(base.c_str());
+}
+
+std::vector<BenchReport> VaultBenchmark::run(const BenchOptions& options) {
+    std::vector<BenchReport> reports;
+    std::string prefix = "bench-" + std::to_string(getpid()) + "-";
+    unsigned counter = 0;
+
+    std::vector<std::string> filesystems = options.filesystems;
+    if (filesystems.empty()) {
+        filesystems.push_back(options.vault.fs_type + "/" + options.vault.fs_profile);
+    }
+
+    for (const auto& filesystem : filesystems) {
+        VaultOptions vault = options.vault;
+        size_t slash = filesystem.find('/');
+        vault.fs_type = filesystem.substr(0, slash);
+        vault.fs_profile = filesystem.substr(slash + 1);
+
+        for (size_t size : options.sizes) {
+            SampleSet samples;
+
+            // Пропускная способность и IOPS: SampleSet считает перцентили любых величин
+            SampleSet io_mib_s;
+            SampleSet io_iops;
+
+            // Шаги операции в порядке выполнения, затем полное время
+            auto measure = [&](const char* operation, auto&& call) {
+                auto start = std::chrono::steady_clock::now();
+                call();
+                double total = elapsed_ms(start);
+                samples.add_phases(operation, vault_.last_phases());
+                samples.add(operation, "total", total);
+            };
+
+            for (unsigned i = 0; i < options.iterations; ++i) {
+                std::string name = prefix + std::to_string(counter++);
+                std::cerr << "bench: " << filesystem << " " << format_size(size) << " iteration "
+                          << (i + 1) << "/" << options.iterations << "\r" << std::flush;
+
+                try {
+                    measure("create", [&] { vault_.create(name, size, vault); });
+                    measure("open", [&] { vault_.open(name); });
+                    if (options.fio) {
+                        for (const auto& result : run_fio(get_current_directory() + "/" + name, size)) {
+                            io_mib_s.add("io", result.job, result.mib_s);
+                            io_iops.add("io", result.job, result.iops);
+                        }
+                    }
+                    measure("close", [&] { vault_.close(name); });
+                } catch (...) {
+                    std::cerr << "\n";
+                    discard(name);
+                    throw;
+                }
+                discard(name);
+            }
+            std::cerr << "\n";
+
+            BenchReport report;
+            report.size = size;
+            report.filesystem = filesystem;
+            report.iterations = options.iterations;
+            report.phases = samples.summarize();
+
+            auto mib_s = io_mib_s.summarize();
+            auto iops = io_iops.summarize();
+            for (size_t j = 0; j < mib_s.size(); ++j) {
+                report.io.push_back({mib_s[j].phase, mib_s[j].samples, mib_s[j].p50_ms, iops[j].p50_ms});
+            }
+            reports.push_back(report);
+        }
+    }
+
+    return reports;
+}
+
+void VaultBenchmark::print_table(std::ostream& out, const std::vector<BenchReport>& reports) {
+    out << std::fixed << std::setprecision(2);
+
+    for (const auto& report : reports) {
+        out << "Size " << format_size(report.size) << ", " << report.filesystem << ", "
+            << report.iterations << " iterations (ms)\n";
+        out << "  " << std::left << std::setw(8) << "op" << std::setw(15) << "phase" << std::right
+            << std::setw(10) << "min" << std::setw(10) << "p50" << std::setw(10) << "p95"
+            << std::setw(10) << "p99" << std::setw(10) << "max" << "\n";
+
+        for (const auto& p : report.phases) {
+            out << "  " << std::left << std::setw(8) << p.operation << std::setw(15) << p.phase << std::right
+                << std::setw(10) << p.min_ms << std::setw(10) << p.p50_ms << std::setw(10) << p.p95_ms
+                << std::setw(10) << p.p99_ms << std::setw(10) << p.max_ms << "\n";
+        }
+
+        if (!report.io.empty()) {
+            out << "  " << std::left << std::setw(23) << "fio (p50)" << std::right
+                << std::setw(10) << "MiB/s" << std::setw(10) << "IOPS" << "\n";
+            for (const auto& io : report.io) {
+                out << "  " << std::left << std::setw(23) << io.job << std::right
+                    << std::setw(10) << io.mib_s << std::setw(10) << io.iops << "\n";
+            }
+        }
+        out << "\n";
+    }
+}
+
+void VaultBenchmark::print_json(std::ostream& out, const std::vector<BenchReport>& reports) {
+    out << std::fixed << std::setprecision(3);
+    out << "{\"reports\":[";
+
+    for (size_t r = 0; r < reports.size(); ++r) {
+        const auto& report = reports[r];
+        out << (r ? "," : "") << "{\"size\":" << report.size
+            << ",\"filesystem\":\"" << report.filesystem << "\""
+            << ",\"iterations\":" << report.iterations << ",\"phases\":[";
+
+        for (size_t i = 0; i < report.phases.size(); ++i) {
+            const auto& p = report.phases[i];
+            out << (i ? "," : "") << "{\"operation\":\"" << p.operation << "\""
+                << ",\"phase\":\"" << p.phase << "\""
+                << ",\"samples\":" << p.samples
+                << ",\"min_ms\":" << p.min_ms
+                << ",\"p50_ms\":" << p.p50_ms
+                << ",\"p95_ms\":" << p.p95_ms
+                << ",\"p99_ms\":" << p.p99_ms
+                << ",\"max_ms\":" << p.max_ms << "}";
+        }
+        out << "],\"io\":[";
+
+        for (size_t i = 0; i < report.io.size(); ++i) {
+            const auto& io = report.io[i];
+            out << (i ? "," : "") << "{\"job\":\"" << io.job << "\""
+                << ",\"samples\":" << io.samples
+                << ",\"mib_s\":" << io.mib_s
+                << ",\"iops\":" << io.iops << "}";
+        }
+        out << "]}";
+    }
+    out << "]}\n";
+}
+
+LookupBenchmark::LookupBenchmark(TpmManager& tpm)
+    : tpm_(tpm) {
+}
+
+std::vector<LookupReport> LookupBenchmark::run(const LookupBenchOptions& options) {
+    std::vector<LookupReport> reports;
+    std::string prefix = "bench-lookup-" + std::to_string(getpid()) + "-";
+    std::vector<size_t> counts = options.counts;
+    std::sort(counts.begin(), counts.end());
+
+    std::vector<std::string> created;
+    auto cleanup = [&] {
+        for (const auto& name : created) {
+            try { tpm_.remove(name); } catch (...) {}
+        }
+    };
+
+    std::mt19937 rng(getpid());
+    auto data = generate_random_bytes(32);
+
+    try {
+        for (size_t count : counts) {
+            // Дополняем хранилище ключей до нужного числа объектов
+            if (created.size() < count) {
+                while (created.size() < count) {
+                    std::string name = prefix + std::to_string(created.size());
+                    if (created.size() % 10 == 0) {
+                        std::cerr << "bench: sealing object " << (created.size() + 1)
+                                  << "/" << count << "\r" << std::flush;
+                    }
+                    tpm_.seal(name, data);
+                    created.push_back(name);
+                }
+                std::cerr << "\n";
+            }
+
+            // Одни и те же имена для всех способов
+            std::uniform_int_distribution<size_t> pick(0, created.size() - 1);
+            std::vector<std::string> hits;
+            for (unsigned i = 0; i < options.iterations; ++i) {
+                hits.push_back(created[pick(rng)]);
+            }
+            std::string miss = prefix + "missing";
+
+            SampleSet samples;
+            auto measure = [&](const char* method, auto&& exists) {
+                for (const auto& name : hits) {
+                    auto start = std::chrono::steady_clock::now();
+                    exists(name);
+                    samples.add(method, "hit", elapsed_ms(start));
+
+                    start = std::chrono::steady_clock::now();
+                    exists(miss);
+                    samples.add(method, "miss", elapsed_ms(start));
+                }
+            };
+
+            measure("list", [&](const std::string& name) { return tpm_.exists_by_list(name); });
+            measure("direct", [&](const std::string& name) { return tpm_.exists(name); });
+
+            // Индекс строится заново для каждого размера
+            tpm_.set_index_enabled(true);
+            auto start = std::chrono::steady_clock::now();
+            tpm_.exists(miss);
+            samples.add("index", "load", elapsed_ms(start));
+            measure("index", [&](const std::string& name) { return tpm_.exists(name); });
+            tpm_.set_index_enabled(false);
+
+            LookupReport report;
+            report.objects = count;
+            report.iterations = options.iterations;
+            report.methods = samples.summarize();
+            reports.push_back(report);
+        }
+    } catch (...) {
+        std::cerr << "\n";
+        tpm_.set_index_enabled(false);
+        cleanup();
+        throw;
+    }
+
+    cleanup();
+    return reports;
+}
+
+void LookupBenchmark::print_table(std::ostream& out, const std::vector<LookupReport>& reports) {
+    out << std::fixed << std::setprecision(3);
+
+    for (const auto& report : reports) {
+        out << report.objects << " objects, " << report.iterations << " lookups (ms)\n";
+        out << "  " << std::left << std::setw(8) << "method" << std::setw(6) << "kind" << std::right
+            << std::setw(10) << "min" << std::setw(10) << "p50" << std::setw(10) << "p95"
+            << std::setw(10) << "p99" << std::setw(10) << "max" << "\n";
+
+        for (const auto& m : report.methods) {
+            out << "  " << std::left << std::setw(8) << m.operation << std::setw(6) << m.phase << std::right
+                << std::setw(10) << m.min_ms << std::setw(10) << m.p50_ms << std::setw(10) << m.p95_ms
+                << std::setw(10) << m.p99_ms << std::setw(10) << m.max_ms << "\n";
+        }
+        out << "\n";
+    }
+}
+
+void LookupBenchmark::print_json(std::ostream& out, const std::vector<LookupReport>& reports) {
+    out << std::fixed << std::setprecision(4);
+    out << "{\"lookup\":[";
+
+    for (size_t r = 0; r < reports.size(); ++r) {
+        const auto& report = reports[r];
+        out << (r ? "," : "") << "{\"objects\":" << report.objects
+            << ",\"iterations\":" << report.iterations << ",\"methods\":[";
+
+        for (size_t i = 0; i < report.methods.size(); ++i) {
+            const auto& m = report.methods[i];
+            out << (i ? "," : "") << "{\"method\":\"" << m.operation << "\""
+                << ",\"kind\":\"" << m.phase << "\""
+                << ",\"samples\":" << m.samples
+                << ",\"min_ms\":" << m.min_ms
+                << ",\"p50_ms\":" << m.p50_ms
+                << ",\"p95_ms\":" << m.p95_ms
+                << ",\"p99_ms\":" << m.p99_ms
+                << ",\"max_ms\":" << m.max_ms << "}";
+        }
+        out << "]}";
+    }
+    out << "]}\n";
+}
+
+} // namespace tpm_vault
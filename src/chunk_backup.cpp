@@ -0,0 +1,493 @@
+#include "chunk_backup.hpp"
+#include "trace.hpp"
+#include "utils.hpp"
+#include "worker_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <fstream>
+#include <sstream>
+#include <unordered_set>
+#include <vector>
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <openssl/evp.h>
+
+namespace tpm_vault {
+
+namespace {
+
+constexpr const char* MANIFEST_HEADER = "# tpm-vault backup manifest";
+constexpr const char* MANIFEST_EXT = ".manifest";
+constexpr const char* HASH_NAME = "sha256";
+constexpr const char* ZERO_CHUNK = "0";
+constexpr size_t HASH_HEX_SIZE = 64;
+
+/// Итог обработки одного блока
+enum ChunkOutcome : uint8_t {
+    CHUNK_ZERO,
+    CHUNK_UNCHANGED,
+    CHUNK_DEDUPLICATED,
+    CHUNK_WRITTEN,
+};
+
+/**
+ * @brief Манифест копии: хеши блоков по порядку, пустая строка — нулевой блок
+ */
+struct Manifest {
+    uint64_t size = 0;
+    size_t chunk_size = 0;
+    std::vector<std::string> hashes;
+};
+
+[[noreturn]] void fail(const std::string& what, int err) {
+    throw VaultError(what + ": " + std::strerror(err));
+}
+
+size_t chunk_count(uint64_t size, size_t chunk_size) {
+    return static_cast<size_t>((size + chunk_size - 1) / chunk_size);
+}
+
+std::string sha256_hex(const uint8_t* data, size_t size) {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_size = 0;
+    if (EVP_Digest(data, size, digest, &digest_size, EVP_sha256(), nullptr) != 1) {
+        throw VaultError("SHA-256 failed");
+    }
+
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(digest_size * 2);
+    for (unsigned int i = 0; i < digest_size; ++i) {
+        hex += digits[digest[i] >> 4];
+        hex += digits[digest[i] & 0x0f];
+    }
+    return hex;
+}
+
+bool is_zero(const uint8_t* data, size_t size) {
+    return size == 0 || (data[0] == 0 && std::memcmp(data, data + 1, size - 1) == 0);
+}
+
+bool is_hash(const std::string& text) {
+    return text.size() == HASH_HEX_SIZE &&
+           std::all_of(text.begin(), text.end(), [](char c) {
+               return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
+           });
+}
+
+/**
+ * @brief Диапазон целиком в дыре файла: его не нужно читать
+ */
+bool in_hole(int fd, uint64_t offset, size_t length) {
+    off_t data = ::lseek(fd, static_cast<off_t>(offset), SEEK_DATA);
+    if (data < 0) {
+        return errno == ENXIO;
+    }
+    return static_cast<uint64_t>(data) >= offset + length;
+}
+
+void read_exact(int fd, uint8_t* buffer, size_t length, uint64_t offset, const std::string& what) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = ::pread(fd, buffer + done, length - done, static_cast<off_t>(offset + done));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fail("Failed to read " + what, errno);
+        }
+        if (n == 0) {
+            throw VaultError("Unexpected end of " + what);
+        }
+        done += static_cast<size_t>(n);
+    }
+}
+
+void write_exact(int fd, const uint8_t* buffer, size_t length, uint64_t offset, const std::string& what) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = ::pwrite(fd, buffer + done, length - done, static_cast<off_t>(offset + done));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fail("Failed to write " + what, errno);
+        }
+        done += static_cast<size_t>(n);
+    }
+}
+
+/**
+ * @brief Пишет файл через временный и rename: читатель не увидит половину
+ * @param tmp_suffix Уникален среди одновременных писателей того же пути
+ * @param sync fsync перед rename (блоки синхронизируются разом через syncfs)
+ */
+void write_file(const std::string& path, const std::string& tmp_suffix, const uint8_t* data, size_t size,
+                bool sync) {
+    std::string tmp_path = path + ".tmp" + tmp_suffix;
+    UniqueFd fd(::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600));
+    if (!fd.valid()) {
+        fail("Failed to create " + tmp_path, errno);
+    }
+    try {
+        write_exact(fd.get(), data, size, 0, tmp_path);
+        if (sync && fsync(fd.get()) != 0) {
+            fail("Failed to sync " + tmp_path, errno);
+        }
+    } catch (const VaultError&) {
+        ::unlink(tmp_path.c_str());
+        throw;
+    }
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        int err = errno;
+        ::unlink(tmp_path.c_str());
+        fail("Failed to save " + path, err);
+    }
+}
+
+/**
+ * @brief Создаёт каталог; одновременное создание другим потоком — не ошибка
+ */
+void make_directory(const std::string& path) {
+    if (::mkdir(path.c_str(), 0700) != 0 && errno != EEXIST) {
+        fail("Failed to create directory " + path, errno);
+    }
+}
+
+/**
+ * @brief Открывает каталог блоков и блокирует его flock
+ *
+ * Хранилище блоков общее для всех хранилищ каталога: копия держит
+ * LOCK_EX от выбора блоков до удаления ненужных, восстановление — LOCK_SH.
+ */
+UniqueFd lock_chunk_store(const std::string& chunk_dir, int operation) {
+    UniqueFd fd(::open(chunk_dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    if (!fd.valid()) {
+        fail("Failed to open " + chunk_dir, errno);
+    }
+    TraceSpan span("flock", chunk_dir);
+    while (flock(fd.get(), operation) != 0) {
+        if (errno != EINTR) {
+            fail("Failed to lock " + chunk_dir, errno);
+        }
+    }
+    return fd;
+}
+
+std::string chunk_path(const std::string& chunk_dir, const std::string& hash) {
+    return chunk_dir + "/" + hash.substr(0, 2) + "/" + hash;
+}
+
+/**
+ * @brief Читает манифест
+ * @return Пустой манифест (chunk_size = 0), если файла нет
+ * @throws VaultError при ошибке разбора
+ */
+Manifest load_manifest(const std::string& path) {
+    Manifest manifest;
+    std::ifstream in(path);
+    if (!in) {
+        return manifest;
+    }
+
+    auto malformed = [&](size_t line_no) {
+        return VaultError("Malformed backup manifest " + path + " at line " + std::to_string(line_no));
+    };
+
+    std::string line;
+    std::string hash_name;
+    size_t line_no = 0;
+    while (std::getline(in, line)) {
+        ++line_no;
+        if (line.empty() || line[0] == '#') continue;
+
+        size_t eq = line.find('=');
+        if (eq != std::string::npos) {
+            std::string key = line.substr(0, eq);
+            std::string value = line.substr(eq + 1);
+            try {
+                if (key == "size") {
+                    manifest.size = std::stoull(value);
+                } else if (key == "chunk_size") {
+                    manifest.chunk_size = std::stoull(value);
+                } else if (key == "hash") {
+                    hash_name = value;
+                }
+            } catch (const std::exception&) {
+                throw malformed(line_no);
+            }
+            continue;
+        }
+        if (line == ZERO_CHUNK) {
+            manifest.hashes.emplace_back();
+        } else if (is_hash(line)) {
+            manifest.hashes.push_back(line);
+        } else {
+            throw malformed(line_no);
+        }
+    }
+
+    if (hash_name != HASH_NAME || manifest.chunk_size == 0 ||
+        manifest.hashes.size() != chunk_count(manifest.size, manifest.chunk_size)) {
+        throw VaultError("Malformed backup manifest " + path);
+    }
+    return manifest;
+}
+
+void save_manifest(const std::string& path, const Manifest& manifest) {
+    std::ostringstream out;
+    out << MANIFEST_HEADER << "\n"
+        << "size=" << manifest.size << "\n"
+        << "chunk_size=" << manifest.chunk_size << "\n"
+        << "hash=" << HASH_NAME << "\n";
+    for (const auto& hash : manifest.hashes) {
+        out << (hash.empty() ? ZERO_CHUNK : hash) << "\n";
+    }
+    std::string content = out.str();
+    write_file(path, "", reinterpret_cast<const uint8_t*>(content.data()), content.size(), true);
+}
+
+/**
+ * @brief Обрабатывает блоки 0..count-1 в пуле потоков
+ *
+ * Потоки берут следующий номер блока из общего счётчика, у каждого свой
+ * буфер размером в блок. После первой ошибки новые блоки не берутся;
+ * она пробрасывается, когда все потоки остановились.
+ */
+template <typename Fn>
+void for_each_chunk(size_t count, size_t chunk_size, Fn&& fn) {
+    size_t threads = WorkerPool::size_for(count);
+    WorkerPool pool(threads);
+    std::atomic<size_t> next{0};
+    std::atomic<bool> failed{false};
+    std::vector<std::future<void>> pending;
+
+    for (size_t t = 0; t < threads; ++t) {
+        pending.push_back(pool.submit([&] {
+            std::vector<uint8_t> buffer(chunk_size);
+            try {
+                for (size_t i; !failed && (i = next++) < count; ) {
+                    fn(i, buffer.data());
+                }
+            } catch (...) {
+                failed = true;
+                throw;
+            }
+        }));
+    }
+
+    std::exception_ptr error;
+    for (auto& task : pending) {
+        try {
+            task.get();
+        } catch (...) {
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+/**
+ * @brief Хеши, на которые ссылаются манифесты каталога, кроме skip_path
+ * @return false, если какой-то манифест не удалось разобрать
+ */
+bool referenced_hashes(const std::string& dir, const std::string& skip_path,
+                       std::unordered_set<std::string>& hashes) {
+    DIR* entries = opendir(dir.c_str());
+    if (!entries) {
+        return false;
+    }
+    std::vector<std::string> manifests;
+    const size_t ext_size = std::strlen(MANIFEST_EXT);
+    struct dirent* entry;
+    while ((entry = readdir(entries)) != nullptr) {
+        std::string file = entry->d_name;
+        if (file.size() > ext_size && file.compare(file.size() - ext_size, ext_size, MANIFEST_EXT) == 0 &&
+            dir + "/" + file != skip_path) {
+            manifests.push_back(dir + "/" + file);
+        }
+    }
+    closedir(entries);
+
+    try {
+        for (const auto& path : manifests) {
+            for (auto& hash : load_manifest(path).hashes) {
+                hashes.insert(std::move(hash));
+            }
+        }
+    } catch (const VaultError&) {
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+std::string ChunkBackup::manifest_path(const std::string& dir, const std::string& name) {
+    return dir + "/" + name + MANIFEST_EXT;
+}
+
+BackupStats ChunkBackup::backup(int image_fd, const std::string& dir, const std::string& name,
+                                size_t chunk_size) {
+    TraceSpan span("backup", name);
+    if (chunk_size < MIN_CHUNK_SIZE || chunk_size > MAX_CHUNK_SIZE || chunk_size % MIN_CHUNK_SIZE != 0) {
+        throw VaultError("Chunk size must be a multiple of 4K between 4K and 64M");
+    }
+
+    struct stat st;
+    if (fstat(image_fd, &st) != 0) {
+        fail("Failed to stat image of " + name, errno);
+    }
+
+    BackupStats stats;
+    stats.size = static_cast<uint64_t>(st.st_size);
+    stats.chunk_size = chunk_size;
+    stats.chunks = chunk_count(stats.size, chunk_size);
+
+    ensure_directory(dir);
+    std::string chunk_dir = dir + "/chunks";
+    make_directory(chunk_dir);
+    UniqueFd chunk_dir_fd = lock_chunk_store(chunk_dir, LOCK_EX);
+    std::string tmp_prefix = "." + std::to_string(::getpid()) + ".";
+
+    std::string path = manifest_path(dir, name);
+    Manifest previous = load_manifest(path);
+    // После смены размера блока прошлые хеши описывают другие границы
+    size_t comparable = previous.chunk_size == chunk_size ? previous.hashes.size() : 0;
+
+    Manifest current;
+    current.size = stats.size;
+    current.chunk_size = chunk_size;
+    current.hashes.resize(stats.chunks);
+    std::vector<ChunkOutcome> outcomes(stats.chunks);
+
+    for_each_chunk(stats.chunks, chunk_size, [&](size_t i, uint8_t* buffer) {
+        uint64_t offset = static_cast<uint64_t>(i) * chunk_size;
+        size_t length = static_cast<size_t>(std::min<uint64_t>(chunk_size, stats.size - offset));
+
+        if (in_hole(image_fd, offset, length)) {
+            outcomes[i] = CHUNK_ZERO;
+            return;
+        }
+        read_exact(image_fd, buffer, length, offset, "image of " + name);
+        if (is_zero(buffer, length)) {
+            outcomes[i] = CHUNK_ZERO;
+            return;
+        }
+
+        std::string hash = sha256_hex(buffer, length);
+        if (i < comparable && previous.hashes[i] == hash) {
+            outcomes[i] = CHUNK_UNCHANGED;
+        } else if (file_exists(chunk_path(chunk_dir, hash))) {
+            outcomes[i] = CHUNK_DEDUPLICATED;
+        } else {
+            make_directory(chunk_dir + "/" + hash.substr(0, 2));
+            write_file(chunk_path(chunk_dir, hash), tmp_prefix + std::to_string(i), buffer, length, false);
+            outcomes[i] = CHUNK_WRITTEN;
+        }
+        current.hashes[i] = std::move(hash);
+    });
+
+    for (size_t i = 0; i < stats.chunks; ++i) {
+        switch (outcomes[i]) {
+            case CHUNK_ZERO: ++stats.zero; break;
+            case CHUNK_UNCHANGED: ++stats.unchanged; break;
+            case CHUNK_DEDUPLICATED: ++stats.deduplicated; break;
+            case CHUNK_WRITTEN:
+                ++stats.written;
+                stats.bytes_written += std::min<uint64_t>(chunk_size, stats.size - uint64_t(i) * chunk_size);
+                break;
+        }
+    }
+
+    // Манифест не должен ссылаться на блоки, которых после сбоя питания нет на диске
+    if (stats.written > 0) {
+        TraceSpan sync_span("syncfs", chunk_dir);
+        if (syncfs(chunk_dir_fd.get()) != 0) {
+            fail("Failed to sync " + chunk_dir, errno);
+        }
+    }
+    save_manifest(path, current);
+
+    // Блоки прошлой копии, которые больше никому не нужны
+    std::unordered_set<std::string> keep(current.hashes.begin(), current.hashes.end());
+    if (!previous.hashes.empty() && referenced_hashes(dir, path, keep)) {
+        for (const auto& hash : previous.hashes) {
+            if (!hash.empty() && keep.insert(hash).second &&
+                ::unlink(chunk_path(chunk_dir, hash).c_str()) == 0) {
+                ++stats.pruned;
+            }
+        }
+    }
+    return stats;
+}
+
+BackupStats ChunkBackup::restore(const std::string& dir, const std::string& name, int image_fd) {
+    TraceSpan span("restore", name);
+    // Параллельная копия не удалит блоки прочитанного манифеста посреди чтения
+    std::string chunk_dir = dir + "/chunks";
+    UniqueFd chunk_dir_fd;
+    if (file_exists(chunk_dir)) {
+        chunk_dir_fd = lock_chunk_store(chunk_dir, LOCK_SH);
+    }
+
+    std::string path = manifest_path(dir, name);
+    Manifest manifest = load_manifest(path);
+    if (manifest.chunk_size == 0) {
+        throw VaultError("No backup of " + name + " in " + dir);
+    }
+
+    BackupStats stats;
+    stats.size = manifest.size;
+    stats.chunk_size = manifest.chunk_size;
+    stats.chunks = manifest.hashes.size();
+
+    // Нулевые блоки остаются дырами полноразмерного файла
+    if (::ftruncate(image_fd, static_cast<off_t>(manifest.size)) != 0) {
+        fail("Failed to size restored image of " + name, errno);
+    }
+
+    for_each_chunk(stats.chunks, manifest.chunk_size, [&](size_t i, uint8_t* buffer) {
+        const std::string& hash = manifest.hashes[i];
+        if (hash.empty()) {
+            return;
+        }
+        uint64_t offset = static_cast<uint64_t>(i) * manifest.chunk_size;
+        size_t length = static_cast<size_t>(std::min<uint64_t>(manifest.chunk_size, manifest.size - offset));
+
+        std::string chunk = chunk_path(chunk_dir, hash);
+        UniqueFd fd(::open(chunk.c_str(), O_RDONLY | O_CLOEXEC));
+        if (!fd.valid()) {
+            fail("Missing backup chunk " + chunk, errno);
+        }
+        struct stat chunk_st;
+        if (fstat(fd.get(), &chunk_st) != 0 || static_cast<uint64_t>(chunk_st.st_size) != length) {
+            throw VaultError("Backup chunk " + chunk + " has the wrong size");
+        }
+        read_exact(fd.get(), buffer, length, 0, chunk);
+        if (sha256_hex(buffer, length) != hash) {
+            throw VaultError("Backup chunk " + chunk + " is corrupted");
+        }
+        write_exact(image_fd, buffer, length, offset, "restored image of " + name);
+    });
+
+    for (size_t i = 0; i < stats.chunks; ++i) {
+        if (manifest.hashes[i].empty()) {
+            ++stats.zero;
+        } else {
+            ++stats.written;
+            stats.bytes_written += std::min<uint64_t>(manifest.chunk_size,
+                                                      manifest.size - uint64_t(i) * manifest.chunk_size);
+        }
+    }
+    return stats;
+}
+
+} // namespace tpm_vault
@@ -0,0 +1,200 @@
+#include "cipher_benchmark.hpp"
+#include "utils.hpp"
+
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/if_alg.h>
+
+#ifndef SOL_ALG
+#define SOL_ALG 279
+#endif
+
+namespace tpm_vault {
+
+namespace {
+
+/// Объём данных, прогоняемых за один проход замера
+constexpr size_t BENCH_BUFFER_SIZE = 1024 * 1024;
+
+} // namespace
+
+const std::vector<CipherCandidate>& CipherBenchmark::candidates() {
+    // aes-xts с 512-битным ключом — то же, что cryptsetup выбирает по умолчанию.
+    // Adiantum рассчитан на CPU без AES-NI: там он в разы быстрее aes-xts.
+    static const std::vector<CipherCandidate> list = {
+        {"aes-xts-plain64",                "xts(aes)",                64, 16},
+        {"xchacha12,aes-adiantum-plain64", "adiantum(xchacha12,aes)", 32, 32},
+        {"xchacha20,aes-adiantum-plain64", "adiantum(xchacha20,aes)", 32, 32},
+    };
+    return list;
+}
+
+void CipherBenchmark::split_spec(const std::string& spec, std::string& cipher, std::string& mode) {
+    size_t dash = spec.find('-');
+    if (dash == std::string::npos || dash == 0 || dash + 1 == spec.size()) {
+        throw VaultError("Invalid cipher specification: " + spec + " (expected e.g. aes-xts-plain64)");
+    }
+    cipher = spec.substr(0, dash);
+    mode = spec.substr(dash + 1);
+}
+
+double CipherBenchmark::measure(const CipherCandidate& candidate, bool encrypt,
+                                uint32_t sector_size, std::chrono::milliseconds duration) {
+    UniqueFd tfm(socket(AF_ALG, SOCK_SEQPACKET | SOCK_CLOEXEC, 0));
+    if (!tfm.valid()) {
+        return -1;
+    }
+
+    struct sockaddr_alg sa;
+    std::memset(&sa, 0, sizeof(sa));
+    sa.salg_family = AF_ALG;
+    std::strncpy(reinterpret_cast<char*>(sa.salg_type), "skcipher", sizeof(sa.salg_type) - 1);
+    std::strncpy(reinterpret_cast<char*>(sa.salg_name), candidate.kernel_alg.c_str(),
+                 sizeof(sa.salg_name) - 1);
+    if (bind(tfm.get(), reinterpret_cast<struct sockaddr*>(&sa), sizeof(sa)) != 0) {
+        return -1; // Шифр не поддерживается ядром
+    }
+
+    // Ключ одноразовый, но всё равно не оставляем его в памяти
+    {
+        auto key = generate_random_bytes(candidate.key_size);
+        int rc = setsockopt(tfm.get(), SOL_ALG, ALG_SET_KEY, key.data(), key.size());
+        secure_erase(key);
+        if (rc != 0) {
+            return -1;
+        }
+    }
+
+    UniqueFd op(accept(tfm.get(), nullptr, nullptr));
+    if (!op.valid()) {
+        return -1;
+    }
+
+    std::vector<uint8_t> input(BENCH_BUFFER_SIZE, 0xA5);
+    std::vector<uint8_t> output(sector_size);
+
+    // Управляющее сообщение: направление операции и IV сектора
+    std::vector<uint8_t> control(CMSG_SPACE(sizeof(uint32_t)) +
+                                 CMSG_SPACE(sizeof(struct af_alg_iv) + candidate.iv_size), 0);
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_ALG;
+    cmsg->cmsg_type = ALG_SET_OP;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint32_t));
+    uint32_t operation = encrypt ? ALG_OP_ENCRYPT : ALG_OP_DECRYPT;
+    std::memcpy(CMSG_DATA(cmsg), &operation, sizeof(operation));
+
+    cmsg = CMSG_NXTHDR(&msg, cmsg);
+    cmsg->cmsg_level = SOL_ALG;
+    cmsg->cmsg_type = ALG_SET_IV;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(struct af_alg_iv) + candidate.iv_size);
+    auto* iv = reinterpret_cast<struct af_alg_iv*>(CMSG_DATA(cmsg));
+    iv->ivlen = static_cast<uint32_t>(candidate.iv_size);
+
+    struct iovec iov;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    // Как dm-crypt: одна операция на сектор, IV plain64 = номер сектора (LE)
+    uint64_t bytes = 0;
+    uint64_t sector = 0;
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + duration;
+
+    do {
+        for (size_t offset = 0; offset + sector_size <= input.size(); offset += sector_size) {
+            std::memset(iv->iv, 0, candidate.iv_size);
+            for (size_t b = 0; b < 8 && b < candidate.iv_size; ++b) {
+                iv->iv[b] = static_cast<uint8_t>(sector >> (8 * b));
+            }
+            ++sector;
+
+            iov.iov_base = input.data() + offset;
+            iov.iov_len = sector_size;
+            if (sendmsg(op.get(), &msg, 0) != static_cast<ssize_t>(sector_size)) {
+                return -1;
+            }
+            if (::read(op.get(), output.data(), sector_size) != static_cast<ssize_t>(sector_size)) {
+                return -1;
+            }
+            bytes += sector_size;
+        }
+    } while (std::chrono::steady_clock::now() < deadline);
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return (bytes / (1024.0 * 1024.0)) / seconds;
+}
+
+std::vector<CipherBenchResult> CipherBenchmark::run(uint32_t sector_size,
+                                                    std::chrono::milliseconds duration) {
+    std::vector<CipherBenchResult> results;
+
+    for (const auto& candidate : candidates()) {
+        CipherBenchResult result;
+        result.spec = candidate.spec;
+        result.key_size = candidate.key_size;
+
+        double enc = measure(candidate, true, sector_size, duration);
+        double dec = enc >= 0 ? measure(candidate, false, sector_size, duration) : -1;
+        if (enc >= 0 && dec >= 0) {
+            result.available = true;
+            result.encrypt_mib_s = enc;
+            result.decrypt_mib_s = dec;
+        }
+        results.push_back(result);
+    }
+
+    return results;
+}
+
+const CipherCandidate& CipherBenchmark::pick(const std::vector<CipherBenchResult>& results) {
+    const CipherCandidate& preferred = candidates().front(); // aes-xts-plain64
+    const CipherBenchResult* preferred_result = nullptr;
+    const CipherBenchResult* fastest = nullptr;
+
+    auto speed = [](const CipherBenchResult& r) {
+        return (r.encrypt_mib_s + r.decrypt_mib_s) / 2;
+    };
+
+    for (const auto& result : results) {
+        if (!result.available) continue;
+        if (result.spec == preferred.spec) {
+            preferred_result = &result;
+        }
+        if (!fastest || speed(result) > speed(*fastest)) {
+            fastest = &result;
+        }
+    }
+
+    if (!fastest) {
+        return preferred;
+    }
+    if (preferred_result && speed(*fastest) < speed(*preferred_result) * PREFERENCE_MARGIN) {
+        return preferred;
+    }
+    for (const auto& candidate : candidates()) {
+        if (candidate.spec == fastest->spec) {
+            return candidate;
+        }
+    }
+    return preferred;
+}
+
+size_t CipherBenchmark::key_size_for(const std::string& spec) {
+    for (const auto& candidate : candidates()) {
+        if (candidate.spec == spec) {
+            return candidate.key_size;
+        }
+    }
+    std::string cipher, mode;
+    split_spec(spec, cipher, mode);
+    // XTS делит ключ пополам между двумя экземплярами шифра
+    return mode.compare(0, 3, "xts") == 0 ? 64 : 32;
+}
+
+} // namespace tpm_vault
@@ -0,0 +1,344 @@
+#include "command_runner.hpp"
+#include "trace.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+extern char** environ;
+
+namespace tpm_vault {
+
+namespace {
+
+/// Размер блока чтения stdout/stderr
+constexpr size_t READ_CHUNK = 64 * 1024;
+
+/**
+ * @brief pipe с O_CLOEXEC: в дочерний процесс попадают только концы,
+ *        явно назначенные на 0, 1 и 2
+ */
+struct Pipe {
+    UniqueFd read;
+    UniqueFd write;
+
+    Pipe() {
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC) != 0) {
+            throw VaultError(std::string("Failed to create pipe: ") + std::strerror(errno));
+        }
+        read.reset(fds[0]);
+        write.reset(fds[1]);
+    }
+};
+
+/**
+ * @brief Блокирует SIGPIPE в потоке на время записи в stdin команды
+ *
+ * Если команда завершится, не дочитав stdin, write() вернёт EPIPE,
+ * а не завершит tpm-vault сигналом.
+ */
+class SigpipeBlock {
+public:
+    SigpipeBlock() {
+        sigemptyset(&set_);
+        sigaddset(&set_, SIGPIPE);
+        sigset_t pending;
+        sigpending(&pending);
+        was_pending_ = sigismember(&pending, SIGPIPE) == 1;
+        pthread_sigmask(SIG_BLOCK, &set_, &old_);
+    }
+
+    ~SigpipeBlock() {
+        // SIGPIPE от наших write() не должен прийти после разблокировки
+        if (!was_pending_) {
+            struct timespec zero = {0, 0};
+            while (sigtimedwait(&set_, nullptr, &zero) > 0) {
+            }
+        }
+        pthread_sigmask(SIG_SETMASK, &old_, nullptr);
+    }
+
+    SigpipeBlock(const SigpipeBlock&) = delete;
+    SigpipeBlock& operator=(const SigpipeBlock&) = delete;
+
+private:
+    sigset_t set_;
+    sigset_t old_;
+    bool was_pending_;
+};
+
+/**
+ * @brief Читает доступные данные в конец строки; при EOF или ошибке закрывает fd
+ */
+void drain(UniqueFd& fd, std::string& data) {
+    size_t old_size = data.size();
+    data.resize(old_size + READ_CHUNK);
+    ssize_t n = ::read(fd.get(), &data[old_size], READ_CHUNK);
+    data.resize(old_size + (n > 0 ? static_cast<size_t>(n) : 0));
+    if (n == 0 || (n < 0 && errno != EINTR && errno != EAGAIN)) {
+        fd.reset();
+    }
+}
+
+/**
+ * @brief Ждёт завершения процесса не дольше deadline, не добирая его
+ *
+ * Нужно, когда команда закрыла stdout и stderr раньше, чем завершилась.
+ * Ждёт на pidfd; ядро без pidfd_open (до 5.3) опрашивается waitid.
+ *
+ * @return false, если к сроку процесс не завершился
+ */
+bool wait_exit(pid_t pid, std::chrono::steady_clock::time_point deadline) {
+    UniqueFd pidfd;
+#ifdef SYS_pidfd_open
+    pidfd.reset(static_cast<int>(::syscall(SYS_pidfd_open, pid, 0)));
+#endif
+    while (true) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now());
+        if (left.count() <= 0) {
+            return false;
+        }
+        if (pidfd.valid()) {
+            struct pollfd fd = {pidfd.get(), POLLIN, 0};
+            int ready = ::poll(&fd, 1, static_cast<int>(left.count()) + 1);
+            if (ready > 0) {
+                return true;
+            }
+            if (ready < 0 && errno != EINTR) {
+                pidfd.reset();
+            }
+            continue;
+        }
+        siginfo_t info{};
+        if (::waitid(P_PID, static_cast<id_t>(pid), &info, WEXITED | WNOHANG | WNOWAIT) != 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return true; // ECHILD: ждать нечего
+        }
+        if (info.si_pid == pid) {
+            return true;
+        }
+        ::poll(nullptr, 0, static_cast<int>(std::min<std::chrono::milliseconds::rep>(left.count(), 10)));
+    }
+}
+
+double to_ms(std::chrono::microseconds us) {
+    return us.count() / 1000.0;
+}
+
+} // namespace
+
+std::string CommandRunner::describe(const std::vector<std::string>& argv) {
+    std::string line;
+    for (const auto& arg : argv) {
+        if (!line.empty()) {
+            line += ' ';
+        }
+        if (!arg.empty() && arg.find_first_of(" \t\n'\"\\$") == std::string::npos) {
+            line += arg;
+        } else {
+            line += '\'';
+            for (char c : arg) {
+                line += c == '\'' ? std::string("'\\''") : std::string(1, c);
+            }
+            line += '\'';
+        }
+    }
+    return line;
+}
+
+CommandResult CommandRunner::run(const std::vector<std::string>& argv, const CommandOptions& options) {
+    if (argv.empty()) {
+        throw VaultError("Empty command");
+    }
+    std::string cmdline = describe(argv);
+    TraceSpan span("exec", cmdline);
+    auto start = std::chrono::steady_clock::now();
+
+    Pipe out_pipe;
+    Pipe err_pipe;
+    std::unique_ptr<Pipe> in_pipe;
+    if (options.stdin_data) {
+        in_pipe = std::make_unique<Pipe>();
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (in_pipe) {
+        posix_spawn_file_actions_adddup2(&actions, in_pipe->read.get(), STDIN_FILENO);
+    } else {
+        posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    }
+    posix_spawn_file_actions_adddup2(&actions, out_pipe.write.get(), STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, err_pipe.write.get(), STDERR_FILENO);
+
+    // Команда получает чистую маску сигналов и SIGPIPE по умолчанию,
+    // даже если вызывающий поток (или демон) их изменил
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t signals;
+    sigemptyset(&signals);
+    posix_spawnattr_setsigmask(&attr, &signals);
+    sigaddset(&signals, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &signals);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+    std::vector<char*> args;
+    for (const auto& arg : argv) {
+        args.push_back(const_cast<char*>(arg.c_str()));
+    }
+    args.push_back(nullptr);
+
+    pid_t pid = -1;
+    int rc = posix_spawnp(&pid, args[0], &actions, &attr, args.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if (rc != 0) {
+        throw VaultError("Failed to run " + argv[0] + ": " + std::strerror(rc));
+    }
+
+    // Концы дочернего процесса: без них EOF придёт вместе с его завершением
+    out_pipe.write.reset();
+    err_pipe.write.reset();
+    UniqueFd in_fd;
+    if (in_pipe) {
+        in_pipe->read.reset();
+        in_fd = std::move(in_pipe->write);
+        fcntl(in_fd.get(), F_SETFL, O_NONBLOCK);
+    }
+
+    CommandResult result;
+    bool timed_out = false;
+    {
+        std::unique_ptr<SigpipeBlock> sigpipe;
+        if (in_fd.valid()) {
+            sigpipe = std::make_unique<SigpipeBlock>();
+        }
+
+        size_t written = 0;
+        auto deadline = start + options.timeout;
+
+        while (out_pipe.read.valid() || err_pipe.read.valid() || in_fd.valid()) {
+            if (in_fd.valid() && written == options.stdin_data->size()) {
+                in_fd.reset(); // EOF для команды
+                continue;
+            }
+
+            struct pollfd fds[3];
+            UniqueFd* owners[3];
+            nfds_t count = 0;
+            if (in_fd.valid()) {
+                fds[count] = {in_fd.get(), POLLOUT, 0};
+                owners[count++] = &in_fd;
+            }
+            if (out_pipe.read.valid()) {
+                fds[count] = {out_pipe.read.get(), POLLIN, 0};
+                owners[count++] = &out_pipe.read;
+            }
+            if (err_pipe.read.valid()) {
+                fds[count] = {err_pipe.read.get(), POLLIN, 0};
+                owners[count++] = &err_pipe.read;
+            }
+
+            int wait_ms = -1;
+            if (options.timeout.count() > 0) {
+                auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    deadline - std::chrono::steady_clock::now());
+                if (left.count() <= 0) {
+                    timed_out = true;
+                    break;
+                }
+                wait_ms = static_cast<int>(left.count()) + 1;
+            }
+
+            int ready = ::poll(fds, count, wait_ms);
+            if (ready < 0 && errno != EINTR) {
+                int err = errno;
+                ::kill(pid, SIGKILL);
+                ::waitpid(pid, nullptr, 0);
+                throw VaultError("Failed to wait for " + argv[0] + ": " + std::strerror(err));
+            }
+
+            for (nfds_t i = 0; ready > 0 && i < count; ++i) {
+                if (fds[i].revents == 0) {
+                    continue;
+                }
+                if (owners[i] == &in_fd) {
+                    const auto& data = *options.stdin_data;
+                    ssize_t n = ::write(in_fd.get(), data.data() + written, data.size() - written);
+                    if (n > 0) {
+                        written += static_cast<size_t>(n);
+                    } else if (n < 0 && errno != EINTR && errno != EAGAIN) {
+                        in_fd.reset(); // Команда не читает stdin до конца
+                    }
+                } else {
+                    drain(*owners[i], owners[i] == &out_pipe.read ? result.out : result.err);
+                }
+            }
+        }
+    }
+
+    // Вывод закрыт, но команда может ещё работать: срок действует и здесь
+    if (!timed_out && options.timeout.count() > 0) {
+        timed_out = !wait_exit(pid, start + options.timeout);
+    }
+    if (timed_out) {
+        ::kill(pid, SIGKILL);
+    }
+
+    int status = 0;
+    while (::waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    result.wall_time = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
+
+    if (timed_out) {
+        std::ostringstream oss;
+        oss << cmdline << " timed out after " << options.timeout.count() << " ms and was killed";
+        throw VaultError(oss.str());
+    }
+
+    if (WIFEXITED(status)) {
+        result.exit_code = WEXITSTATUS(status);
+    } else if (WIFSIGNALED(status)) {
+        result.exit_code = 128 + WTERMSIG(status);
+    }
+    return result;
+}
+
+CommandResult CommandRunner::check(const std::string& what, const std::vector<std::string>& argv,
+                                   const CommandOptions& options) {
+    CommandResult result = run(argv, options);
+    if (result.exit_code == 0) {
+        return result;
+    }
+
+    std::string err = result.err;
+    while (!err.empty() && (err.back() == '\n' || err.back() == '\r')) {
+        err.pop_back();
+    }
+
+    std::ostringstream oss;
+    oss << what << ": " << argv[0] << " exited with " << result.exit_code
+        << " after " << std::fixed << std::setprecision(1) << to_ms(result.wall_time) << " ms";
+    if (!err.empty()) {
+        oss << " — " << err;
+    }
+    throw VaultError(oss.str());
+}
+
+} // namespace tpm_vault
@@ -0,0 +1,79 @@
+#include "crypt_backend.hpp"
+#include "utils.hpp"
+
+#include <fstream>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+namespace tpm_vault {
+
+std::string CryptBackend::get_mapper_path(const std::string& mapper_name) {
+    return "/dev/mapper/" + mapper_name;
+}
+
+std::string CryptBackend::get_mapper_name(const std::string& vault_name) {
+    return "tpm-vault-" + vault_name;
+}
+
+bool CryptBackend::is_open(const std::string& mapper_name) {
+    std::string mapper_path = get_mapper_path(mapper_name);
+    // Используем stat напрямую, так как /dev/mapper/* это блочные устройства, а не обычные файлы
+    struct stat st;
+    return stat(mapper_path.c_str(), &st) == 0;
+}
+
+std::unordered_map<std::string, uint64_t> CryptBackend::scan_active() {
+    std::unordered_map<std::string, uint64_t> result;
+
+    DIR* dir = opendir("/sys/block");
+    if (!dir) {
+        return result;
+    }
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        std::string block_name = entry->d_name;
+        if (block_name.compare(0, 3, "dm-") != 0) continue;
+
+        std::string base = "/sys/block/" + block_name;
+        std::ifstream name_file(base + "/dm/name");
+        std::ifstream dev_file(base + "/dev");
+        std::string name;
+        unsigned int dev_major = 0, dev_minor = 0;
+        char colon = 0;
+        if (!std::getline(name_file, name) || name.empty()) continue;
+        if (!(dev_file >> dev_major >> colon >> dev_minor) || colon != ':') continue;
+
+        result.emplace(std::move(name), makedev(dev_major, dev_minor));
+    }
+
+    closedir(dir);
+    return result;
+}
+
+void CryptBackend::apply_cpu_mask(const std::string& mapper_name, const std::string& cpu_mask) {
+    struct stat st;
+    std::string mapper_path = get_mapper_path(mapper_name);
+    if (stat(mapper_path.c_str(), &st) != 0) {
+        throw VaultError("Failed to stat " + mapper_path);
+    }
+
+    // dm-crypt регистрирует очередь kcryptd с WQ_SYSFS под именем kcryptd-<major>:<minor>
+    std::string path = "/sys/bus/workqueue/devices/kcryptd-" +
+                       std::to_string(major(st.st_rdev)) + ":" +
+                       std::to_string(minor(st.st_rdev)) + "/cpumask";
+
+    std::ofstream out(path);
+    if (!out) {
+        throw VaultError("kcryptd workqueue of " + mapper_name +
+                         " is not exposed in sysfs; CPU mask is not supported by this kernel");
+    }
+    out << cpu_mask;
+    out.flush();
+    if (!out) {
+        throw VaultError("Failed to set kcryptd CPU mask " + cpu_mask + " for " + mapper_name);
+    }
+}
+
+} // namespace tpm_vault
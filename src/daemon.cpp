@@ -0,0 +1,270 @@
+#include "daemon.hpp"
+#include "utils.hpp"
+
+#include <iostream>
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+namespace tpm_vault {
+
+namespace {
+
+/// Предельная длина строки запроса или заголовка ответа
+constexpr size_t MAX_LINE = 64 * 1024;
+
+volatile sig_atomic_t stop_requested = 0;
+
+void on_stop_signal(int) {
+    stop_requested = 1;
+}
+
+struct sockaddr_un make_address(const std::string& path) {
+    struct sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        throw VaultError("Socket path is too long: " + path);
+    }
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    return addr;
+}
+
+bool write_all(int fd, const std::string& data) {
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t n = ::send(fd, data.data() + written, data.size() - written, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        written += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+/// Читает строку до '\n' (без него); false при обрыве или слишком длинной строке
+bool read_line(int fd, std::string& line) {
+    line.clear();
+    char c;
+    while (line.size() < MAX_LINE) {
+        ssize_t n = ::read(fd, &c, 1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        if (c == '\n') return true;
+        line += c;
+    }
+    return false;
+}
+
+bool read_exact(int fd, std::string& data, size_t size) {
+    data.resize(size);
+    size_t got = 0;
+    while (got < size) {
+        ssize_t n = ::read(fd, &data[got], size - got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        got += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+std::vector<std::string> split_fields(const std::string& line) {
+    std::vector<std::string> fields;
+    size_t start = 0;
+    while (true) {
+        size_t tab = line.find('\t', start);
+        fields.push_back(line.substr(start, tab - start));
+        if (tab == std::string::npos) break;
+        start = tab + 1;
+    }
+    return fields;
+}
+
+} // namespace
+
+VaultDaemon::VaultDaemon(const std::string& socket_path, Handler handler)
+    : socket_path_(socket_path), handler_(std::move(handler)) {
+}
+
+void VaultDaemon::run() {
+    UniqueFd listen_fd(::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    if (!listen_fd.valid()) {
+        throw VaultError(std::string("Failed to create socket: ") + std::strerror(errno));
+    }
+
+    struct sockaddr_un addr = make_address(socket_path_);
+
+    // Сокет на месте: если на нём отвечают, демон уже работает; удалять
+    // можно только сокет, оставшийся от аварийно завершённого демона
+    struct stat st;
+    if (lstat(socket_path_.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+        UniqueFd probe(::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+        if (!probe.valid()) {
+            throw VaultError(std::string("Failed to create socket: ") + std::strerror(errno));
+        }
+        if (::connect(probe.get(), reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == 0) {
+            throw VaultError("tpm-vault daemon already running on " + socket_path_);
+        }
+        if (errno != ECONNREFUSED) {
+            throw VaultError("Failed to check existing socket " + socket_path_ + ": " + std::strerror(errno));
+        }
+        ::unlink(socket_path_.c_str());
+    }
+
+    if (::bind(listen_fd.get(), reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+        throw VaultError("Failed to bind " + socket_path_ + ": " + std::strerror(errno));
+    }
+    ::chmod(socket_path_.c_str(), 0600);
+
+    // Удаляем только свой сокет: путь мог занять другой демон после нашего запуска
+    struct stat own;
+    bool have_own = lstat(socket_path_.c_str(), &own) == 0;
+    auto remove_socket = [&] {
+        struct stat now;
+        if (have_own && lstat(socket_path_.c_str(), &now) == 0 &&
+            now.st_dev == own.st_dev && now.st_ino == own.st_ino) {
+            ::unlink(socket_path_.c_str());
+        }
+    };
+
+    if (::listen(listen_fd.get(), 16) != 0) {
+        int err = errno;
+        remove_socket();
+        throw VaultError("Failed to listen on " + socket_path_ + ": " + std::strerror(err));
+    }
+    std::cerr << "tpm-vault daemon listening on " << socket_path_ << "\n";
+
+    // Без SA_RESTART: accept() прерывается сигналом остановки
+    struct sigaction sa;
+    std::memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_stop_signal;
+    sigaction(SIGTERM, &sa, nullptr);
+    sigaction(SIGINT, &sa, nullptr);
+    std::signal(SIGPIPE, SIG_IGN);
+
+    while (!stop_requested) {
+        UniqueFd client(::accept4(listen_fd.get(), nullptr, nullptr, SOCK_CLOEXEC));
+        if (!client.valid()) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            int err = errno;
+            remove_socket();
+            throw VaultError(std::string("Failed to accept connection: ") + std::strerror(err));
+        }
+        serve(client.get());
+    }
+
+    remove_socket();
+}
+
+void VaultDaemon::serve(int client_fd) {
+    // Команды выполняются с правами демона, поэтому только для root
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    if (getsockopt(client_fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0 || cred.uid != 0) {
+        return;
+    }
+
+    // Зависший клиент не должен блокировать очередь
+    struct timeval timeout = {5, 0};
+    setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    std::string line;
+    if (!read_line(client_fd, line)) {
+        return;
+    }
+    std::vector<std::string> fields = split_fields(line);
+    std::string cwd = fields.front();
+    std::vector<std::string> args(fields.begin() + 1, fields.end());
+
+    std::ostringstream out;
+    std::ostringstream err;
+    int exit_code = 1;
+
+    if (args.empty()) {
+        err << "Error: Empty request\n";
+    } else if (cwd.empty() || cwd[0] != '/') {
+        err << "Error: Working directory must be an absolute path: " << cwd << "\n";
+    } else if (::chdir(cwd.c_str()) != 0) {
+        err << "Error: Failed to enter " << cwd << ": " << std::strerror(errno) << "\n";
+    } else {
+        // Команды печатают в std::cout/std::cerr; перенаправляем их в ответ
+        std::streambuf* old_out = std::cout.rdbuf(out.rdbuf());
+        std::streambuf* old_err = std::cerr.rdbuf(err.rdbuf());
+        try {
+            exit_code = handler_(args);
+        } catch (const std::exception& e) {
+            err << "Error: " << e.what() << "\n";
+            exit_code = 1;
+        }
+        std::cout.rdbuf(old_out);
+        std::cerr.rdbuf(old_err);
+    }
+
+    std::string out_data = out.str();
+    std::string err_data = err.str();
+    std::ostringstream header;
+    header << exit_code << "\t" << out_data.size() << "\t" << err_data.size() << "\n";
+    write_all(client_fd, header.str() + out_data + err_data);
+}
+
+bool DaemonClient::forward(const std::string& socket_path, const std::vector<std::string>& args,
+                           int& exit_code) {
+    std::string request = get_current_directory();
+    if (request.find_first_of("\t\n") != std::string::npos) {
+        return false; // Не передаётся протоколом — выполняем локально
+    }
+    for (const auto& arg : args) {
+        if (arg.find_first_of("\t\n") != std::string::npos) {
+            return false; // Не передаётся протоколом — выполняем локально
+        }
+        request += "\t" + arg;
+    }
+    request += "\n";
+
+    UniqueFd fd(::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    if (!fd.valid()) {
+        return false;
+    }
+    struct sockaddr_un addr = make_address(socket_path);
+    if (::connect(fd.get(), reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+        return false; // Демон не запущен
+    }
+
+    if (!write_all(fd.get(), request)) {
+        return false;
+    }
+
+    std::string header;
+    if (!read_line(fd.get(), header)) {
+        throw VaultError("tpm-vault daemon closed the connection without a reply");
+    }
+
+    std::vector<std::string> fields = split_fields(header);
+    size_t out_size = 0;
+    size_t err_size = 0;
+    try {
+        if (fields.size() != 3) throw std::invalid_argument(header);
+        exit_code = std::stoi(fields[0]);
+        out_size = std::stoull(fields[1]);
+        err_size = std::stoull(fields[2]);
+    } catch (const std::exception&) {
+        throw VaultError("Malformed reply from tpm-vault daemon");
+    }
+
+    std::string out_data;
+    std::string err_data;
+    if (!read_exact(fd.get(), out_data, out_size) || !read_exact(fd.get(), err_data, err_size)) {
+        throw VaultError("tpm-vault daemon closed the connection mid-reply");
+    }
+    std::cout << out_data << std::flush;
+    std::cerr << err_data << std::flush;
+    return true;
+}
+
+} // namespace tpm_vault
@@ -0,0 +1,327 @@
+#include "dm_crypt_manager.hpp"
+#include "cipher_benchmark.hpp"
+#include "luks_manager.hpp"
+#include "trace.hpp"
+#include "utils.hpp"
+
+#include <sstream>
+#include <iomanip>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <linux/fs.h>
+#include <linux/dm-ioctl.h>
+
+namespace tpm_vault {
+
+namespace {
+
+constexpr const char* DM_CONTROL_PATH = "/dev/mapper/control";
+
+/**
+ * @brief Буфер запроса к device-mapper: struct dm_ioctl и данные после неё
+ *
+ * Буфер выровнен по 8 байтам, как того требуют dm_target_spec,
+ * и затирается в деструкторе, поскольку таблица crypt содержит ключ.
+ */
+class DmRequest {
+public:
+    DmRequest(const std::string& name, size_t payload_size = 0)
+        : words_((sizeof(struct dm_ioctl) + payload_size + 7) / 8, 0), name_(name) {
+        if (name.size() >= DM_NAME_LEN) {
+            throw VaultError("Device mapper name is too long: " + name);
+        }
+        struct dm_ioctl* io = header();
+        io->version[0] = DM_VERSION_MAJOR;
+        io->version[1] = 0;
+        io->version[2] = 0;
+        io->data_size = static_cast<uint32_t>(words_.size() * 8);
+        io->data_start = sizeof(struct dm_ioctl);
+        std::strncpy(io->name, name.c_str(), DM_NAME_LEN - 1);
+    }
+
+    ~DmRequest() {
+        secure_erase(words_.data(), words_.size() * 8);
+    }
+
+    DmRequest(const DmRequest&) = delete;
+    DmRequest& operator=(const DmRequest&) = delete;
+
+    struct dm_ioctl* header() {
+        return reinterpret_cast<struct dm_ioctl*>(words_.data());
+    }
+
+    char* payload() {
+        return reinterpret_cast<char*>(words_.data()) + sizeof(struct dm_ioctl);
+    }
+
+    /// @return 0 или errno
+    int run(int control_fd, unsigned long command, const char* command_name) {
+        TraceSpan span(command_name, name_);
+        return ioctl(control_fd, command, header()) == 0 ? 0 : errno;
+    }
+
+private:
+    std::vector<uint64_t> words_;
+    std::string name_;
+};
+
+UniqueFd open_control() {
+    UniqueFd fd(::open(DM_CONTROL_PATH, O_RDWR | O_CLOEXEC));
+    if (!fd.valid()) {
+        if (errno == ENOENT) {
+            throw VaultError(std::string(DM_CONTROL_PATH) +
+                             " not found; device-mapper is not available (modprobe dm_mod)");
+        }
+        throw VaultError(std::string("Failed to open ") + DM_CONTROL_PATH + ": " + std::strerror(errno));
+    }
+    return fd;
+}
+
+/**
+ * @brief Переводит спецификацию cryptsetup в формат таблицы dm-crypt
+ *
+ * "aes-xts-plain64" передаётся как есть, а составные шифры вида
+ * "xchacha12,aes-adiantum-plain64" — в нотации crypto API:
+ * "capi:adiantum(xchacha12,aes)-plain64".
+ */
+std::string table_cipher(const std::string& spec) {
+    std::string cipher, mode;
+    CipherBenchmark::split_spec(spec, cipher, mode);
+    if (cipher.find(',') == std::string::npos) {
+        return spec;
+    }
+
+    size_t dash = mode.find('-');
+    std::string chain = mode.substr(0, dash);
+    std::string iv = dash == std::string::npos ? "" : mode.substr(dash);
+    return "capi:" + chain + "(" + cipher + ")" + iv;
+}
+
+void remove_device(int control_fd, const std::string& mapper_name) {
+    DmRequest request(mapper_name);
+    request.run(control_fd, DM_DEV_REMOVE, "DM_DEV_REMOVE");
+}
+
+} // namespace
+
+std::string DmCryptManager::get_profile_args(const std::string& profile) {
+    // Те же флаги, что LuksManager::get_profile_flags, в записи таблицы dm-crypt
+    LuksManager::get_profile_flags(profile);
+    if (profile == "latency") {
+        return "no_read_workqueue no_write_workqueue";
+    }
+    if (profile == "throughput") {
+        return "same_cpu_crypt submit_from_crypt_cpus";
+    }
+    return "";
+}
+
+std::string DmCryptManager::make_uuid(const std::string& mapper_name) {
+    return "CRYPT-PLAIN-" + mapper_name;
+}
+
+std::string DmCryptManager::build_table(const std::string& device, const std::vector<uint8_t>& key,
+                                        const LuksOptions& options) {
+    struct stat st;
+    if (stat(device.c_str(), &st) != 0 || !S_ISBLK(st.st_mode)) {
+        throw VaultError(device + " is not a block device");
+    }
+
+    size_t key_size = std::min(CipherBenchmark::key_size_for(options.cipher), key.size());
+
+    std::vector<std::string> optional;
+    if (options.sector_size > 512) {
+        // Как у LUKS2: IV считается в секторах шифрования, а не в 512-байтовых
+        optional.push_back("sector_size:" + std::to_string(options.sector_size));
+        optional.push_back("iv_large_sectors");
+    }
+    std::istringstream profile_args(get_profile_args(options.perf_profile));
+    for (std::string arg; profile_args >> arg; ) {
+        optional.push_back(arg);
+    }
+
+    std::ostringstream table;
+    table << table_cipher(options.cipher) << " ";
+    table << std::hex << std::setfill('0');
+    for (size_t i = 0; i < key_size; ++i) {
+        table << std::setw(2) << static_cast<unsigned>(key[i]);
+    }
+    table << std::dec << " 0 " << major(st.st_rdev) << ":" << minor(st.st_rdev) << " 0";
+    if (!optional.empty()) {
+        table << " " << optional.size();
+        for (const auto& arg : optional) {
+            table << " " << arg;
+        }
+    }
+    return table.str();
+}
+
+void DmCryptManager::format(const std::string& device, const std::vector<uint8_t>& key,
+                            const LuksOptions& options) {
+    (void)key;
+    last_kdf_time_ = std::chrono::microseconds(0);
+
+    std::string cipher, mode;
+    CipherBenchmark::split_spec(options.cipher, cipher, mode);
+    get_profile_args(options.perf_profile);
+
+    UniqueFd fd(::open(device.c_str(), O_RDONLY | O_CLOEXEC));
+    uint64_t size = 0;
+    if (!fd.valid() || ioctl(fd.get(), BLKGETSIZE64, &size) != 0) {
+        throw VaultError("Failed to query size of " + device + ": " + std::strerror(errno));
+    }
+    uint32_t sector = options.sector_size != 0 ? options.sector_size : 512;
+    if (size == 0 || size % sector != 0) {
+        throw VaultError("Size of " + device + " is not a multiple of the " +
+                         std::to_string(sector) + "-byte encryption sector");
+    }
+}
+
+void DmCryptManager::load_table(int control_fd, const std::string& device, const std::string& mapper_name,
+                                const std::vector<uint8_t>& key, const LuksOptions& options) {
+    uint64_t sectors = 0;
+    {
+        UniqueFd fd(::open(device.c_str(), O_RDONLY | O_CLOEXEC));
+        uint64_t size = 0;
+        if (!fd.valid() || ioctl(fd.get(), BLKGETSIZE64, &size) != 0) {
+            throw VaultError("Failed to query size of " + device + ": " + std::strerror(errno));
+        }
+        sectors = size / 512;
+    }
+
+    std::string params = build_table(device, key, options);
+    size_t spec_size = (sizeof(struct dm_target_spec) + params.size() + 1 + 7) & ~size_t(7);
+
+    DmRequest request(mapper_name, spec_size);
+    request.header()->target_count = 1;
+    request.header()->flags = DM_SECURE_DATA_FLAG; // ядро затрёт свою копию ключа
+
+    auto* spec = reinterpret_cast<struct dm_target_spec*>(request.payload());
+    spec->sector_start = 0;
+    spec->length = sectors;
+    spec->next = static_cast<uint32_t>(spec_size);
+    std::strncpy(spec->target_type, "crypt", DM_MAX_TYPE_NAME - 1);
+    std::memcpy(request.payload() + sizeof(struct dm_target_spec), params.c_str(), params.size() + 1);
+    secure_erase(&params[0], params.size());
+
+    int err = request.run(control_fd, DM_TABLE_LOAD, "DM_TABLE_LOAD");
+    if (err != 0) {
+        throw VaultError("Failed to load dm-crypt table for " + mapper_name + ": " +
+                         std::strerror(err) + " (is cipher " + options.cipher + " supported?)");
+    }
+}
+
+void DmCryptManager::open(const std::string& device, const std::string& mapper_name,
+                          const std::vector<uint8_t>& key, const LuksOptions& options) {
+    // Если устройство уже открыто, сначала закрываем его
+    if (is_open(mapper_name)) {
+        close(mapper_name);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    UniqueFd control = open_control();
+
+    // 1. Создаём пустое устройство
+    {
+        DmRequest request(mapper_name);
+        std::string uuid = make_uuid(mapper_name);
+        std::strncpy(request.header()->uuid, uuid.c_str(), DM_UUID_LEN - 1);
+        int err = request.run(control.get(), DM_DEV_CREATE, "DM_DEV_CREATE");
+        if (err != 0) {
+            throw VaultError("Failed to create device mapper device " + mapper_name + ": " +
+                             std::strerror(err));
+        }
+    }
+
+    try {
+        // 2. Загружаем таблицу с единственной целью crypt
+        load_table(control.get(), device, mapper_name, key, options);
+
+        // 3. Resume делает загруженную таблицу активной
+        uint64_t dev = 0;
+        {
+            DmRequest request(mapper_name);
+            int err = request.run(control.get(), DM_DEV_SUSPEND, "DM_DEV_SUSPEND");
+            if (err != 0) {
+                throw VaultError("Failed to activate " + mapper_name + ": " + std::strerror(err));
+            }
+            dev = request.header()->dev;
+        }
+
+        ensure_node(mapper_name, dev);
+    } catch (const VaultError&) {
+        remove_device(control.get(), mapper_name);
+        throw;
+    }
+
+    last_kdf_time_ = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
+
+    if (!options.cpu_mask.empty()) {
+        try {
+            apply_cpu_mask(mapper_name, options.cpu_mask);
+        } catch (const VaultError&) {
+            try { close(mapper_name); } catch (...) {}
+            throw;
+        }
+    }
+}
+
+void DmCryptManager::resize(const std::string& device, const std::string& mapper_name,
+                            const std::vector<uint8_t>& key, const LuksOptions& options) {
+    UniqueFd control = open_control();
+    load_table(control.get(), device, mapper_name, key, options);
+
+    // Resume с загруженной неактивной таблицей: suspend, замена таблицы, resume
+    DmRequest request(mapper_name);
+    int err = request.run(control.get(), DM_DEV_SUSPEND, "DM_DEV_SUSPEND");
+    if (err != 0) {
+        DmRequest clear(mapper_name);
+        clear.run(control.get(), DM_TABLE_CLEAR, "DM_TABLE_CLEAR");
+        throw VaultError("Failed to switch " + mapper_name + " to the resized table: " + std::strerror(err));
+    }
+}
+
+void DmCryptManager::ensure_node(const std::string& mapper_name, uint64_t dev) {
+    if (is_open(mapper_name)) {
+        return; // Узел уже создал udev
+    }
+
+    // Без udev (контейнеры, initramfs) узел создаём сами, как libdevmapper
+    std::string path = get_mapper_path(mapper_name);
+    dev_t rdev = makedev(major(dev), minor(dev));
+    if (mknod(path.c_str(), S_IFBLK | 0600, rdev) != 0 && errno != EEXIST) {
+        throw VaultError("Failed to create " + path + ": " + std::strerror(errno));
+    }
+}
+
+void DmCryptManager::close(const std::string& mapper_name) {
+    if (!is_open(mapper_name)) {
+        return; // Уже закрыт
+    }
+
+    UniqueFd control = open_control();
+    DmRequest request(mapper_name);
+    int err = request.run(control.get(), DM_DEV_REMOVE, "DM_DEV_REMOVE");
+    if (err == EBUSY) {
+        throw VaultError("Failed to close " + mapper_name + ": device is busy");
+    }
+    if (err != 0 && err != ENXIO) {
+        throw VaultError("Failed to close " + mapper_name + ": " + std::strerror(err));
+    }
+
+    // Узел, созданный в ensure_node(), udev не удалит
+    std::string path = get_mapper_path(mapper_name);
+    if (::unlink(path.c_str()) != 0 && errno != ENOENT) {
+        throw VaultError("Failed to remove " + path + ": " + std::strerror(errno));
+    }
+}
+
+} // namespace tpm_vault
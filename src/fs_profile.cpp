@@ -0,0 +1,141 @@
+#include "fs_profile.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+namespace tpm_vault {
+
+namespace {
+
+constexpr uint64_t MiB = 1024 * 1024;
+
+/// Блок ext4: не меньше сектора шифрования, иначе запись блока — чтение-изменение сектора
+constexpr uint32_t EXT4_BLOCK = 4096;
+
+std::vector<std::string> ext4_default(const DeviceGeometry&) {
+    return {"-q"};
+}
+
+/**
+ * @brief ext4 под хранилище: без полной инициализации таблиц inode,
+ *        с fast_commit и журналом по размеру тома
+ */
+std::vector<std::string> ext4_tuned(const DeviceGeometry& geometry) {
+    // Журнал ~1/128 тома, от 4 МиБ (минимум mke2fs) до 256 МиБ
+    uint64_t journal_mb = std::clamp<uint64_t>(geometry.size / 128 / MiB, 4, 256);
+
+    return {
+        "-q",
+        "-b", std::to_string(EXT4_BLOCK),
+        "-m", "0",
+        "-O", "fast_commit",
+        "-J", "size=" + std::to_string(journal_mb),
+        "-E", "lazy_itable_init=1,lazy_journal_init=1",
+    };
+}
+
+std::vector<std::string> xfs_default(const DeviceGeometry& geometry) {
+    return {"-q", "-f", "-s", "size=" + std::to_string(geometry.sector_size)};
+}
+
+/**
+ * @brief XFS под большие файлы: мало групп размещения, минимум места под inode
+ */
+std::vector<std::string> xfs_large_files(const DeviceGeometry& geometry) {
+    return {"-q", "-f", "-s", "size=" + std::to_string(geometry.sector_size),
+            "-d", "agcount=4", "-i", "maxpct=5"};
+}
+
+std::vector<std::string> btrfs_default(const DeviceGeometry&) {
+    return {"-q", "-f"};
+}
+
+std::vector<std::string> f2fs_default(const DeviceGeometry&) {
+    return {"-q", "-f"};
+}
+
+} // namespace
+
+const std::vector<FsProfile>& FsProfiles::all() {
+    static const std::vector<FsProfile> profiles = {
+        {"ext4", "default", "mkfs.ext4 defaults", {}, ext4_default},
+        {"ext4", "tuned", "lazy inode tables, fast_commit, sized journal, noatime",
+         {"noatime"}, ext4_tuned},
+        {"xfs", "default", "sector size of the crypt volume", {}, xfs_default},
+        {"xfs", "large-files", "4 allocation groups, 64M speculative preallocation",
+         {"noatime", "largeio", "allocsize=64m"}, xfs_large_files},
+        {"btrfs", "default", "mkfs.btrfs defaults", {}, btrfs_default},
+        {"btrfs", "compress", "transparent zstd compression", {"noatime", "compress=zstd:3"}, btrfs_default},
+        {"f2fs", "default", "mkfs.f2fs defaults", {}, f2fs_default},
+    };
+    return profiles;
+}
+
+const FsProfile& FsProfiles::find(const std::string& fs_type, const std::string& name) {
+    std::string known;
+    for (const auto& profile : all()) {
+        if (profile.fs_type == fs_type && profile.name == name) {
+            return profile;
+        }
+        if (profile.fs_type == fs_type) {
+            known += (known.empty() ? "" : ", ") + profile.name;
+        }
+    }
+    if (known.empty()) {
+        throw VaultError("Unknown filesystem " + fs_type + " (expected ext4, xfs, btrfs or f2fs)");
+    }
+    throw VaultError("Unknown " + fs_type + " profile " + name + " (expected " + known + ")");
+}
+
+std::vector<std::string> FsProfiles::mkfs_command(const FsProfile& profile, const std::string& device) {
+    std::vector<std::string> argv = {"mkfs." + profile.fs_type};
+    for (auto& arg : profile.mkfs_args(geometry(device))) {
+        argv.push_back(std::move(arg));
+    }
+    argv.push_back(device);
+    return argv;
+}
+
+bool FsProfiles::grows_online(const std::string& fs_type) {
+    return fs_type != "f2fs";
+}
+
+std::vector<std::string> FsProfiles::grow_command(const std::string& fs_type, const std::string& device,
+                                                  const std::string& mount_point) {
+    if (fs_type == "ext4") {
+        return {"resize2fs", device};
+    }
+    if (fs_type == "xfs") {
+        return {"xfs_growfs", mount_point};
+    }
+    if (fs_type == "btrfs") {
+        return {"btrfs", "filesystem", "resize", "max", mount_point};
+    }
+    if (fs_type == "f2fs") {
+        return {"resize.f2fs", device};
+    }
+    throw VaultError("Unknown filesystem " + fs_type + " (expected ext4, xfs, btrfs or f2fs)");
+}
+
+DeviceGeometry FsProfiles::geometry(const std::string& device) {
+    UniqueFd fd(::open(device.c_str(), O_RDONLY | O_CLOEXEC));
+    if (!fd.valid()) {
+        throw VaultError("Failed to open " + device + ": " + std::strerror(errno));
+    }
+
+    int logical_block = 0;
+    DeviceGeometry geometry;
+    if (ioctl(fd.get(), BLKSSZGET, &logical_block) != 0 ||
+        ioctl(fd.get(), BLKGETSIZE64, &geometry.size) != 0) {
+        throw VaultError("Failed to query block size of " + device + ": " + std::strerror(errno));
+    }
+    geometry.sector_size = static_cast<uint32_t>(logical_block);
+    return geometry;
+}
+
+} // namespace tpm_vault
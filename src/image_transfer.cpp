@@ -0,0 +1,368 @@
+#include "image_transfer.hpp"
+#include "trace.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <vector>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+namespace tpm_vault {
+
+namespace {
+
+constexpr char STREAM_MAGIC[8] = {'T', 'P', 'M', 'V', 'I', 'M', 'G', 0x01};
+
+/// Метаданные — несколько строк "ключ=значение"; больший размер означает мусор на входе
+constexpr uint64_t MAX_METADATA = 1024 * 1024;
+
+/// Порция одного вызова copy_file_range/sendfile/splice и буфер запасного пути
+constexpr size_t CHUNK = 8 * 1024 * 1024;
+constexpr size_t BUFFER_SIZE = 1024 * 1024;
+
+[[noreturn]] void fail(const std::string& what, int err) {
+    throw VaultError(what + ": " + std::strerror(err));
+}
+
+uint64_t file_size(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        fail("Failed to stat image", errno);
+    }
+    return static_cast<uint64_t>(st.st_size);
+}
+
+void put_u64(uint8_t* out, uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+        out[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+uint64_t get_u64(const uint8_t* in) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; ++i) {
+        value |= static_cast<uint64_t>(in[i]) << (8 * i);
+    }
+    return value;
+}
+
+void write_all(int fd, const void* data, size_t size) {
+    const auto* p = static_cast<const uint8_t*>(data);
+    while (size > 0) {
+        ssize_t n = ::write(fd, p, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fail("Failed to write stream", errno);
+        }
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+}
+
+/**
+ * @brief Читает ровно size байт
+ * @throws VaultError при ошибке или конце потока раньше времени
+ */
+void read_all(int fd, void* data, size_t size) {
+    auto* p = static_cast<uint8_t*>(data);
+    while (size > 0) {
+        ssize_t n = ::read(fd, p, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fail("Failed to read stream", errno);
+        }
+        if (n == 0) {
+            throw VaultError("Image stream is truncated");
+        }
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+}
+
+void write_record(int fd, uint64_t a, uint64_t b) {
+    uint8_t record[16];
+    put_u64(record, a);
+    put_u64(record + 8, b);
+    write_all(fd, record, sizeof(record));
+}
+
+/**
+ * @brief Обходит экстенты с данными: SEEK_DATA находит начало, SEEK_HOLE — конец
+ *
+ * ФС без SEEK_DATA (EINVAL) отдаёт остаток файла одним экстентом.
+ * Смещение дескриптора меняется, поэтому копирование идёт по явным смещениям.
+ */
+template <typename Fn>
+void for_each_extent(int fd, uint64_t size, Fn&& fn) {
+    uint64_t offset = 0;
+    while (offset < size) {
+        off_t data = ::lseek(fd, static_cast<off_t>(offset), SEEK_DATA);
+        if (data < 0) {
+            if (errno == ENXIO) {
+                return; // До конца файла — дыра
+            }
+            if (errno != EINVAL) {
+                fail("Failed to find data in image", errno);
+            }
+            fn(offset, size - offset);
+            return;
+        }
+        off_t hole = ::lseek(fd, data, SEEK_HOLE);
+        if (hole < 0) {
+            fail("Failed to find hole in image", errno);
+        }
+        uint64_t end = std::min(static_cast<uint64_t>(hole), size);
+        if (static_cast<uint64_t>(data) >= end) {
+            return;
+        }
+        fn(static_cast<uint64_t>(data), end - static_cast<uint64_t>(data));
+        offset = end;
+    }
+}
+
+/// Ошибки, означающие «этим способом нельзя», а не сбой ввода-вывода
+bool unsupported(int err) {
+    return err == EINVAL || err == ENOSYS || err == EOPNOTSUPP || err == EXDEV || err == ENOTTY;
+}
+
+} // namespace
+
+TransferStats ImageTransfer::copy(int src_fd, int dst_fd) {
+    TransferStats stats;
+    stats.size = file_size(src_fd);
+
+    // Общие экстенты вместо копии: мгновенно при любом размере
+    {
+        TraceSpan span("reflink");
+        if (ioctl(dst_fd, FICLONE, src_fd) == 0) {
+            stats.method = "reflink";
+            return stats;
+        }
+        if (!unsupported(errno)) {
+            fail("Failed to clone image", errno);
+        }
+    }
+
+    TraceSpan span("copy_extents");
+    bool kernel_copy = true;
+    for_each_extent(src_fd, stats.size, [&](uint64_t offset, uint64_t length) {
+        if (!kernel_copy || !copy_range(src_fd, dst_fd, offset, length)) {
+            kernel_copy = false;
+            copy_range_buffered(src_fd, dst_fd, offset, length);
+        }
+        stats.data_bytes += length;
+        ++stats.extents;
+    });
+    stats.method = kernel_copy ? "copy_file_range" : "read/write";
+
+    // Хвостовая дыра: размер задаёт только ftruncate
+    if (::ftruncate(dst_fd, static_cast<off_t>(stats.size)) != 0) {
+        fail("Failed to size image copy", errno);
+    }
+    return stats;
+}
+
+bool ImageTransfer::copy_range(int src_fd, int dst_fd, uint64_t offset, uint64_t length) {
+    loff_t in = static_cast<loff_t>(offset);
+    loff_t out = static_cast<loff_t>(offset);
+    bool started = false;
+    while (length > 0) {
+        ssize_t n = ::copy_file_range(src_fd, &in, dst_fd, &out, std::min<uint64_t>(length, CHUNK), 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (!started && unsupported(errno)) {
+                return false;
+            }
+            fail("Failed to copy image", errno);
+        }
+        if (n == 0) {
+            throw VaultError("Image shrank while copying");
+        }
+        started = true;
+        length -= static_cast<uint64_t>(n);
+    }
+    return true;
+}
+
+void ImageTransfer::copy_range_buffered(int src_fd, int dst_fd, uint64_t offset, uint64_t length) {
+    std::vector<uint8_t> buffer(std::min<uint64_t>(length, BUFFER_SIZE));
+    while (length > 0) {
+        ssize_t n = ::pread(src_fd, buffer.data(), std::min<uint64_t>(length, buffer.size()),
+                            static_cast<off_t>(offset));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fail("Failed to read image", errno);
+        }
+        if (n == 0) {
+            throw VaultError("Image shrank while copying");
+        }
+        size_t done = 0;
+        while (done < static_cast<size_t>(n)) {
+            ssize_t w = ::pwrite(dst_fd, buffer.data() + done, static_cast<size_t>(n) - done,
+                                 static_cast<off_t>(offset + done));
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                fail("Failed to write image copy", errno);
+            }
+            done += static_cast<size_t>(w);
+        }
+        offset += static_cast<uint64_t>(n);
+        length -= static_cast<uint64_t>(n);
+    }
+}
+
+TransferStats ImageTransfer::write_stream(int src_fd, const std::string& metadata, int out_fd) {
+    TraceSpan span("write_stream");
+    TransferStats stats;
+    stats.method = "stream";
+    stats.size = file_size(src_fd);
+
+    write_all(out_fd, STREAM_MAGIC, sizeof(STREAM_MAGIC));
+    write_record(out_fd, stats.size, metadata.size());
+    write_all(out_fd, metadata.data(), metadata.size());
+
+    // sendfile пишет в канал без копии через пользовательский буфер
+    bool kernel_send = true;
+    std::vector<uint8_t> buffer;
+    for_each_extent(src_fd, stats.size, [&](uint64_t offset, uint64_t length) {
+        write_record(out_fd, offset, length);
+        stats.data_bytes += length;
+        ++stats.extents;
+
+        off_t pos = static_cast<off_t>(offset);
+        while (length > 0 && kernel_send) {
+            ssize_t n = ::sendfile(out_fd, src_fd, &pos, std::min<uint64_t>(length, CHUNK));
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (unsupported(errno)) {
+                    kernel_send = false;
+                    break;
+                }
+                fail("Failed to write stream", errno);
+            }
+            if (n == 0) {
+                throw VaultError("Image shrank while exporting");
+            }
+            length -= static_cast<uint64_t>(n);
+        }
+        if (length == 0) {
+            return;
+        }
+
+        buffer.resize(BUFFER_SIZE);
+        while (length > 0) {
+            ssize_t n = ::pread(src_fd, buffer.data(), std::min<uint64_t>(length, buffer.size()), pos);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                fail("Failed to read image", errno);
+            }
+            if (n == 0) {
+                throw VaultError("Image shrank while exporting");
+            }
+            write_all(out_fd, buffer.data(), static_cast<size_t>(n));
+            pos += n;
+            length -= static_cast<uint64_t>(n);
+        }
+    });
+
+    write_record(out_fd, stats.size, 0);
+    return stats;
+}
+
+TransferStats ImageTransfer::read_stream(int in_fd, int dst_fd, std::string& metadata) {
+    TraceSpan span("read_stream");
+    TransferStats stats;
+    stats.method = "stream";
+
+    char magic[sizeof(STREAM_MAGIC)];
+    read_all(in_fd, magic, sizeof(magic));
+    if (std::memcmp(magic, STREAM_MAGIC, sizeof(magic)) != 0) {
+        throw VaultError("Not a tpm-vault image stream");
+    }
+
+    uint8_t record[16];
+    read_all(in_fd, record, sizeof(record));
+    stats.size = get_u64(record);
+    uint64_t metadata_size = get_u64(record + 8);
+    if (stats.size == 0) {
+        throw VaultError("Image stream is corrupted: empty image");
+    }
+    if (metadata_size > MAX_METADATA) {
+        throw VaultError("Image stream is corrupted: metadata too large");
+    }
+    metadata.resize(metadata_size);
+    read_all(in_fd, &metadata[0], metadata_size);
+
+    // Из канала splice переносит страницы в файл без пользовательского буфера
+    struct stat st;
+    bool kernel_receive = fstat(in_fd, &st) == 0 && S_ISFIFO(st.st_mode);
+    std::vector<uint8_t> buffer;
+
+    uint64_t position = 0;
+    for (;;) {
+        read_all(in_fd, record, sizeof(record));
+        uint64_t offset = get_u64(record);
+        uint64_t length = get_u64(record + 8);
+        if (length == 0) {
+            if (offset != stats.size) {
+                throw VaultError("Image stream is corrupted: bad end marker");
+            }
+            break;
+        }
+        if (offset < position || offset > stats.size || length > stats.size - offset) {
+            throw VaultError("Image stream is corrupted: extent outside the image");
+        }
+        position = offset + length;
+        stats.data_bytes += length;
+        ++stats.extents;
+
+        loff_t out = static_cast<loff_t>(offset);
+        while (length > 0 && kernel_receive) {
+            ssize_t n = ::splice(in_fd, nullptr, dst_fd, &out, std::min<uint64_t>(length, CHUNK), SPLICE_F_MOVE);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (unsupported(errno)) {
+                    kernel_receive = false;
+                    break;
+                }
+                fail("Failed to write image", errno);
+            }
+            if (n == 0) {
+                throw VaultError("Image stream is truncated");
+            }
+            length -= static_cast<uint64_t>(n);
+        }
+
+        if (length > 0) {
+            buffer.resize(BUFFER_SIZE);
+        }
+        while (length > 0) {
+            size_t chunk = static_cast<size_t>(std::min<uint64_t>(length, buffer.size()));
+            read_all(in_fd, buffer.data(), chunk);
+            size_t done = 0;
+            while (done < chunk) {
+                ssize_t w = ::pwrite(dst_fd, buffer.data() + done, chunk - done, static_cast<off_t>(out));
+                if (w < 0) {
+                    if (errno == EINTR) continue;
+                    fail("Failed to write image", errno);
+                }
+                done += static_cast<size_t>(w);
+                out += w;
+            }
+            length -= chunk;
+        }
+    }
+
+    if (::ftruncate(dst_fd, static_cast<off_t>(stats.size)) != 0) {
+        fail("Failed to size imported image", errno);
+    }
+    return stats;
+}
+
+} // namespace tpm_vault
@@ -0,0 +1,69 @@
+#include "key_hierarchy.hpp"
+#include "trace.hpp"
+#include "utils.hpp"
+
+#include <openssl/evp.h>
+#include <openssl/kdf.h>
+
+#include <cstring>
+#include <memory>
+
+namespace tpm_vault {
+
+void KeyHierarchy::derive(const SecureBuffer& root, const std::vector<uint8_t>& salt, SecureBuffer& key) {
+    TraceSpan span("hkdf_sha512");
+
+    std::unique_ptr<EVP_PKEY_CTX, decltype(&EVP_PKEY_CTX_free)> ctx(
+        EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, nullptr), &EVP_PKEY_CTX_free);
+    size_t out_size = key.size();
+
+    bool ok = ctx &&
+        EVP_PKEY_derive_init(ctx.get()) > 0 &&
+        EVP_PKEY_CTX_set_hkdf_md(ctx.get(), EVP_sha512()) > 0 &&
+        EVP_PKEY_CTX_set1_hkdf_salt(ctx.get(), salt.data(), static_cast<int>(salt.size())) > 0 &&
+        EVP_PKEY_CTX_set1_hkdf_key(ctx.get(), root.data(), static_cast<int>(root.size())) > 0 &&
+        EVP_PKEY_CTX_add1_hkdf_info(ctx.get(), reinterpret_cast<const unsigned char*>(INFO),
+                                    static_cast<int>(std::strlen(INFO))) > 0 &&
+        EVP_PKEY_derive(ctx.get(), key.data(), &out_size) > 0 &&
+        out_size == key.size();
+
+    if (!ok) {
+        secure_erase(key.data(), key.size());
+        throw VaultError("Failed to derive vault key (HKDF-SHA512)");
+    }
+}
+
+std::vector<uint8_t> KeyHierarchy::new_salt() {
+    return generate_random_bytes(SALT_SIZE);
+}
+
+std::string KeyHierarchy::encode_salt(const std::vector<uint8_t>& salt) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(salt.size() * 2);
+    for (uint8_t b : salt) {
+        hex += digits[b >> 4];
+        hex += digits[b & 0x0f];
+    }
+    return hex;
+}
+
+std::vector<uint8_t> KeyHierarchy::decode_salt(const std::string& hex) {
+    auto nibble = [](char c) -> uint8_t {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        throw VaultError("Invalid key salt in metadata");
+    };
+
+    if (hex.size() != SALT_SIZE * 2) {
+        throw VaultError("Invalid key salt in metadata");
+    }
+    std::vector<uint8_t> salt(SALT_SIZE);
+    for (size_t i = 0; i < SALT_SIZE; ++i) {
+        salt[i] = static_cast<uint8_t>(nibble(hex[2 * i]) << 4 | nibble(hex[2 * i + 1]));
+    }
+    return salt;
+}
+
+} // namespace tpm_vault
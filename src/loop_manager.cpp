@@ -1,121 +1,275 @@
 #include "loop_manager.hpp"
+#include "trace.hpp"
 #include "utils.hpp"
 
-#include <sstream>
+#include <fstream>
 #include <algorithm>
-#include <climits>
 #include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/loop.h>
 
 namespace tpm_vault {
 
-std::string LoopManager::attach(const std::string& image_path) {
+std::string LoopManager::attach(const std::string& image_path, const LoopOptions& options) {
+    TraceSpan span("loop_attach", image_path);
+    
     // Проверяем, не подключён ли уже
     std::string existing = find_loop_for_file(image_path);
     if (!existing.empty()) {
         return existing; // Уже подключён
     }
     
-    // losetup --find --show <image_path>
-    std::string cmd = "losetup --find --show " + image_path;
+    UniqueFd file_fd(::open(image_path.c_str(), O_RDWR | O_CLOEXEC));
+    if (!file_fd.valid()) {
+        throw VaultError("Failed to open image " + image_path + ": " + std::strerror(errno));
+    }
+    
+    UniqueFd control_fd(::open("/dev/loop-control", O_RDWR | O_CLOEXEC));
+    if (!control_fd.valid()) {
+        throw VaultError(std::string("Failed to open /dev/loop-control: ") + std::strerror(errno));
+    }
     
-    try {
-        std::string loop_device = execute_command_output(cmd);
+    // LOOP_CTL_GET_FREE лишь возвращает номер свободного устройства, не резервируя его.
+    // Если другой процесс успел привязать к нему свой файл, берём следующее.
+    for (int attempt = 0; attempt < MAX_ATTACH_ATTEMPTS; ++attempt) {
+        int index = ioctl(control_fd.get(), LOOP_CTL_GET_FREE);
+        if (index < 0) {
+            throw VaultError(std::string("Failed to find free loop device: ") + std::strerror(errno));
+        }
         
-        // Проверяем что получили валидный путь
-        if (loop_device.empty() || loop_device.find("/dev/loop") != 0) {
-            throw VaultError("Invalid loop device returned: " + loop_device);
+        std::string loop_device = "/dev/loop" + std::to_string(index);
+        UniqueFd loop_fd(::open(loop_device.c_str(), O_RDWR | O_CLOEXEC));
+        if (!loop_fd.valid()) {
+            throw VaultError("Failed to open " + loop_device + ": " + std::strerror(errno));
         }
         
-        return loop_device;
-    } catch (const VaultError&) {
-        throw VaultError("Failed to attach " + image_path + " as loop device");
+        if (configure(loop_fd.get(), file_fd.get(), image_path, options)) {
+            try {
+                tune_queue(loop_device, options);
+            } catch (const VaultError&) {
+                ioctl(loop_fd.get(), LOOP_CLR_FD, 0);
+                throw;
+            }
+            return loop_device;
+        }
+    }
+    
+    throw VaultError("Failed to attach " + image_path + " as loop device: all free devices were taken concurrently");
+}
+
+bool LoopManager::configure(int loop_fd, int file_fd, const std::string& image_path,
+                            const LoopOptions& options) {
+    struct loop_info64 info;
+    std::memset(&info, 0, sizeof(info));
+    std::strncpy(reinterpret_cast<char*>(info.lo_file_name), image_path.c_str(), LO_NAME_SIZE - 1);
+    
+    // LOOP_CONFIGURE привязывает файл и выставляет параметры атомарно
+    struct loop_config config;
+    std::memset(&config, 0, sizeof(config));
+    config.fd = static_cast<uint32_t>(file_fd);
+    config.block_size = options.block_size;
+    config.info = info;
+    if (options.direct_io) {
+        config.info.lo_flags |= LO_FLAGS_DIRECT_IO;
+    }
+    
+    if (ioctl(loop_fd, LOOP_CONFIGURE, &config) == 0) {
+        return true;
+    }
+    if (errno == EBUSY) {
+        return false;
     }
+    if (errno != EINVAL && errno != ENOTTY) {
+        throw VaultError("Failed to configure loop device for " + image_path + ": " + std::strerror(errno));
+    }
+    
+    // Ядро старше 5.8: LOOP_SET_FD + LOOP_SET_STATUS64
+    if (ioctl(loop_fd, LOOP_SET_FD, file_fd) != 0) {
+        if (errno == EBUSY) {
+            return false;
+        }
+        throw VaultError("Failed to attach " + image_path + " as loop device: " + std::strerror(errno));
+    }
+    
+    if (ioctl(loop_fd, LOOP_SET_STATUS64, &info) != 0) {
+        int err = errno;
+        ioctl(loop_fd, LOOP_CLR_FD, 0);
+        throw VaultError("Failed to set loop device status for " + image_path + ": " + std::strerror(err));
+    }
+    
+    if (options.block_size != 0 &&
+        ioctl(loop_fd, LOOP_SET_BLOCK_SIZE, static_cast<unsigned long>(options.block_size)) != 0) {
+        int err = errno;
+        ioctl(loop_fd, LOOP_CLR_FD, 0);
+        throw VaultError("Failed to set loop block size for " + image_path + ": " + std::strerror(err));
+    }
+    
+    if (options.direct_io && ioctl(loop_fd, LOOP_SET_DIRECT_IO, 1UL) != 0) {
+        int err = errno;
+        ioctl(loop_fd, LOOP_CLR_FD, 0);
+        throw VaultError("Failed to enable direct I/O for " + image_path + ": " + std::strerror(err));
+    }
+    
+    return true;
+}
+
+void LoopManager::tune_queue(const std::string& loop_device, const LoopOptions& options) {
+    std::string queue_dir = "/sys/block/" + loop_device.substr(std::strlen("/dev/")) + "/queue/";
+    
+    auto write_attr = [&](const char* attr, uint32_t value) {
+        if (value == 0) return;
+        std::ofstream out(queue_dir + attr);
+        out << value;
+        out.flush();
+        if (!out) {
+            throw VaultError("Failed to set " + std::string(attr) + "=" + std::to_string(value) +
+                             " on " + loop_device);
+        }
+    };
+    
+    write_attr("read_ahead_kb", options.read_ahead_kb);
+    write_attr("nr_requests", options.nr_requests);
 }
 
 void LoopManager::detach(const std::string& loop_device) {
-    // losetup -d /dev/loopX
-    std::string cmd = "losetup -d " + loop_device;
+    TraceSpan span("loop_detach", loop_device);
+    UniqueFd loop_fd(::open(loop_device.c_str(), O_RDWR | O_CLOEXEC));
+    if (!loop_fd.valid()) {
+        throw VaultError("Failed to open " + loop_device + ": " + std::strerror(errno));
+    }
+    
+    if (ioctl(loop_fd.get(), LOOP_CLR_FD, 0) != 0) {
+        throw VaultError("Failed to detach loop device " + loop_device + ": " + std::strerror(errno));
+    }
+}
+
+void LoopManager::refresh_capacity(const std::string& loop_device) {
+    TraceSpan span("loop_set_capacity", loop_device);
+    UniqueFd loop_fd(::open(loop_device.c_str(), O_RDWR | O_CLOEXEC));
+    if (!loop_fd.valid()) {
+        throw VaultError("Failed to open " + loop_device + ": " + std::strerror(errno));
+    }
     
-    int ret = execute_command(cmd);
-    if (ret != 0) {
-        throw VaultError("Failed to detach loop device " + loop_device);
+    if (ioctl(loop_fd.get(), LOOP_SET_CAPACITY, 0) != 0) {
+        throw VaultError("Failed to update capacity of " + loop_device + ": " + std::strerror(errno));
     }
 }
 
 std::string LoopManager::find_loop_for_file(const std::string& image_path) {
-    // Получаем абсолютный путь к файлу для сравнения
-    char resolved_path[PATH_MAX];
-    if (realpath(image_path.c_str(), resolved_path) == nullptr) {
+    struct stat st;
+    if (stat(image_path.c_str(), &st) != 0) {
         return ""; // Файл не существует
     }
-    std::string abs_path(resolved_path);
-    
-    // losetup -j <image_path> выводит ассоциированные loop-устройства
-    std::string cmd = "losetup -j " + abs_path + " 2>/dev/null";
     
-    FILE* pipe = popen(cmd.c_str(), "r");
-    if (!pipe) {
+    LoopMap loops = scan();
+    auto it = loops.find(BackingId{static_cast<uint64_t>(st.st_dev), static_cast<uint64_t>(st.st_ino)});
+    if (it == loops.end()) {
         return "";
     }
-    
-    char buffer[1024];
-    std::string result;
-    if (fgets(buffer, sizeof(buffer), pipe) != nullptr) {
-        result = buffer;
+    return it->second.device;
+}
+
+bool LoopManager::is_bound_to(const std::string& loop_device, const std::string& image_path) {
+    struct stat st;
+    if (stat(image_path.c_str(), &st) != 0) {
+        return false;
     }
-    pclose(pipe);
     
-    if (result.empty()) {
-        return "";
+    UniqueFd loop_fd(::open(loop_device.c_str(), O_RDONLY | O_CLOEXEC));
+    if (!loop_fd.valid()) {
+        return false;
     }
-    
-    // Формат вывода: /dev/loop0: [64769]:123456 (/path/to/file)
-    // Извлекаем имя устройства до двоеточия
-    size_t colon_pos = result.find(':');
-    if (colon_pos != std::string::npos) {
-        return result.substr(0, colon_pos);
+    // ENXIO — устройство ни к чему не привязано
+    struct loop_info64 status;
+    if (ioctl(loop_fd.get(), LOOP_GET_STATUS64, &status) != 0) {
+        return false;
     }
-    
-    return "";
+    return status.lo_device == static_cast<uint64_t>(st.st_dev) &&
+           status.lo_inode == static_cast<uint64_t>(st.st_ino);
 }
 
 std::vector<std::pair<std::string, std::string>> LoopManager::list_attached() {
-    std::vector<std::pair<std::string, std::string>> result;
+    LoopMap loops = scan();
+    
+    std::vector<const LoopDeviceInfo*> sorted;
+    sorted.reserve(loops.size());
+    for (const auto& entry : loops) {
+        sorted.push_back(&entry.second);
+    }
     
-    // losetup -l выводит список всех loop-устройств
-    // Формат: NAME SIZELIMIT OFFSET AUTOCLEAR RO BACK-FILE DIO LOG-SEC
-    std::string cmd = "losetup -l -n -O NAME,BACK-FILE 2>/dev/null";
+    // Сортируем по номеру устройства, как это делает losetup -l
+    auto index_of = [](const std::string& device) {
+        return std::strtoul(device.c_str() + std::strlen("/dev/loop"), nullptr, 10);
+    };
+    std::sort(sorted.begin(), sorted.end(), [&](const LoopDeviceInfo* a, const LoopDeviceInfo* b) {
+        return index_of(a->device) < index_of(b->device);
+    });
+    
+    std::vector<std::pair<std::string, std::string>> result;
+    result.reserve(sorted.size());
+    for (const auto* info : sorted) {
+        result.emplace_back(info->device, info->backing_file);
+    }
+    return result;
+}
+
+LoopMap LoopManager::scan() {
+    LoopMap result;
     
-    FILE* pipe = popen(cmd.c_str(), "r");
-    if (!pipe) {
+    DIR* dir = opendir("/sys/block");
+    if (!dir) {
         return result;
     }
     
-    char buffer[512];
-    while (fgets(buffer, sizeof(buffer), pipe) != nullptr) {
-        std::string line(buffer);
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        std::string block_name = entry->d_name;
+        if (block_name.compare(0, 4, "loop") != 0) continue;
         
-        // Убираем trailing newline
-        while (!line.empty() && (line.back() == '\n' || line.back() == '\r')) {
-            line.pop_back();
-        }
+        // Каталог loop/ есть только у привязанных устройств
+        std::ifstream backing("/sys/block/" + block_name + "/loop/backing_file");
+        if (!backing) continue;
         
-        if (line.empty()) continue;
+        LoopDeviceInfo info;
+        info.device = "/dev/" + block_name;
+        std::getline(backing, info.backing_file);
+        if (info.backing_file.empty()) continue;
         
-        // Разбираем строку: "/dev/loop0  /path/to/file"
-        std::istringstream iss(line);
-        std::string device, file;
-        iss >> device;
-        
-        // Остаток строки - путь к файлу (может содержать пробелы)
-        std::getline(iss >> std::ws, file);
+        // LOOP_GET_STATUS64 даёт устройство и inode, под которыми файл был привязан,
+        // даже если его с тех пор переименовали
+        bool have_id = false;
+        UniqueFd loop_fd(::open(info.device.c_str(), O_RDONLY | O_CLOEXEC));
+        if (loop_fd.valid()) {
+            struct stat loop_st;
+            if (fstat(loop_fd.get(), &loop_st) == 0) {
+                info.rdev = loop_st.st_rdev;
+            }
+            struct loop_info64 status;
+            if (ioctl(loop_fd.get(), LOOP_GET_STATUS64, &status) == 0) {
+                info.backing_dev = status.lo_device;
+                info.backing_inode = status.lo_inode;
+                have_id = true;
+            }
+        }
         
-        if (!device.empty() && !file.empty()) {
-            result.emplace_back(device, file);
+        if (!have_id) {
+            struct stat st;
+            if (stat(info.backing_file.c_str(), &st) != 0) continue;
+            info.backing_dev = st.st_dev;
+            info.backing_inode = st.st_ino;
         }
+        
+        BackingId id{info.backing_dev, info.backing_inode};
+        result.emplace(id, std::move(info));
     }
     
-    pclose(pipe);
+    closedir(dir);
     return result;
 }
 
@@ -1,80 +1,362 @@
 #include "luks_manager.hpp"
+#include "cipher_benchmark.hpp"
+#include "trace.hpp"
 #include "utils.hpp"
 
+#include <libcryptsetup.h>
+
 #include <sstream>
-#include <sys/stat.h>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
 
 namespace tpm_vault {
 
-std::string LuksManager::get_mapper_path(const std::string& mapper_name) {
-    return "/dev/mapper/" + mapper_name;
+LuksManager::~LuksManager() {
+    release();
+}
+
+uint32_t LuksManager::get_profile_flags(const std::string& profile) {
+    if (profile.empty() || profile == "default") {
+        return 0;
+    }
+    if (profile == "latency") {
+        // Чтение и запись шифруются синхронно в контексте запроса,
+        // без перехода в очереди kcryptd/dmcrypt_write
+        return CRYPT_ACTIVATE_NO_READ_WORKQUEUE | CRYPT_ACTIVATE_NO_WRITE_WORKQUEUE;
+    }
+    if (profile == "throughput") {
+        // Шифрование на CPU, отправившем запрос, и параллельная отправка записи
+        return CRYPT_ACTIVATE_SAME_CPU_CRYPT | CRYPT_ACTIVATE_SUBMIT_FROM_CRYPT_CPUS;
+    }
+    throw VaultError("Unknown performance profile: " + profile +
+                     " (expected default, latency or throughput)");
+}
+
+uint32_t LuksManager::max_sector_size(const std::string& device) {
+    UniqueFd fd(::open(device.c_str(), O_RDONLY | O_CLOEXEC));
+    if (!fd.valid()) {
+        throw VaultError("Failed to open " + device + ": " + std::strerror(errno));
+    }
+
+    int logical_block = 0;
+    uint64_t size = 0;
+    if (ioctl(fd.get(), BLKSSZGET, &logical_block) != 0 ||
+        ioctl(fd.get(), BLKGETSIZE64, &size) != 0) {
+        throw VaultError("Failed to query block size of " + device + ": " + std::strerror(errno));
+    }
+
+    if (logical_block <= 4096 && size % 4096 == 0) {
+        return 4096;
+    }
+    return 512;
+}
+
+void LuksManager::log_callback(int level, const char* msg, void* usrptr) {
+    if (level != CRYPT_LOG_ERROR || !msg || !usrptr) {
+        return;
+    }
+    auto* self = static_cast<LuksManager*>(usrptr);
+    self->last_error_ = msg;
+    while (!self->last_error_.empty() && self->last_error_.back() == '\n') {
+        self->last_error_.pop_back();
+    }
+}
+
+std::string LuksManager::error_message(const std::string& what, int rc) const {
+    std::ostringstream oss;
+    oss << what << ": " << std::strerror(-rc) << " (" << rc << ")";
+    if (!last_error_.empty()) {
+        oss << " — " << last_error_;
+    }
+    return oss.str();
+}
+
+void LuksManager::release() {
+    if (cd_) {
+        crypt_free(cd_);
+        cd_ = nullptr;
+    }
+    cd_device_.clear();
+    cd_mapper_.clear();
+    volume_key_known_ = false;
 }
 
-std::string LuksManager::get_mapper_name(const std::string& vault_name) {
-    return "tpm-vault-" + vault_name;
+void LuksManager::init_device(const std::string& device) {
+    release();
+    last_error_.clear();
+
+    int rc = crypt_init(&cd_, device.c_str());
+    if (rc < 0) {
+        cd_ = nullptr;
+        throw VaultError(error_message("Failed to initialize crypt device " + device, rc));
+    }
+    crypt_set_log_callback(cd_, &LuksManager::log_callback, this);
+    cd_device_ = device;
 }
 
-void LuksManager::format(const std::string& device, const std::vector<uint8_t>& key) {
-    // cryptsetup luksFormat --type luks2 --key-file - --key-size 512 <device>
-    // --batch-mode отключает интерактивные запросы
-    // --key-size в битах (512 бит = 64 байта)
-    std::ostringstream cmd;
-    cmd << "cryptsetup luksFormat"
-        << " --type luks2"
-        << " --batch-mode"
-        << " --key-file -"
-        << " --key-size " << (key.size() * 8)  // размер в битах
-        << " " << device;
+struct crypt_device* LuksManager::acquire(const std::string& device) {
+    if (cd_ && cd_device_ == device) {
+        return cd_;
+    }
 
-    int ret = execute_command(cmd.str(), &key);
+    init_device(device);
 
-    if (ret != 0) {
-        throw VaultError("Failed to format LUKS container on " + device);
+    int rc;
+    {
+        TraceSpan span("crypt_load", device);
+        rc = crypt_load(cd_, CRYPT_LUKS2, nullptr);
+    }
+    if (rc < 0) {
+        std::string msg = error_message("No LUKS2 header on " + device, rc);
+        release();
+        throw VaultError(msg);
     }
+    return cd_;
+}
+
+void LuksManager::format(const std::string& device, const std::vector<uint8_t>& key,
+                         const LuksOptions& options) {
+    init_device(device);
+
+    // Эквивалент cryptsetup luksFormat --type luks2 --cipher <spec> --key-size <bits>
+    std::string cipher, mode;
+    CipherBenchmark::split_spec(options.cipher, cipher, mode);
+    size_t volume_key_size = std::min(CipherBenchmark::key_size_for(options.cipher), key.size());
+
+    struct crypt_params_luks2 params;
+    std::memset(&params, 0, sizeof(params));
+    params.sector_size = options.sector_size;
+
+    const char* volume_key = nullptr; // nullptr — сгенерирует библиотека
+
+    // PBKDF2 с минимальным числом итераций и без замера производительности.
+    // CRYPT_PBKDF_NO_BENCHMARK снижает до минимума и digest мастер-ключа.
+    struct crypt_pbkdf_type fast_pbkdf;
+    std::memset(&fast_pbkdf, 0, sizeof(fast_pbkdf));
+    if (options.fast_unlock) {
+        fast_pbkdf.type = CRYPT_KDF_PBKDF2;
+        fast_pbkdf.hash = "sha256";
+        fast_pbkdf.iterations = FAST_PBKDF2_ITERATIONS;
+        fast_pbkdf.flags = CRYPT_PBKDF_NO_BENCHMARK;
+        params.pbkdf = &fast_pbkdf;
+        volume_key = reinterpret_cast<const char*>(key.data());
+    }
+
+    int rc;
+    {
+        TraceSpan span("crypt_format", device);
+        rc = crypt_format(cd_, CRYPT_LUKS2, cipher.c_str(), mode.c_str(), nullptr,
+                          volume_key, volume_key_size, &params);
+    }
+    if (rc < 0) {
+        std::string msg = error_message("Failed to format LUKS container on " + device, rc);
+        release();
+        throw VaultError(msg);
+    }
+
+    // Ключ из TPM становится парольной фразой keyslot
+    TraceSpan keyslot_span("crypt_keyslot_add_by_volume_key", device);
+    auto start = std::chrono::steady_clock::now();
+    rc = crypt_keyslot_add_by_volume_key(cd_, CRYPT_ANY_SLOT, nullptr, 0,
+                                         reinterpret_cast<const char*>(key.data()), key.size());
+    last_kdf_time_ = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
+    if (rc < 0) {
+        std::string msg = error_message("Failed to add LUKS keyslot on " + device, rc);
+        release();
+        throw VaultError(msg);
+    }
+
+    // Аналог cryptsetup --perf-* --persistent: флаги хранятся в заголовке
+    uint32_t perf_flags = get_profile_flags(options.perf_profile);
+    if (perf_flags != 0) {
+        rc = crypt_persistent_flags_set(cd_, CRYPT_FLAGS_ACTIVATION, perf_flags);
+        if (rc < 0) {
+            std::string msg = error_message("Failed to store performance flags on " + device, rc);
+            release();
+            throw VaultError(msg);
+        }
+    }
+
+    volume_key_known_ = true;
 }
 
 void LuksManager::open(const std::string& device, const std::string& mapper_name,
-                       const std::vector<uint8_t>& key) {
+                       const std::vector<uint8_t>& key, const LuksOptions& options) {
     // Если устройство уже открыто, сначала закрываем его
     if (is_open(mapper_name)) {
         close(mapper_name);
     }
 
-    // cryptsetup luksOpen --key-file - <device> <mapper-name>
-    std::ostringstream cmd;
-    cmd << "cryptsetup open"
-        << " --type luks2"
-        << " --key-file -"
-        << " " << device
-        << " " << mapper_name;
+    struct crypt_device* cd = acquire(device);
+    last_error_.clear();
+
+    // Профиль производительности хранится в заголовке постоянными флагами
+    uint32_t flags = 0;
+    if (crypt_persistent_flags_get(cd, CRYPT_FLAGS_ACTIVATION, &flags) < 0) {
+        flags = 0;
+    }
+
+    TraceSpan span("crypt_activate", mapper_name);
+    auto start = std::chrono::steady_clock::now();
+    int rc;
+    if (volume_key_known_) {
+        // Дескриптор только что отформатирован и помнит мастер-ключ
+        rc = crypt_activate_by_volume_key(cd, mapper_name.c_str(), nullptr, 0, flags);
+    } else if (options.fast_unlock) {
+        // Ключ из TPM (или его начало, если шифру нужен более короткий ключ)
+        // и есть мастер-ключ тома: keyslot не нужен, проверяется только дешёвый digest
+        int vk_size = crypt_get_volume_key_size(cd);
+        size_t volume_key_size = vk_size > 0 ? std::min(static_cast<size_t>(vk_size), key.size()) : key.size();
+        rc = crypt_activate_by_volume_key(cd, mapper_name.c_str(),
+                                          reinterpret_cast<const char*>(key.data()), volume_key_size, flags);
+    } else {
+        rc = crypt_activate_by_passphrase(cd, mapper_name.c_str(), CRYPT_ANY_SLOT,
+                                          reinterpret_cast<const char*>(key.data()), key.size(), flags);
+    }
+    last_kdf_time_ = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
+
+    if (rc < 0) {
+        throw VaultError(error_message("Failed to open LUKS container on " + device, rc));
+    }
+    cd_mapper_ = mapper_name;
+
+    if (!options.cpu_mask.empty()) {
+        try {
+            apply_cpu_mask(mapper_name, options.cpu_mask);
+        } catch (const VaultError&) {
+            try { close(mapper_name); } catch (...) {}
+            throw;
+        }
+    }
+}
+
+void LuksManager::resize(const std::string& device, const std::string& mapper_name,
+                         const std::vector<uint8_t>& key, const LuksOptions& options) {
+    struct crypt_device* cd = acquire(device);
+    last_error_.clear();
+
+    struct crypt_active_device active;
+    int rc = crypt_get_active_device(cd, mapper_name.c_str(), &active);
+    if (rc < 0) {
+        throw VaultError(error_message("Failed to query active device " + mapper_name, rc));
+    }
+
+    // Таблица с ключом в keyring не содержит самого ключа: его нужно
+    // получить заново (имя nullptr — только проверка, без активации)
+    if (active.flags & CRYPT_ACTIVATE_KEYRING_KEY) {
+        TraceSpan span("crypt_load_volume_key", mapper_name);
+        if (options.fast_unlock) {
+            int vk_size = crypt_get_volume_key_size(cd);
+            size_t volume_key_size = vk_size > 0 ? std::min(static_cast<size_t>(vk_size), key.size()) : key.size();
+            rc = crypt_activate_by_volume_key(cd, nullptr, reinterpret_cast<const char*>(key.data()),
+                                              volume_key_size, CRYPT_ACTIVATE_KEYRING_KEY);
+        } else {
+            rc = crypt_activate_by_passphrase(cd, nullptr, CRYPT_ANY_SLOT,
+                                              reinterpret_cast<const char*>(key.data()), key.size(),
+                                              CRYPT_ACTIVATE_KEYRING_KEY);
+        }
+        if (rc < 0) {
+            throw VaultError(error_message("Failed to unlock volume key of " + device, rc));
+        }
+    }
 
-    int ret = execute_command(cmd.str(), &key);
+    TraceSpan span("crypt_resize", mapper_name);
+    rc = crypt_resize(cd, mapper_name.c_str(), 0);
+    if (rc < 0) {
+        throw VaultError(error_message("Failed to resize " + mapper_name, rc));
+    }
+}
 
-    if (ret != 0) {
-        throw VaultError("Failed to open LUKS container on " + device);
+bool LuksManager::resize_needs_key(const std::string& device, const std::string& mapper_name) {
+    struct crypt_device* cd = acquire(device);
+    last_error_.clear();
+
+    struct crypt_active_device active;
+    int rc = crypt_get_active_device(cd, mapper_name.c_str(), &active);
+    if (rc < 0) {
+        throw VaultError(error_message("Failed to query active device " + mapper_name, rc));
     }
+    return (active.flags & CRYPT_ACTIVATE_KEYRING_KEY) != 0;
+}
+
+void LuksManager::add_passphrase(const std::string& device, const std::vector<uint8_t>& key,
+                                 const std::vector<uint8_t>& new_key) {
+    struct crypt_device* cd = acquire(device);
+    last_error_.clear();
+
+    TraceSpan span("crypt_keyslot_add_by_passphrase", device);
+    int rc = crypt_keyslot_add_by_passphrase(cd, CRYPT_ANY_SLOT,
+                                             reinterpret_cast<const char*>(key.data()), key.size(),
+                                             reinterpret_cast<const char*>(new_key.data()), new_key.size());
+    if (rc < 0) {
+        throw VaultError(error_message("Failed to add LUKS keyslot on " + device, rc));
+    }
+}
+
+void LuksManager::remove_passphrase(const std::string& device, const std::vector<uint8_t>& key) {
+    struct crypt_device* cd = acquire(device);
+    last_error_.clear();
+
+    // Без имени mapper проверяется только ключ; возвращается номер keyslot
+    int slot = crypt_activate_by_passphrase(cd, nullptr, CRYPT_ANY_SLOT,
+                                            reinterpret_cast<const char*>(key.data()), key.size(), 0);
+    if (slot < 0) {
+        throw VaultError(error_message("Key does not match any LUKS keyslot on " + device, slot));
+    }
+
+    TraceSpan span("crypt_keyslot_destroy", device);
+    int rc = crypt_keyslot_destroy(cd, slot);
+    if (rc < 0) {
+        throw VaultError(error_message("Failed to remove LUKS keyslot " + std::to_string(slot) +
+                                       " on " + device, rc));
+    }
+}
+
+int LuksManager::destroy_keyslots(const std::string& device) {
+    struct crypt_device* cd = acquire(device);
+    last_error_.clear();
+
+    TraceSpan span("crypt_keyslot_destroy", device);
+    int destroyed = 0;
+    int max_slots = crypt_keyslot_max(CRYPT_LUKS2);
+    for (int slot = 0; slot < max_slots; ++slot) {
+        crypt_keyslot_info status = crypt_keyslot_status(cd, slot);
+        if (status == CRYPT_SLOT_INVALID || status == CRYPT_SLOT_INACTIVE) continue;
+
+        int rc = crypt_keyslot_destroy(cd, slot);
+        if (rc < 0) {
+            throw VaultError(error_message("Failed to destroy LUKS keyslot " + std::to_string(slot) +
+                                           " on " + device, rc));
+        }
+        ++destroyed;
+    }
+    return destroyed;
 }
 
 void LuksManager::close(const std::string& mapper_name) {
     if (!is_open(mapper_name)) {
         return; // Уже закрыт
     }
-    
-    // cryptsetup luksClose <mapper-name>
-    std::ostringstream cmd;
-    cmd << "cryptsetup close " << mapper_name;
-    
-    int ret = execute_command(cmd.str());
-    if (ret != 0) {
-        throw VaultError("Failed to close LUKS container " + mapper_name);
-    }
-}
 
-bool LuksManager::is_open(const std::string& mapper_name) {
-    std::string mapper_path = get_mapper_path(mapper_name);
-    // Используем stat напрямую, так как /dev/mapper/* это блочные устройства, а не обычные файлы
-    struct stat st;
-    return stat(mapper_path.c_str(), &st) == 0;
+    last_error_.clear();
+
+    // Удерживаемый дескриптор используем, только если он и активировал этот mapper;
+    // с nullptr libcryptsetup сам находит устройство по имени
+    struct crypt_device* cd = (cd_ && cd_mapper_ == mapper_name) ? cd_ : nullptr;
+    TraceSpan span("crypt_deactivate", mapper_name);
+    int rc = crypt_deactivate(cd, mapper_name.c_str());
+    if (rc < 0) {
+        throw VaultError(error_message("Failed to close LUKS container " + mapper_name, rc));
+    }
+    if (cd) {
+        cd_mapper_.clear();
+    }
 }
 
 } // namespace tpm_vault
@@ -1,60 +1,364 @@
 #include "tpm_vault.hpp"
+#include "bench.hpp"
+#include "daemon.hpp"
+#include "tpm_manager.hpp"
+#include "cipher_benchmark.hpp"
+#include "fs_profile.hpp"
+#include "image_transfer.hpp"
+#include "chunk_backup.hpp"
+#include "trace.hpp"
 #include "utils.hpp"
 
 #include <iostream>
 #include <iomanip>
 #include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+#include <sstream>
+#include <memory>
+#include <algorithm>
+#include <chrono>
+#include <unistd.h>
+#include <sys/sysmacros.h>
 
 using namespace tpm_vault;
 
 void print_usage(const char* program_name) {
-    std::cerr << "Usage: " << program_name << " <command> [arguments]\n"
+    std::cerr << "Usage: " << program_name << " [--trace <file>] <command> [arguments]\n"
+              << "\n"
+              << "  --trace <file>        Write a Chrome trace (Perfetto) of the command;\n"
+              << "                        same as TPM_VAULT_TRACE=<file>\n"
               << "\n"
               << "Commands:\n"
-              << "  create <name> [size]  Create a new encrypted vault\n"
+              << "  create <name> [size] [options]\n"
+              << "                        Create a new encrypted vault\n"
               << "                        size: default 100M (supports M, G suffixes)\n"
-              << "  open <name>           Open and mount an existing vault\n"
-              << "  close <name>          Unmount and close a vault\n"
-              << "  list                  List open vaults in current directory\n"
-              << "  wipe <name>           Remove TPM sealed object (vault becomes inaccessible)\n"
+              << "    --direct-io           Bypass the page cache for the image (implies --block-size 4096)\n"
+              << "    --block-size <bytes>  Logical block size of the loop device (512-4096)\n"
+              << "    --read-ahead-kb <n>   Read-ahead of the loop queue\n"
+              << "    --nr-requests <n>     Request queue depth of the loop device\n"
+              << "    --fast-unlock         Use the TPM key as volume key, skip Argon2 on open\n"
+              << "    --perf-profile <p>    dm-crypt profile: default, latency, throughput\n"
+              << "    --cpu-mask <hex>      Pin the kcryptd workqueue to these CPUs\n"
+              << "                          (perf profile default or latency only)\n"
+              << "    --cipher <spec|auto>  dm-crypt cipher (default aes-xts-plain64);\n"
+              << "                          auto benchmarks the kernel ciphers and picks the fastest\n"
+              << "    --sector-size <bytes> Encryption sector size (512-4096; auto picks 4096 if possible)\n"
+              << "    --backend <b>         luks2 (default) or raw: dm-crypt without a header,\n"
+              << "                          cipher parameters kept in <name>.vault\n"
+              << "    --sparse              Thin image: set the size, allocate space on write\n"
+              << "    --key-source <s>      sealed (default): own TPM sealed object;\n"
+              << "                          derived: HKDF-SHA512 from the host root secret\n"
+              << "    --fs <type>           Filesystem: ext4 (default), xfs, btrfs, f2fs\n"
+              << "    --fs-profile <p>      mkfs and mount profile of that filesystem (default: default)\n";
+    for (const auto& profile : FsProfiles::all()) {
+        std::cerr << "                          " << std::left << std::setw(18)
+                  << (profile.fs_type + "/" + profile.name) << std::right << profile.description << "\n";
+    }
+    std::cerr
+              << "    --timing              Report how long key derivation took\n"
+              << "  open <name>... [--timing]\n"
+              << "                        Open and mount vaults; several names are unsealed\n"
+              << "                        back to back and activated in parallel\n"
+              << "  close <name>... | --all\n"
+              << "                        Unmount and close vaults (--all: every open vault here)\n"
+              << "  list [--all] [--json] List open vaults in current directory with usage\n"
+              << "                        (--all: every registered vault on this host)\n"
+              << "  wipe <name> [--yes]   Destroy the vault key (vault becomes inaccessible)\n"
+              << "  migrate-key <name>    Switch a LUKS2 vault from its sealed object to a key\n"
+              << "                        derived from the host root secret\n"
+              << "  grow <name> <size>    Enlarge a vault (image, loop, dm-crypt, filesystem);\n"
+              << "                        an open vault stays mounted\n"
+              << "  export <name> <dest|->\n"
+              << "                        Copy a closed vault's image and metadata, keeping holes\n"
+              << "                        (reflink when possible); - streams to stdout\n"
+              << "  import <src|-> <name>\n"
+              << "                        Create <name>.img from an exported image or a stream on\n"
+              << "                        stdin; the key is not copied (sealed to this host's TPM)\n"
+              << "  backup <name> <dir> [--chunk-size <size>]\n"
+              << "                        Incremental backup of a closed vault: only chunks changed\n"
+              << "                        since the last backup are stored (default chunk 1M)\n"
+              << "  restore <dir> <name>  Rebuild <name>.img from the latest backup in <dir>\n"
+              << "  pool fill --size <size> --count <n> [create options]\n"
+              << "                        Prepare formatted vaults with sealed keys ahead of time;\n"
+              << "                        create with the same size and options renames one\n"
+              << "  pool status           Ready vaults per size/options, hit and miss counters\n"
+              << "  pool drain            Delete ready pooled vaults and their TPM objects\n"
+              << "  bench [options]       Time create/open/close phases on throwaway vaults\n"
+              << "    --iterations <n>      Iterations per image size (default 10)\n"
+              << "    --sizes <list>        Comma-separated image sizes (default 100M)\n"
+              << "    --json                Print results as JSON\n"
+              << "                          create options (--backend, --fast-unlock, ...) apply\n"
+              << "    --fs-profiles <list>  Repeat the run for each fs/profile (e.g. ext4/tuned,xfs)\n"
+              << "                          or all\n"
+              << "    --fio                 Also run fio (sequential 1M, random 4k) on each open vault\n"
+              << "    --lookup              Time sealed-object lookups instead (list scan vs\n"
+              << "                          direct probe vs cached index)\n"
+              << "    --objects <list>      Keystore sizes for --lookup (default 10,100,1000,10000)\n"
+              << "  daemon                Keep the TPM context warm and serve create/open/close/\n"
+              << "                        list/wipe/migrate-key/grow/pool on " << VaultDaemon::SOCKET_PATH << " (TPM_VAULT_SOCKET);\n"
+              << "                        other invocations forward to it while it runs\n"
+              << "\n"
+              << "Vaults are recorded in " << VaultRegistry::DEFAULT_DIR << " (" << VaultRegistry::ENV_VAR << ");\n"
+              << "a name without <name>.img in the current directory is looked up there.\n"
+              << "With " << VaultRegistry::ENV_VAR << " set, commands run in-process, not in the daemon.\n"
               << "\n"
               << "Examples:\n"
               << "  " << program_name << " create secrets\n"
               << "  " << program_name << " create backup 1G\n"
+              << "  " << program_name << " create data 4G --direct-io --read-ahead-kb 1024\n"
+              << "  " << program_name << " create scratch 1G --fast-unlock --timing\n"
+              << "  " << program_name << " create db 8G --perf-profile latency --cpu-mask 0f\n"
+              << "  " << program_name << " create media 16G --cipher auto\n"
+              << "  " << program_name << " create tmp 2G --backend raw\n"
+              << "  " << program_name << " create mail 1G --key-source derived\n"
+              << "  " << program_name << " create archive 8G --fs btrfs --fs-profile compress\n"
               << "  " << program_name << " open secrets\n"
+              << "  " << program_name << " open secrets backup data\n"
               << "  " << program_name << " close secrets\n"
-              << "  " << program_name << " list\n"
-              << "  " << program_name << " wipe secrets\n";
+              << "  " << program_name << " close --all\n"
+              << "  " << program_name << " list --json\n"
+              << "  " << program_name << " list --all\n"
+              << "  " << program_name << " wipe secrets\n"
+              << "  " << program_name << " migrate-key backup\n"
+              << "  " << program_name << " grow backup 4G\n"
+              << "  " << program_name << " export backup /mnt/usb/\n"
+              << "  " << program_name << " export backup - | ssh host tpm-vault import - backup\n"
+              << "  " << program_name << " backup secrets /srv/backups\n"
+              << "  " << program_name << " restore /srv/backups secrets\n"
+              << "  " << program_name << " pool fill --size 1G --count 20\n"
+              << "  " << program_name << " bench --iterations 20 --sizes 64M,1G,16G --json\n"
+              << "  " << program_name << " bench --sizes 1G --fs-profiles all --fio\n";
+}
+
+/**
+ * @brief Возвращает значение опции вида "--opt <value>" и сдвигает индекс
+ * @throws VaultError если значение отсутствует
+ */
+const char* option_value(int argc, char* argv[], int& i) {
+    if (i + 1 >= argc) {
+        throw VaultError(std::string("Missing value for ") + argv[i]);
+    }
+    return argv[++i];
+}
+
+/**
+ * @brief Разбирает неотрицательное целое значение опции
+ * @throws VaultError при некорректном значении
+ */
+uint32_t parse_uint_option(const char* option, const char* value) {
+    try {
+        size_t pos = 0;
+        unsigned long parsed = std::stoul(value, &pos);
+        if (pos != std::strlen(value) || parsed > UINT32_MAX) {
+            throw std::invalid_argument(value);
+        }
+        return static_cast<uint32_t>(parsed);
+    } catch (const std::exception&) {
+        throw VaultError(std::string("Invalid value for ") + option + ": " + value);
+    }
+}
+
+/**
+ * @brief Возвращает TpmVault процесса, создавая его при первом обращении
+ *
+ * В режиме демона экземпляр, а с ним и контекст FAPI, живёт между запросами.
+ *
+ * @throws VaultError без прав root
+ */
+TpmVault& vault_instance() {
+    static std::unique_ptr<TpmVault> vault;
+    if (!vault) {
+        vault = std::make_unique<TpmVault>();
+    }
+    return *vault;
+}
+
+/**
+ * @brief Путь к сокету демона (TPM_VAULT_SOCKET или /run/tpm-vault.sock)
+ */
+std::string daemon_socket_path() {
+    const char* env = std::getenv("TPM_VAULT_SOCKET");
+    return env && *env ? env : VaultDaemon::SOCKET_PATH;
+}
+
+/**
+ * @brief Печатает время вывода ключа LUKS
+ */
+void print_kdf_time(const TpmVault& vault, const VaultOptions& options) {
+    const char* mode = options.backend == TpmVault::BACKEND_RAW ? "raw dm-crypt, no KDF"
+                     : options.luks.fast_unlock ? "fast unlock, PBKDF2 minimal"
+                     : "default keyslot KDF";
+    std::cout << "  Key derivation: " << std::fixed << std::setprecision(2)
+              << (vault.last_kdf_time().count() / 1000.0) << " ms (" << mode << ")\n";
+}
+
+/**
+ * @brief Разбирает опцию параметров хранилища (общие для create и bench)
+ * @return false, если argv[i] не относится к параметрам хранилища
+ * @throws VaultError при некорректном значении
+ */
+bool parse_vault_option(int argc, char* argv[], int& i, VaultOptions& options, bool& block_size_set) {
+    std::string arg = argv[i];
+    if (arg == "--direct-io") {
+        options.loop.direct_io = true;
+    } else if (arg == "--block-size") {
+        options.loop.block_size = parse_uint_option(argv[i], option_value(argc, argv, i));
+        block_size_set = true;
+    } else if (arg == "--read-ahead-kb") {
+        options.loop.read_ahead_kb = parse_uint_option(argv[i], option_value(argc, argv, i));
+    } else if (arg == "--nr-requests") {
+        options.loop.nr_requests = parse_uint_option(argv[i], option_value(argc, argv, i));
+    } else if (arg == "--fast-unlock") {
+        options.luks.fast_unlock = true;
+    } else if (arg == "--perf-profile") {
+        options.luks.perf_profile = option_value(argc, argv, i);
+        LuksManager::get_profile_flags(options.luks.perf_profile);
+    } else if (arg == "--cpu-mask") {
+        options.luks.cpu_mask = option_value(argc, argv, i);
+        if (options.luks.cpu_mask.empty() ||
+            options.luks.cpu_mask.find_first_not_of("0123456789abcdefABCDEF,") != std::string::npos) {
+            throw VaultError("Invalid CPU mask: " + options.luks.cpu_mask);
+        }
+    } else if (arg == "--cipher") {
+        options.luks.cipher = option_value(argc, argv, i);
+        if (options.luks.cipher != TpmVault::CIPHER_AUTO) {
+            std::string cipher, mode;
+            CipherBenchmark::split_spec(options.luks.cipher, cipher, mode);
+        }
+    } else if (arg == "--backend") {
+        options.backend = option_value(argc, argv, i);
+        if (options.backend != TpmVault::BACKEND_LUKS2 && options.backend != TpmVault::BACKEND_RAW) {
+            throw VaultError("Unknown backend " + options.backend + " (expected luks2 or raw)");
+        }
+    } else if (arg == "--sector-size") {
+        options.luks.sector_size = parse_uint_option(argv[i], option_value(argc, argv, i));
+    } else if (arg == "--sparse") {
+        options.sparse = true;
+    } else if (arg == "--fs") {
+        options.fs_type = option_value(argc, argv, i);
+    } else if (arg == "--fs-profile") {
+        options.fs_profile = option_value(argc, argv, i);
+    } else if (arg == "--key-source") {
+        options.key_source = option_value(argc, argv, i);
+        if (options.key_source != TpmVault::KEY_SEALED && options.key_source != TpmVault::KEY_DERIVED) {
+            throw VaultError("Unknown key source " + options.key_source + " (expected sealed or derived)");
+        }
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Дополняет и проверяет параметры хранилища заданного размера
+ * @throws VaultError при несовместимых параметрах
+ */
+void validate_vault_options(VaultOptions& options, bool block_size_set, size_t size) {
+    // Direct I/O требует выравнивания запросов по блоку страницы
+    if (options.loop.direct_io && !block_size_set) {
+        options.loop.block_size = 4096;
+    }
+    
+    uint32_t bs = options.loop.block_size;
+    if (bs != 0 && (bs < 512 || bs > 4096 || (bs & (bs - 1)) != 0)) {
+        throw VaultError("Block size must be 512, 1024, 2048 or 4096");
+    }
+    
+    if (options.backend == TpmVault::BACKEND_RAW && options.luks.fast_unlock) {
+        throw VaultError("--fast-unlock applies to LUKS2 only; raw volumes have no keyslots");
+    }
+    
+    // same_cpu_crypt создаёт привязанную очередь kcryptd без WQ_SYSFS: маску некуда записать
+    if (!options.luks.cpu_mask.empty() && options.luks.perf_profile == "throughput") {
+        throw VaultError("--cpu-mask needs an unbound kcryptd workqueue (perf profile default or latency); "
+                         "the throughput profile (same_cpu_crypt) runs crypto on the submitting CPU");
+    }
+    
+    uint32_t ss = options.luks.sector_size;
+    if (ss != 0 && (ss < 512 || ss > 4096 || (ss & (ss - 1)) != 0)) {
+        throw VaultError("Sector size must be 512, 1024, 2048 or 4096");
+    }
+    if (ss != 0 && size % ss != 0) {
+        throw VaultError("Vault size must be a multiple of the sector size");
+    }
+    
+    FsProfiles::find(options.fs_type, options.fs_profile);
 }
 
 int cmd_create(int argc, char* argv[]) {
-    if (argc < 3) {
+    std::vector<std::string> positional;
+    VaultOptions options;
+    bool block_size_set = false;
+    bool timing = false;
+    
+    try {
+        for (int i = 2; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (parse_vault_option(argc, argv, i, options, block_size_set)) {
+                continue;
+            } else if (arg == "--timing") {
+                timing = true;
+            } else if (arg.compare(0, 2, "--") == 0) {
+                throw VaultError("Unknown option " + arg);
+            } else {
+                positional.push_back(arg);
+            }
+        }
+    } catch (const VaultError& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+    
+    if (positional.empty()) {
         std::cerr << "Error: Missing vault name\n";
-        std::cerr << "Usage: " << argv[0] << " create <name> [size]\n";
+        std::cerr << "Usage: " << argv[0] << " create <name> [size] [options]\n";
         return 1;
     }
     
-    std::string name = argv[2];
+    std::string name = positional[0];
     size_t size = TpmVault::DEFAULT_SIZE;
     
-    if (argc >= 4) {
-        try {
-            size = parse_size(argv[3]);
-        } catch (const VaultError& e) {
-            std::cerr << "Error: " << e.what() << "\n";
-            return 1;
+    try {
+        if (positional.size() >= 2) {
+            size = parse_size(positional[1]);
         }
+        validate_vault_options(options, block_size_set, size);
+    } catch (const VaultError& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
     }
     
     try {
-        TpmVault vault;
+        TpmVault& vault = vault_instance();
         
         std::cout << "Creating vault '" << name << "' (" << format_size(size) << ")...\n";
-        vault.create(name, size);
+        vault.create(name, size, options);
         
         std::cout << "Vault '" << name << "' created successfully.\n";
         std::cout << "  Image: " << name << ".img\n";
-        std::cout << "  Key sealed in TPM with PCR policy (sha256:0,7)\n";
+        if (options.key_source == TpmVault::KEY_DERIVED) {
+            std::cout << "  Key derived from the host root secret (sealed with PCR policy sha256:0,7)\n";
+        } else {
+            std::cout << "  Key sealed in TPM with PCR policy (sha256:0,7)\n";
+        }
+        if (options.fs_type != FsProfiles::DEFAULT_TYPE || options.fs_profile != FsProfiles::DEFAULT_PROFILE) {
+            std::cout << "  Filesystem: " << options.fs_type << " (" << options.fs_profile << " profile)\n";
+        }
+        const auto& phases = vault.last_phases();
+        if (!phases.empty() && phases.front().phase == "pool_claim") {
+            std::cout << "  Taken from the pool in " << std::fixed << std::setprecision(2)
+                      << phases.front().duration.count() / 1000.0 << " ms\n";
+        }
+        if (options.luks.cipher == TpmVault::CIPHER_AUTO) {
+            LuksOptions chosen = vault.load_options(name).luks;
+            std::cout << "  Cipher: " << chosen.cipher << " (benchmarked), sector "
+                      << chosen.sector_size << " bytes\n";
+        }
+        if (timing) {
+            print_kdf_time(vault, options);
+        }
         std::cout << "\nTo use: " << argv[0] << " open " << name << "\n";
         
         return 0;
@@ -65,22 +369,66 @@ int cmd_create(int argc, char* argv[]) {
     }
 }
 
+/**
+ * @brief Печатает итог операции над несколькими хранилищами
+ * @return 0, если все хранилища обработаны успешно
+ */
+int print_results(const std::vector<VaultResult>& results, const char* done, double seconds) {
+    size_t failed = 0;
+    for (const auto& r : results) {
+        if (r.ok()) {
+            std::cout << "  " << r.name << ": " << done << "\n";
+        } else {
+            std::cerr << "  " << r.name << ": Error: " << r.error << "\n";
+            ++failed;
+        }
+    }
+    std::cout << (results.size() - failed) << " of " << results.size() << " vaults " << done
+              << " in " << std::fixed << std::setprecision(2) << seconds << " s\n";
+    return failed == 0 ? 0 : 1;
+}
+
 int cmd_open(int argc, char* argv[]) {
-    if (argc < 3) {
+    std::vector<std::string> names;
+    bool timing = false;
+    
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--timing") {
+            timing = true;
+        } else if (arg.compare(0, 2, "--") == 0) {
+            std::cerr << "Error: Unknown option " << arg << "\n";
+            return 1;
+        } else {
+            names.push_back(arg);
+        }
+    }
+    
+    if (names.empty()) {
         std::cerr << "Error: Missing vault name\n";
-        std::cerr << "Usage: " << argv[0] << " open <name>\n";
+        std::cerr << "Usage: " << argv[0] << " open <name>... [--timing]\n";
         return 1;
     }
     
-    std::string name = argv[2];
-    
     try {
-        TpmVault vault;
+        TpmVault& vault = vault_instance();
+        
+        if (names.size() > 1) {
+            std::cout << "Opening " << names.size() << " vaults...\n";
+            auto start = std::chrono::steady_clock::now();
+            auto results = vault.open_many(names);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            return print_results(results, "opened", elapsed.count());
+        }
         
+        const std::string& name = names.front();
         std::cout << "Opening vault '" << name << "'...\n";
         vault.open(name);
         
-        std::cout << "Vault '" << name << "' opened and mounted at ./" << name << "\n";
+        std::cout << "Vault '" << name << "' opened and mounted at " << vault.get_mount_path(name) << "\n";
+        if (timing) {
+            print_kdf_time(vault, vault.load_options(name));
+        }
         
         return 0;
         
@@ -91,17 +439,51 @@ int cmd_open(int argc, char* argv[]) {
 }
 
 int cmd_close(int argc, char* argv[]) {
-    if (argc < 3) {
+    std::vector<std::string> names;
+    bool all = false;
+    
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--all") {
+            all = true;
+        } else if (arg.compare(0, 2, "--") == 0) {
+            std::cerr << "Error: Unknown option " << arg << "\n";
+            return 1;
+        } else {
+            names.push_back(arg);
+        }
+    }
+    
+    if (names.empty() && !all) {
         std::cerr << "Error: Missing vault name\n";
-        std::cerr << "Usage: " << argv[0] << " close <name>\n";
+        std::cerr << "Usage: " << argv[0] << " close <name>... | --all\n";
         return 1;
     }
     
-    std::string name = argv[2];
-    
     try {
-        TpmVault vault;
+        TpmVault& vault = vault_instance();
+        
+        if (all) {
+            for (const auto& v : vault.list()) {
+                if (std::find(names.begin(), names.end(), v.name) == names.end()) {
+                    names.push_back(v.name);
+                }
+            }
+            if (names.empty()) {
+                std::cout << "No open vaults in current directory.\n";
+                return 0;
+            }
+        }
         
+        if (names.size() > 1 || all) {
+            std::cout << "Closing " << names.size() << " vaults...\n";
+            auto start = std::chrono::steady_clock::now();
+            auto results = vault.close_many(names);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            return print_results(results, "closed", elapsed.count());
+        }
+        
+        const std::string& name = names.front();
         std::cout << "Closing vault '" << name << "'...\n";
         vault.close(name);
         
@@ -115,16 +497,68 @@ int cmd_close(int argc, char* argv[]) {
     }
 }
 
+/// Приблизительный размер для таблиц: "1.5G", "640M"
+std::string approx_size(uint64_t bytes) {
+    static const char* units[] = {"", "K", "M", "G", "T", "P"};
+    double value = static_cast<double>(bytes);
+    size_t unit = 0;
+    while (value >= 1024.0 && unit + 1 < sizeof(units) / sizeof(units[0])) {
+        value /= 1024.0;
+        ++unit;
+    }
+    std::ostringstream oss;
+    oss << std::fixed << std::setprecision(unit && value < 10.0 ? 1 : 0) << value << units[unit];
+    return oss.str();
+}
+
+std::string device_number(uint64_t rdev) {
+    return std::to_string(major(rdev)) + ":" + std::to_string(minor(rdev));
+}
+
+void print_list_json(std::ostream& out, const std::vector<VaultInfo>& vaults) {
+    out << "{\"vaults\":[";
+    for (size_t i = 0; i < vaults.size(); ++i) {
+        const auto& v = vaults[i];
+        out << (i ? "," : "") << "{\"name\":\"" << json_escape(v.name) << "\""
+            << ",\"image\":\"" << json_escape(v.image_path) << "\""
+            << ",\"loop_device\":\"" << v.loop_device << "\""
+            << ",\"loop_dev\":\"" << device_number(v.loop_rdev) << "\""
+            << ",\"mapper_device\":\"" << json_escape(v.mapper_device) << "\""
+            << ",\"mapper_dev\":\"" << device_number(v.mapper_rdev) << "\""
+            << ",\"mount_point\":\"" << json_escape(v.mount_point) << "\""
+            << ",\"total_bytes\":" << v.total_bytes
+            << ",\"used_bytes\":" << v.used_bytes
+            << ",\"available_bytes\":" << v.available_bytes << "}";
+    }
+    out << "]}\n";
+}
+
 int cmd_list(int argc, char* argv[]) {
-    (void)argc;
-    (void)argv;
+    bool json = false;
+    bool everywhere = false;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--json") {
+            json = true;
+        } else if (arg == "--all") {
+            everywhere = true;
+        } else {
+            std::cerr << "Error: Unknown option " << arg << "\n";
+            return 1;
+        }
+    }
     
     try {
-        TpmVault vault;
-        auto vaults = vault.list();
+        TpmVault& vault = vault_instance();
+        auto vaults = vault.list(everywhere);
+        
+        if (json) {
+            print_list_json(std::cout, vaults);
+            return 0;
+        }
         
         if (vaults.empty()) {
-            std::cout << "No open vaults in current directory.\n";
+            std::cout << (everywhere ? "No open vaults.\n" : "No open vaults in current directory.\n");
             return 0;
         }
         
@@ -133,9 +567,15 @@ int cmd_list(int argc, char* argv[]) {
         for (const auto& v : vaults) {
             std::cout << "  " << v.name << "\n";
             std::cout << "    Image:       " << v.image_path << "\n";
-            std::cout << "    Loop device: " << v.loop_device << "\n";
-            std::cout << "    Mapper:      " << v.mapper_device << "\n";
+            std::cout << "    Loop device: " << v.loop_device << " (" << device_number(v.loop_rdev) << ")\n";
+            std::cout << "    Mapper:      " << v.mapper_device << " (" << device_number(v.mapper_rdev) << ")\n";
             std::cout << "    Mount point: " << v.mount_point << "\n";
+            if (v.total_bytes > 0) {
+                std::cout << "    Used:        " << approx_size(v.used_bytes) << " of "
+                          << approx_size(v.total_bytes) << " ("
+                          << (v.used_bytes * 100 / v.total_bytes) << "%), "
+                          << approx_size(v.available_bytes) << " available\n";
+            }
             std::cout << "\n";
         }
         
@@ -148,37 +588,265 @@ int cmd_list(int argc, char* argv[]) {
 }
 
 int cmd_wipe(int argc, char* argv[]) {
-    if (argc < 3) {
+    std::string name;
+    bool confirmed = false;
+    
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--yes") {
+            confirmed = true;
+        } else if (arg.compare(0, 2, "--") == 0) {
+            std::cerr << "Error: Unknown option " << arg << "\n";
+            return 1;
+        } else if (name.empty()) {
+            name = arg;
+        }
+    }
+    
+    if (name.empty()) {
         std::cerr << "Error: Missing vault name\n";
-        std::cerr << "Usage: " << argv[0] << " wipe <name>\n";
+        std::cerr << "Usage: " << argv[0] << " wipe <name> [--yes]\n";
         return 1;
     }
     
+    if (!confirmed) {
+        // Предупреждение
+        std::cout << "WARNING: This will destroy the key of '" << name << "'.\n";
+        std::cout << "         The vault image will remain but become inaccessible.\n";
+        std::cout << "         This operation cannot be undone!\n";
+        std::cout << "\nType 'yes' to confirm: ";
+        
+        std::string confirmation;
+        std::getline(std::cin, confirmation);
+        
+        if (confirmation != "yes") {
+            std::cout << "Operation cancelled.\n";
+            return 0;
+        }
+    }
+    
+    try {
+        TpmVault& vault = vault_instance();
+        
+        bool derived = vault.load_options(name).key_source == TpmVault::KEY_DERIVED;
+        const char* what = derived ? "LUKS keyslots and key salt" : "TPM sealed object";
+        
+        std::cout << "Wiping key of '" << name << "'...\n";
+        vault.wipe(name);
+        
+        std::cout << what << " for '" << name << "' destroyed.\n";
+        std::cout << "The vault is now permanently inaccessible.\n";
+        
+        return 0;
+        
+    } catch (const VaultError& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+}
+
+int cmd_migrate_key(int argc, char* argv[]) {
+    if (argc != 3 || argv[2][0] == '-') {
+        std::cerr << "Error: Missing vault name\n";
+        std::cerr << "Usage: " << argv[0] << " migrate-key <name>\n";
+        return 1;
+    }
+    std::string name = argv[2];
+    
+    try {
+        TpmVault& vault = vault_instance();
+        
+        std::cout << "Migrating vault '" << name << "' to a derived key...\n";
+        vault.migrate_key(name);
+        
+        std::cout << "Vault '" << name << "' now uses a key derived from the host root secret.\n";
+        std::cout << "  Its own TPM sealed object has been deleted.\n";
+        
+        return 0;
+        
+    } catch (const VaultError& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+}
+
+int cmd_grow(int argc, char* argv[]) {
+    if (argc != 4 || argv[2][0] == '-') {
+        std::cerr << "Error: Missing vault name or size\n";
+        std::cerr << "Usage: " << argv[0] << " grow <name> <size>\n";
+        return 1;
+    }
+    std::string name = argv[2];
+    
+    try {
+        size_t size = parse_size(argv[3]);
+        TpmVault& vault = vault_instance();
+        
+        std::cout << "Growing vault '" << name << "' to " << format_size(size) << "...\n";
+        vault.grow(name, size);
+        
+        std::cout << "Vault '" << name << "' grown to " << format_size(size) << ".\n";
+        std::cout << std::fixed << std::setprecision(2);
+        for (const auto& phase : vault.last_phases()) {
+            std::cout << "  " << std::left << std::setw(15) << phase.phase << std::right
+                      << std::setw(10) << phase.duration.count() / 1000.0 << " ms\n";
+        }
+        
+        return 0;
+        
+    } catch (const VaultError& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+}
+
+/**
+ * @brief Одна строка итога export/import: способ и объём данных против размера образа
+ */
+void print_transfer(std::ostream& out, const TransferStats& stats) {
+    out << "  " << stats.method << ": ";
+    if (stats.method == "reflink") {
+        out << "extents shared";
+    } else {
+        out << format_size(stats.data_bytes) << " of data in " << stats.extents << " extent(s)";
+    }
+    out << ", image " << format_size(stats.size) << "\n";
+}
+
+int cmd_export(int argc, char* argv[]) {
+    if (argc != 4 || argv[2][0] == '-') {
+        std::cerr << "Error: Missing vault name or destination\n";
+        std::cerr << "Usage: " << argv[0] << " export <name> <dest|->\n";
+        return 1;
+    }
     std::string name = argv[2];
+    std::string destination = argv[3];
+    bool to_stdout = destination == ImageTransfer::STDIO;
     
-    // Предупреждение
-    std::cout << "WARNING: This will delete the TPM sealed object for '" << name << "'.\n";
-    std::cout << "         The vault image will remain but become inaccessible.\n";
-    std::cout << "         This operation cannot be undone!\n";
-    std::cout << "\nType 'yes' to confirm: ";
+    if (to_stdout && isatty(STDOUT_FILENO)) {
+        std::cerr << "Error: Refusing to write an image stream to a terminal\n";
+        return 1;
+    }
+    // В режиме потока stdout занят образом
+    std::ostream& out = to_stdout ? std::cerr : std::cout;
     
-    std::string confirmation;
-    std::getline(std::cin, confirmation);
+    try {
+        TpmVault& vault = vault_instance();
+        TransferStats stats = vault.export_vault(name, destination);
+        
+        out << "Vault '" << name << "' exported" << (to_stdout ? "" : " to " + destination) << ".\n";
+        print_transfer(out, stats);
+        return 0;
+        
+    } catch (const VaultError& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+}
+
+int cmd_import(int argc, char* argv[]) {
+    if (argc != 4 || argv[3][0] == '-') {
+        std::cerr << "Error: Missing source or vault name\n";
+        std::cerr << "Usage: " << argv[0] << " import <src|-> <name>\n";
+        return 1;
+    }
+    std::string source = argv[2];
+    std::string name = argv[3];
     
-    if (confirmation != "yes") {
-        std::cout << "Operation cancelled.\n";
+    if (source == ImageTransfer::STDIO && isatty(STDIN_FILENO)) {
+        std::cerr << "Error: Expected an image stream on stdin\n";
+        return 1;
+    }
+    
+    try {
+        TpmVault& vault = vault_instance();
+        TransferStats stats = vault.import_vault(source, name);
+        
+        std::cout << "Vault '" << name << "' imported.\n";
+        print_transfer(std::cout, stats);
+        std::cout << "\nTo use: " << argv[0] << " open " << name << "\n";
         return 0;
+        
+    } catch (const VaultError& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+}
+
+/**
+ * @brief Итог backup/restore: блоки по исходу и объём записанного
+ */
+void print_backup(const BackupStats& stats, bool backup) {
+    std::cout << "  chunks:       " << stats.chunks << " x " << format_size(stats.chunk_size)
+              << " (image " << format_size(stats.size) << ")\n";
+    std::cout << "  written:      " << stats.written << " (" << format_size(stats.bytes_written) << ")\n";
+    if (backup) {
+        std::cout << "  unchanged:    " << stats.unchanged << "\n";
+        std::cout << "  deduplicated: " << stats.deduplicated << "\n";
+    }
+    std::cout << "  zero:         " << stats.zero << "\n";
+    if (backup && stats.pruned > 0) {
+        std::cout << "  pruned:       " << stats.pruned << "\n";
     }
+}
+
+int cmd_backup(int argc, char* argv[]) {
+    std::vector<std::string> positional;
+    size_t chunk_size = ChunkBackup::DEFAULT_CHUNK_SIZE;
     
     try {
-        TpmVault vault;
+        for (int i = 2; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--chunk-size") {
+                chunk_size = parse_size(option_value(argc, argv, i));
+            } else if (arg[0] == '-') {
+                throw VaultError("Unknown option " + arg);
+            } else {
+                positional.push_back(arg);
+            }
+        }
+    } catch (const VaultError& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+    if (positional.size() != 2) {
+        std::cerr << "Error: Missing vault name or backup directory\n";
+        std::cerr << "Usage: " << argv[0] << " backup <name> <dir> [--chunk-size <size>]\n";
+        return 1;
+    }
+    const std::string& name = positional[0];
+    const std::string& dir = positional[1];
+    
+    try {
+        TpmVault& vault = vault_instance();
+        BackupStats stats = vault.backup(name, dir, chunk_size);
         
-        std::cout << "Wiping TPM sealed object for '" << name << "'...\n";
-        vault.wipe(name);
+        std::cout << "Vault '" << name << "' backed up to " << dir << ".\n";
+        print_backup(stats, true);
+        return 0;
         
-        std::cout << "TPM sealed object for '" << name << "' has been deleted.\n";
-        std::cout << "The vault is now permanently inaccessible.\n";
+    } catch (const VaultError& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+}
+
+int cmd_restore(int argc, char* argv[]) {
+    if (argc != 4 || argv[3][0] == '-') {
+        std::cerr << "Error: Missing backup directory or vault name\n";
+        std::cerr << "Usage: " << argv[0] << " restore <dir> <name>\n";
+        return 1;
+    }
+    std::string dir = argv[2];
+    std::string name = argv[3];
+    
+    try {
+        TpmVault& vault = vault_instance();
+        BackupStats stats = vault.restore(dir, name);
         
+        std::cout << "Vault '" << name << "' restored from " << dir << ".\n";
+        print_backup(stats, false);
+        std::cout << "\nTo use: " << argv[0] << " open " << name << "\n";
         return 0;
         
     } catch (const VaultError& e) {
@@ -187,7 +855,284 @@ int cmd_wipe(int argc, char* argv[]) {
     }
 }
 
-int main(int argc, char* argv[]) {
+int cmd_pool(int argc, char* argv[]) {
+    std::string action = argc >= 3 ? argv[2] : "";
+    
+    if (action == "status" && argc == 3) {
+        try {
+            PoolStatus status = vault_instance().pool_status();
+            
+            // Хранилища с одинаковыми параметрами — одной строкой
+            std::vector<std::pair<const PoolEntry*, size_t>> groups;
+            for (const auto& entry : status.entries) {
+                auto it = std::find_if(groups.begin(), groups.end(),
+                                       [&](const auto& group) { return group.first->spec == entry.spec; });
+                if (it == groups.end()) {
+                    groups.emplace_back(&entry, 1);
+                } else {
+                    ++it->second;
+                }
+            }
+            
+            if (groups.empty()) {
+                std::cout << "Pool is empty.\n";
+            } else {
+                std::cout << std::left << std::setw(7) << "READY" << std::setw(8) << "SIZE"
+                          << std::setw(18) << "FILESYSTEM" << std::setw(9) << "BACKEND" << "KEY\n";
+                for (const auto& [entry, ready] : groups) {
+                    std::cout << std::setw(7) << ready << std::setw(8) << format_size(entry->size)
+                              << std::setw(18) << (entry->options.fs_type + "/" + entry->options.fs_profile)
+                              << std::setw(9) << entry->options.backend << entry->options.key_source << "\n";
+                }
+                std::cout << std::right;
+            }
+            
+            uint64_t claims = status.hits + status.misses;
+            std::cout << "Hits: " << status.hits << ", misses: " << status.misses;
+            if (claims > 0) {
+                std::cout << " (" << (status.hits * 100 / claims) << "% hit rate)";
+            }
+            std::cout << "\n";
+            return 0;
+            
+        } catch (const VaultError& e) {
+            std::cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+    }
+    
+    if (action == "drain" && argc == 3) {
+        try {
+            size_t removed = vault_instance().pool_drain();
+            std::cout << "Removed " << removed << " pooled vault(s).\n";
+            return 0;
+        } catch (const VaultError& e) {
+            std::cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+    }
+    
+    if (action != "fill") {
+        std::cerr << "Error: Expected fill, status or drain\n";
+        std::cerr << "Usage: " << argv[0] << " pool fill --size <size> --count <n> [create options]\n";
+        std::cerr << "       " << argv[0] << " pool status | drain\n";
+        return 1;
+    }
+    
+    VaultOptions options;
+    bool block_size_set = false;
+    size_t size = TpmVault::DEFAULT_SIZE;
+    size_t count = 0;
+    
+    try {
+        for (int i = 3; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (parse_vault_option(argc, argv, i, options, block_size_set)) {
+                continue;
+            } else if (arg == "--size") {
+                size = parse_size(option_value(argc, argv, i));
+            } else if (arg == "--count") {
+                count = parse_uint_option(argv[i], option_value(argc, argv, i));
+            } else {
+                throw VaultError("Unknown option " + arg);
+            }
+        }
+        if (count == 0) {
+            throw VaultError("--count must be positive");
+        }
+        validate_vault_options(options, block_size_set, size);
+    } catch (const VaultError& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+    
+    try {
+        TpmVault& vault = vault_instance();
+        
+        auto start = std::chrono::steady_clock::now();
+        size_t created = vault.pool_fill(size, options, count);
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+        
+        std::cout << "Prepared " << created << " vault(s) of " << format_size(size) << " in "
+                  << std::fixed << std::setprecision(1) << elapsed.count() << " s; "
+                  << count << " ready.\n";
+        return 0;
+        
+    } catch (const VaultError& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+}
+
+int cmd_bench(int argc, char* argv[]) {
+    BenchOptions bench;
+    LookupBenchOptions lookup_bench;
+    bool block_size_set = false;
+    bool json = false;
+    bool lookup = false;
+    
+    try {
+        for (int i = 2; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (parse_vault_option(argc, argv, i, bench.vault, block_size_set)) {
+                continue;
+            } else if (arg == "--iterations") {
+                bench.iterations = parse_uint_option(argv[i], option_value(argc, argv, i));
+                if (bench.iterations == 0) {
+                    throw VaultError("--iterations must be positive");
+                }
+                lookup_bench.iterations = bench.iterations;
+            } else if (arg == "--sizes") {
+                bench.sizes.clear();
+                std::istringstream list(option_value(argc, argv, i));
+                for (std::string item; std::getline(list, item, ','); ) {
+                    bench.sizes.push_back(parse_size(item));
+                }
+                if (bench.sizes.empty()) {
+                    throw VaultError("--sizes needs at least one size");
+                }
+            } else if (arg == "--fs-profiles") {
+                bench.filesystems.clear();
+                std::istringstream list(option_value(argc, argv, i));
+                for (std::string item; std::getline(list, item, ','); ) {
+                    if (item == "all") {
+                        for (const auto& profile : FsProfiles::all()) {
+                            bench.filesystems.push_back(profile.fs_type + "/" + profile.name);
+                        }
+                        continue;
+                    }
+                    if (item.find('/') == std::string::npos) {
+                        item += std::string("/") + FsProfiles::DEFAULT_PROFILE;
+                    }
+                    size_t slash = item.find('/');
+                    FsProfiles::find(item.substr(0, slash), item.substr(slash + 1));
+                    bench.filesystems.push_back(item);
+                }
+                if (bench.filesystems.empty()) {
+                    throw VaultError("--fs-profiles needs at least one profile");
+                }
+            } else if (arg == "--fio") {
+                bench.fio = true;
+            } else if (arg == "--lookup") {
+                lookup = true;
+            } else if (arg == "--objects") {
+                lookup_bench.counts.clear();
+                std::istringstream list(option_value(argc, argv, i));
+                for (std::string item; std::getline(list, item, ','); ) {
+                    size_t count = parse_uint_option("--objects", item.c_str());
+                    if (count == 0) {
+                        throw VaultError("--objects counts must be positive");
+                    }
+                    lookup_bench.counts.push_back(count);
+                }
+                if (lookup_bench.counts.empty()) {
+                    throw VaultError("--objects needs at least one count");
+                }
+            } else if (arg == "--json") {
+                json = true;
+            } else {
+                throw VaultError("Unknown option " + arg);
+            }
+        }
+        
+        for (size_t size : bench.sizes) {
+            validate_vault_options(bench.vault, block_size_set, size);
+        }
+    } catch (const VaultError& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+    
+    try {
+        TpmVault& vault = vault_instance();
+        
+        if (lookup) {
+            // Отдельный контекст FAPI: индекс и объекты замера не касаются хранилищ
+            TpmManager tpm;
+            tpm.provision();
+            LookupBenchmark runner(tpm);
+            auto reports = runner.run(lookup_bench);
+            if (json) {
+                LookupBenchmark::print_json(std::cout, reports);
+            } else {
+                LookupBenchmark::print_table(std::cout, reports);
+            }
+            return 0;
+        }
+        
+        VaultBenchmark runner(vault);
+        
+        auto reports = runner.run(bench);
+        if (json) {
+            VaultBenchmark::print_json(std::cout, reports);
+        } else {
+            VaultBenchmark::print_table(std::cout, reports);
+        }
+        return 0;
+        
+    } catch (const VaultError& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+}
+
+int run_command(int argc, char* argv[]);
+
+/**
+ * @brief Можно ли выполнить команду через демон
+ *
+ * Интерактивный wipe (без --yes) читает подтверждение с терминала
+ * и выполняется в своём процессе.
+ */
+bool daemon_serves(const std::vector<std::string>& args) {
+    if (args.empty()) {
+        return false;
+    }
+    const std::string& command = args[0];
+    if (command == "wipe") {
+        for (const auto& arg : args) {
+            if (arg == "--yes") return true;
+        }
+        return false;
+    }
+    return command == "create" || command == "open" || command == "close" || command == "list" ||
+           command == "migrate-key" || command == "grow" || command == "pool";
+}
+
+int cmd_daemon(int argc, char* argv[]) {
+    (void)argc;
+    std::string socket_path = daemon_socket_path();
+    
+    try {
+        // Контекст FAPI и provisioning готовятся один раз, до первого запроса
+        vault_instance().prepare_tpm();
+        
+        VaultDaemon daemon(socket_path, [program = std::string(argv[0])](const std::vector<std::string>& args) {
+            if (!daemon_serves(args)) {
+                std::cerr << "Error: Command is not served by the daemon\n";
+                return 1;
+            }
+            std::vector<std::string> storage;
+            storage.push_back(program);
+            storage.insert(storage.end(), args.begin(), args.end());
+            std::vector<char*> request_argv;
+            for (auto& arg : storage) {
+                request_argv.push_back(&arg[0]);
+            }
+            request_argv.push_back(nullptr);
+            return run_command(static_cast<int>(storage.size()), request_argv.data());
+        });
+        
+        daemon.run();
+        return 0;
+        
+    } catch (const VaultError& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+}
+
+int run_command(int argc, char* argv[]) {
     if (argc < 2) {
         print_usage(argv[0]);
         return 1;
@@ -205,6 +1150,24 @@ int main(int argc, char* argv[]) {
         return cmd_list(argc, argv);
     } else if (command == "wipe") {
         return cmd_wipe(argc, argv);
+    } else if (command == "migrate-key") {
+        return cmd_migrate_key(argc, argv);
+    } else if (command == "grow") {
+        return cmd_grow(argc, argv);
+    } else if (command == "export") {
+        return cmd_export(argc, argv);
+    } else if (command == "import") {
+        return cmd_import(argc, argv);
+    } else if (command == "backup") {
+        return cmd_backup(argc, argv);
+    } else if (command == "restore") {
+        return cmd_restore(argc, argv);
+    } else if (command == "pool") {
+        return cmd_pool(argc, argv);
+    } else if (command == "bench") {
+        return cmd_bench(argc, argv);
+    } else if (command == "daemon") {
+        return cmd_daemon(argc, argv);
     } else if (command == "-h" || command == "--help" || command == "help") {
         print_usage(argv[0]);
         return 0;
@@ -214,3 +1177,55 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 }
+
+int main(int argc, char* argv[]) {
+    // Трассировка: TPM_VAULT_TRACE=<file> или --trace <file> перед командой
+    std::string trace_path;
+    if (const char* env = std::getenv(Tracer::ENV_VAR)) {
+        trace_path = env;
+    }
+    if (argc >= 2 && std::strcmp(argv[1], "--trace") == 0) {
+        if (argc < 3) {
+            std::cerr << "Error: Missing value for --trace\n";
+            return 1;
+        }
+        trace_path = argv[2];
+        argv[2] = argv[0];
+        argv += 2;
+        argc -= 2;
+    }
+    
+    // Демон ищет хранилища в своём реестре: с другим каталогом реестра
+    // команда выполняется в своём процессе
+    const char* registry = std::getenv(VaultRegistry::ENV_VAR);
+    bool own_registry = registry && *registry;
+    
+    if (!trace_path.empty()) {
+        Tracer::start(trace_path);
+    } else if (!own_registry) {
+        // Если запущен демон, команду выполняет он с уже готовым контекстом FAPI;
+        // трассировка пишется только для команд в своём процессе
+        std::vector<std::string> args(argv + 1, argv + argc);
+        if (daemon_serves(args)) {
+            try {
+                int exit_code = 1;
+                if (DaemonClient::forward(daemon_socket_path(), args, exit_code)) {
+                    return exit_code;
+                }
+            } catch (const VaultError& e) {
+                std::cerr << "Error: " << e.what() << "\n";
+                return 1;
+            }
+        }
+    }
+    
+    int ret = run_command(argc, argv);
+    
+    try {
+        Tracer::finish();
+    } catch (const VaultError& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return ret != 0 ? ret : 1;
+    }
+    return ret;
+}
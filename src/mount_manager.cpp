@@ -0,0 +1,276 @@
+#include "mount_manager.hpp"
+#include "trace.hpp"
+#include "utils.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+namespace tpm_vault {
+
+namespace {
+
+/**
+ * @brief Параметры точки монтирования, а не файловой системы
+ *
+ * Как и mount(8), отделяем их от параметров ФС: в mount(2) это флаги MS_*,
+ * в fsmount — атрибуты MOUNT_ATTR_*, а fsconfig их не принимает.
+ */
+struct MountFlag {
+    const char* name;
+    unsigned long flag;
+};
+
+constexpr MountFlag MOUNT_FLAGS[] = {
+    {"ro", MS_RDONLY},
+    {"nosuid", MS_NOSUID},
+    {"nodev", MS_NODEV},
+    {"noexec", MS_NOEXEC},
+    {"noatime", MS_NOATIME},
+    {"nodiratime", MS_NODIRATIME},
+    {"relatime", MS_RELATIME},
+    {"strictatime", MS_STRICTATIME},
+};
+
+unsigned long mount_flag(const std::string& option) {
+    for (const auto& entry : MOUNT_FLAGS) {
+        if (option == entry.name) {
+            return entry.flag;
+        }
+    }
+    return 0;
+}
+
+std::string mount_error(const std::string& device, const std::string& target, int err,
+                        const std::string& detail) {
+    std::string msg = "Failed to mount " + device + " to " + target + ": " + std::strerror(err);
+    if (!detail.empty()) {
+        msg += " — " + detail;
+    }
+    return msg;
+}
+
+#ifdef FSOPEN_CLOEXEC
+/**
+ * @brief Забирает сообщения журнала контекста ФС ("e ext4: ...") для текста ошибки
+ */
+std::string fs_context_log(int fs_fd) {
+    std::string log;
+    char buf[512];
+    ssize_t n;
+    while ((n = ::read(fs_fd, buf, sizeof(buf) - 1)) > 0) {
+        while (n > 0 && buf[n - 1] == '\n') {
+            --n;
+        }
+        buf[n] = '\0';
+        const char* text = (n > 2 && buf[1] == ' ') ? buf + 2 : buf;
+        if (!log.empty()) {
+            log += "; ";
+        }
+        log += text;
+    }
+    return log;
+}
+
+unsigned int mount_attributes(unsigned long flags) {
+    unsigned int attr = 0;
+    if (flags & MS_RDONLY) attr |= MOUNT_ATTR_RDONLY;
+    if (flags & MS_NOSUID) attr |= MOUNT_ATTR_NOSUID;
+    if (flags & MS_NODEV) attr |= MOUNT_ATTR_NODEV;
+    if (flags & MS_NOEXEC) attr |= MOUNT_ATTR_NOEXEC;
+    if (flags & MS_NODIRATIME) attr |= MOUNT_ATTR_NODIRATIME;
+    if (flags & MS_NOATIME) {
+        attr |= MOUNT_ATTR_NOATIME;
+    } else if (flags & MS_STRICTATIME) {
+        attr |= MOUNT_ATTR_STRICTATIME;
+    }
+    return attr;
+}
+#endif
+
+/**
+ * @brief Раскрывает экранирование \ooo (пробел, табуляция, '\') в полях mountinfo
+ */
+std::string unescape_mountinfo(const std::string& field) {
+    std::string out;
+    out.reserve(field.size());
+    for (size_t i = 0; i < field.size(); ++i) {
+        if (field[i] == '\\' && i + 3 < field.size() &&
+            field[i + 1] >= '0' && field[i + 1] <= '7' &&
+            field[i + 2] >= '0' && field[i + 2] <= '7' &&
+            field[i + 3] >= '0' && field[i + 3] <= '7') {
+            out += static_cast<char>((field[i + 1] - '0') * 64 + (field[i + 2] - '0') * 8 + (field[i + 3] - '0'));
+            i += 3;
+        } else {
+            out += field[i];
+        }
+    }
+    return out;
+}
+
+} // namespace
+
+void MountManager::mount(const std::string& device, const std::string& target, const std::string& fs_type,
+                         const std::vector<std::string>& options) {
+    TraceSpan span("mount", target);
+
+    unsigned long flags = 0;
+    std::vector<std::string> fs_options;
+    for (const auto& option : options) {
+        unsigned long flag = mount_flag(option);
+        if (flag != 0) {
+            flags |= flag;
+        } else {
+            fs_options.push_back(option);
+        }
+    }
+
+    if (mount_fs_context(device, target, fs_type, fs_options, flags)) {
+        return;
+    }
+
+    // mount(2): параметры ФС одной строкой через запятую
+    std::string data;
+    for (const auto& option : fs_options) {
+        if (!data.empty()) {
+            data += ',';
+        }
+        data += option;
+    }
+    if (::mount(device.c_str(), target.c_str(), fs_type.c_str(), flags,
+                data.empty() ? nullptr : data.c_str()) != 0) {
+        throw VaultError(mount_error(device, target, errno, ""));
+    }
+}
+
+bool MountManager::mount_fs_context(const std::string& device, const std::string& target,
+                                    const std::string& fs_type, const std::vector<std::string>& options,
+                                    unsigned long flags) {
+#ifdef FSOPEN_CLOEXEC
+    UniqueFd fs(fsopen(fs_type.c_str(), FSOPEN_CLOEXEC));
+    if (!fs.valid()) {
+        if (errno == ENOSYS) {
+            return false;
+        }
+        throw VaultError(mount_error(device, target, errno, "filesystem type " + fs_type));
+    }
+
+    auto fail = [&](int err) {
+        throw VaultError(mount_error(device, target, err, fs_context_log(fs.get())));
+    };
+    auto set = [&](const std::string& key, const char* value) {
+        int rc = value ? fsconfig(fs.get(), FSCONFIG_SET_STRING, key.c_str(), value, 0)
+                       : fsconfig(fs.get(), FSCONFIG_SET_FLAG, key.c_str(), nullptr, 0);
+        if (rc != 0) {
+            fail(errno);
+        }
+    };
+
+    // Источник и все параметры задаются до создания суперблока
+    set("source", device.c_str());
+    if (flags & MS_RDONLY) {
+        set("ro", nullptr);
+    }
+    for (const auto& option : options) {
+        size_t eq = option.find('=');
+        if (eq == std::string::npos) {
+            set(option, nullptr);
+        } else {
+            set(option.substr(0, eq), option.c_str() + eq + 1);
+        }
+    }
+    if (fsconfig(fs.get(), FSCONFIG_CMD_CREATE, nullptr, nullptr, 0) != 0) {
+        fail(errno);
+    }
+
+    UniqueFd mnt(fsmount(fs.get(), FSMOUNT_CLOEXEC, mount_attributes(flags)));
+    if (!mnt.valid()) {
+        fail(errno);
+    }
+    if (move_mount(mnt.get(), "", AT_FDCWD, target.c_str(), MOVE_MOUNT_F_EMPTY_PATH) != 0) {
+        fail(errno);
+    }
+    return true;
+#else
+    (void)device;
+    (void)target;
+    (void)fs_type;
+    (void)options;
+    (void)flags;
+    return false;
+#endif
+}
+
+void MountManager::unmount(const std::string& target) {
+    TraceSpan span("umount", target);
+
+    if (::umount2(target.c_str(), UMOUNT_NOFOLLOW) == 0) {
+        return;
+    }
+    // EINVAL — каталог не точка монтирования, ENOENT — его нет
+    if (errno == EINVAL || errno == ENOENT) {
+        return;
+    }
+    throw VaultError("Failed to unmount " + target + ": " + std::strerror(errno));
+}
+
+bool MountManager::is_mounted(const std::string& target) {
+#ifdef STATX_ATTR_MOUNT_ROOT
+    struct statx stx;
+    if (statx(AT_FDCWD, target.c_str(), AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, STATX_BASIC_STATS, &stx) != 0) {
+        return false;
+    }
+    if (stx.stx_attributes_mask & STATX_ATTR_MOUNT_ROOT) {
+        return (stx.stx_attributes & STATX_ATTR_MOUNT_ROOT) != 0;
+    }
+#endif
+    return find_in_mountinfo(target);
+}
+
+bool MountManager::find_in_mountinfo(const std::string& target) {
+    std::ifstream mountinfo("/proc/self/mountinfo");
+    if (!mountinfo) {
+        return false;
+    }
+
+    // Формат: id parent major:minor root mount_point options ...
+    std::string line;
+    while (std::getline(mountinfo, line)) {
+        std::istringstream fields(line);
+        std::string id, parent, dev, root, mount_point;
+        if (fields >> id >> parent >> dev >> root >> mount_point &&
+            unescape_mountinfo(mount_point) == target) {
+            return true;
+        }
+    }
+    return false;
+}
+
+std::unordered_map<std::string, uint64_t> MountManager::mount_table() {
+    std::unordered_map<std::string, uint64_t> result;
+    std::ifstream mountinfo("/proc/self/mountinfo");
+    if (!mountinfo) {
+        return result;
+    }
+
+    std::string line;
+    while (std::getline(mountinfo, line)) {
+        std::istringstream fields(line);
+        std::string id, parent, dev, root, mount_point;
+        if (!(fields >> id >> parent >> dev >> root >> mount_point)) continue;
+
+        unsigned int dev_major = 0, dev_minor = 0;
+        if (std::sscanf(dev.c_str(), "%u:%u", &dev_major, &dev_minor) != 2) continue;
+        result[unescape_mountinfo(mount_point)] = makedev(dev_major, dev_minor);
+    }
+    return result;
+}
+
+} // namespace tpm_vault
@@ -1,14 +1,33 @@
 #include "tpm_manager.hpp"
+#include "trace.hpp"
 #include "utils.hpp"
 
 #include <tss2/tss2_fapi.h>
 #include <tss2/tss2_rc.h>
 
+#include <algorithm>
 #include <cstring>
+#include <fstream>
 #include <sstream>
+#include <unistd.h>
 
 namespace tpm_vault {
 
+namespace {
+
+/**
+ * @brief Выполняет вызов FAPI внутри спана трассировки
+ * @param name Имя функции FAPI
+ * @param detail Путь объекта FAPI
+ */
+template <typename Call>
+TSS2_RC traced(const char* name, const std::string& detail, Call&& call) {
+    TraceSpan span(name, detail);
+    return call();
+}
+
+} // namespace
+
 // Политика PCR для sha256:0,7
 // Использует currentPCRandBanks для захвата текущих значений PCR при создании
 const char* TpmManager::PCR_POLICY_JSON = 
@@ -29,8 +48,12 @@ const char* TpmManager::PCR_POLICY_JSON =
 
 const char* TpmManager::POLICY_PATH = "/policy/tpm_vault_pcr";
 
+const char* TpmManager::ROOT_PATH = "/HS/SRK/tpm_vault_root";
+
+const char* TpmManager::PROVISIONED_MARKER = "/var/lib/tpm-vault/provisioned";
+
 TpmManager::TpmManager() : ctx_(nullptr), policy_imported_(false) {
-    TSS2_RC rc = Fapi_Initialize(&ctx_, nullptr);
+    TSS2_RC rc = traced("Fapi_Initialize", "", [&] { return Fapi_Initialize(&ctx_, nullptr); });
     if (rc != TSS2_RC_SUCCESS) {
         std::ostringstream oss;
         oss << "Failed to initialize FAPI context: " << Tss2_RC_Decode(rc)
@@ -41,24 +64,39 @@ TpmManager::TpmManager() : ctx_(nullptr), policy_imported_(false) {
 
 TpmManager::~TpmManager() {
     if (ctx_) {
+        TraceSpan span("Fapi_Finalize");
         Fapi_Finalize(&ctx_);
     }
 }
 
 void TpmManager::provision() {
-    TSS2_RC rc = Fapi_Provision(ctx_, nullptr, nullptr, nullptr);
-    
-    if (rc == TSS2_FAPI_RC_ALREADY_PROVISIONED) {
-        // TPM уже provisioned - это нормально
+    // Повторный Fapi_Provision лишь вернул бы ALREADY_PROVISIONED
+    if (file_exists(PROVISIONED_MARKER)) {
+        provision_skipped_ = true;
         return;
     }
+    run_provision();
+}
+
+void TpmManager::run_provision() {
+    provision_skipped_ = false;
+    TSS2_RC rc = traced("Fapi_Provision", "", [&] { return Fapi_Provision(ctx_, nullptr, nullptr, nullptr); });
     
-    if (rc != TSS2_RC_SUCCESS) {
+    // TPM уже provisioned - это нормально
+    if (rc != TSS2_RC_SUCCESS && rc != TSS2_FAPI_RC_ALREADY_PROVISIONED) {
         std::ostringstream oss;
         oss << "Failed to provision TPM: " << Tss2_RC_Decode(rc)
             << " (0x" << std::hex << rc << ")";
         throw VaultError(oss.str());
     }
+    
+    // Отметка — лишь ускорение: без неё provisioning проверяется при каждом запуске
+    std::string marker = PROVISIONED_MARKER;
+    try {
+        ensure_directory(marker.substr(0, marker.rfind('/')));
+        std::ofstream(marker) << "1\n";
+    } catch (const VaultError&) {
+    }
 }
 
 void TpmManager::ensure_pcr_policy() {
@@ -67,7 +105,7 @@ void TpmManager::ensure_pcr_policy() {
     }
     
     // Пробуем импортировать политику
-    TSS2_RC rc = Fapi_Import(ctx_, POLICY_PATH, PCR_POLICY_JSON);
+    TSS2_RC rc = traced("Fapi_Import", POLICY_PATH, [&] { return Fapi_Import(ctx_, POLICY_PATH, PCR_POLICY_JSON); });
     
     if (rc == TSS2_FAPI_RC_PATH_ALREADY_EXISTS) {
         // Политика уже существует - отлично
@@ -94,6 +132,64 @@ std::string TpmManager::get_policy_path() const {
 }
 
 void TpmManager::seal(const std::string& name, const std::vector<uint8_t>& data) {
+    std::string path = get_seal_path(name);
+    seal_object(path, data);
+    if (index_loaded_) {
+        index_.insert(path);
+    }
+}
+
+std::vector<uint8_t> TpmManager::unseal(const std::string& name) {
+    return unseal_object(get_seal_path(name), name);
+}
+
+void TpmManager::remove(const std::string& name) {
+    std::string path = get_seal_path(name);
+    remove_object(path, name);
+    if (index_loaded_) {
+        index_.erase(path);
+    }
+}
+
+bool TpmManager::exists(const std::string& name) {
+    std::string path = get_seal_path(name);
+    if (!index_enabled_) {
+        return object_exists(path);
+    }
+    
+    if (!index_loaded_) {
+        auto paths = list_objects();
+        index_.clear();
+        index_.insert(paths.begin(), paths.end());
+        index_loaded_ = true;
+    }
+    return index_.count(path) != 0;
+}
+
+bool TpmManager::exists_by_list(const std::string& name) {
+    auto paths = list_objects();
+    return std::find(paths.begin(), paths.end(), get_seal_path(name)) != paths.end();
+}
+
+void TpmManager::set_index_enabled(bool enabled) {
+    index_enabled_ = enabled;
+    index_loaded_ = false;
+    index_.clear();
+}
+
+void TpmManager::seal_root(const std::vector<uint8_t>& data) {
+    seal_object(ROOT_PATH, data);
+}
+
+std::vector<uint8_t> TpmManager::unseal_root() {
+    return unseal_object(ROOT_PATH, "the host root secret");
+}
+
+bool TpmManager::has_root() {
+    return object_exists(ROOT_PATH);
+}
+
+void TpmManager::seal_object(const std::string& path, const std::vector<uint8_t>& data) {
     if (data.size() > 128) {
         throw VaultError("Data too large to seal (max 128 bytes, got " + 
                         std::to_string(data.size()) + ")");
@@ -102,22 +198,34 @@ void TpmManager::seal(const std::string& name, const std::vector<uint8_t>& data)
     // Убеждаемся, что политика PCR импортирована
     ensure_pcr_policy();
     
-    std::string path = get_seal_path(name);
-    
     // Удаляем существующий объект если есть
-    Fapi_Delete(ctx_, path.c_str());
+    traced("Fapi_Delete", path, [&] { return Fapi_Delete(ctx_, path.c_str()); });
     
     // Создаём sealed object с политикой PCR
     // type = "noDa" отключает защиту от dictionary attack (для тестирования)
-    TSS2_RC rc = Fapi_CreateSeal(
-        ctx_,
-        path.c_str(),           // path
-        "noDa",                 // type
-        data.size(),            // size - размер данных в байтах
-        POLICY_PATH,            // policyPath - политика PCR
-        nullptr,                // authValue (пароль не используем)
-        data.data()             // data
-    );
+    auto create_seal = [&] {
+        return traced("Fapi_CreateSeal", path, [&] {
+            return Fapi_CreateSeal(
+                ctx_,
+                path.c_str(),           // path
+                "noDa",                 // type
+                data.size(),            // size - размер данных в байтах
+                POLICY_PATH,            // policyPath - политика PCR
+                nullptr,                // authValue (пароль не используем)
+                data.data()             // data
+            );
+        });
+    };
+    TSS2_RC rc = create_seal();
+    
+    // Отметка provisioning устарела (TPM или хранилище ключей очищены):
+    // родительского SRK нет — выполняем provisioning и пробуем ещё раз
+    if (provision_skipped_ &&
+        (rc == TSS2_FAPI_RC_KEY_NOT_FOUND || rc == TSS2_FAPI_RC_PATH_NOT_FOUND)) {
+        ::unlink(PROVISIONED_MARKER);
+        run_provision();
+        rc = create_seal();
+    }
     
     if (rc != TSS2_RC_SUCCESS) {
         std::ostringstream oss;
@@ -127,13 +235,11 @@ void TpmManager::seal(const std::string& name, const std::vector<uint8_t>& data)
     }
 }
 
-std::vector<uint8_t> TpmManager::unseal(const std::string& name) {
-    std::string path = get_seal_path(name);
-    
+std::vector<uint8_t> TpmManager::unseal_object(const std::string& path, const std::string& owner) {
     uint8_t* data = nullptr;
     size_t size = 0;
     
-    TSS2_RC rc = Fapi_Unseal(ctx_, path.c_str(), &data, &size);
+    TSS2_RC rc = traced("Fapi_Unseal", path, [&] { return Fapi_Unseal(ctx_, path.c_str(), &data, &size); });
     
     if (rc != TSS2_RC_SUCCESS) {
         // Проверяем специфические ошибки
@@ -143,7 +249,7 @@ std::vector<uint8_t> TpmManager::unseal(const std::string& name) {
         }
         if (rc == TSS2_FAPI_RC_KEY_NOT_FOUND || 
             rc == TSS2_FAPI_RC_PATH_NOT_FOUND) {
-            throw VaultError("No TPM sealed object found for " + name);
+            throw VaultError("No TPM sealed object found for " + owner);
         }
         
         std::ostringstream oss;
@@ -162,14 +268,12 @@ std::vector<uint8_t> TpmManager::unseal(const std::string& name) {
     return result;
 }
 
-void TpmManager::remove(const std::string& name) {
-    std::string path = get_seal_path(name);
-    
-    TSS2_RC rc = Fapi_Delete(ctx_, path.c_str());
+void TpmManager::remove_object(const std::string& path, const std::string& owner) {
+    TSS2_RC rc = traced("Fapi_Delete", path, [&] { return Fapi_Delete(ctx_, path.c_str()); });
     
     if (rc == TSS2_FAPI_RC_KEY_NOT_FOUND || 
         rc == TSS2_FAPI_RC_PATH_NOT_FOUND) {
-        throw VaultError("No TPM sealed object found for " + name);
+        throw VaultError("No TPM sealed object found for " + owner);
     }
     
     if (rc != TSS2_RC_SUCCESS) {
@@ -180,35 +284,50 @@ void TpmManager::remove(const std::string& name) {
     }
 }
 
-bool TpmManager::exists(const std::string& name) {
+bool TpmManager::object_exists(const std::string& path) {
+    char* description = nullptr;
+    TSS2_RC rc = traced("Fapi_GetDescription", path,
+                        [&] { return Fapi_GetDescription(ctx_, path.c_str(), &description); });
+    
+    if (rc == TSS2_RC_SUCCESS) {
+        Fapi_Free(description);
+        return true;
+    }
+    if (rc == TSS2_FAPI_RC_KEY_NOT_FOUND ||
+        rc == TSS2_FAPI_RC_PATH_NOT_FOUND) {
+        return false;
+    }
+    
+    std::ostringstream oss;
+    oss << "Failed to look up " << path << " in FAPI keystore: " << Tss2_RC_Decode(rc)
+        << " (0x" << std::hex << rc << ")";
+    throw VaultError(oss.str());
+}
+
+std::vector<std::string> TpmManager::list_objects() {
     char* pathList = nullptr;
-    TSS2_RC rc = Fapi_List(ctx_, "/HS/SRK", &pathList);
+    TSS2_RC rc = traced("Fapi_List", "/HS/SRK", [&] { return Fapi_List(ctx_, "/HS/SRK", &pathList); });
 
+    std::vector<std::string> result;
     if (rc != TSS2_RC_SUCCESS || !pathList) {
-        return false;
+        return result;
     }
 
     std::string paths(pathList);
     Fapi_Free(pathList);
 
-    // Точное сравнение с разделителями
-    std::string search_path = get_seal_path(name);
-
-    // Ищем как отдельный элемент (разделитель — перенос строки или начало/конец)
-    size_t pos = paths.find(search_path);
-    while (pos != std::string::npos) {
-        // Проверяем, что это полное совпадение пути
-        bool start_ok = (pos == 0 || paths[pos - 1] == '\n' || paths[pos - 1] == ':');
-        size_t end_pos = pos + search_path.size();
-        bool end_ok = (end_pos == paths.size() || paths[end_pos] == '\n' || paths[end_pos] == ':');
-
-        if (start_ok && end_ok) {
-            return true;
+    // Пути разделены ':', а FAPI может предварять их профилем ("/P_RSA2048SHA256/HS/SRK/...")
+    std::istringstream list(paths);
+    for (std::string path; std::getline(list, path, ':'); ) {
+        if (path.compare(0, 3, "/P_") == 0) {
+            size_t next = path.find('/', 1);
+            path = next == std::string::npos ? std::string() : path.substr(next);
+        }
+        if (!path.empty()) {
+            result.push_back(path);
         }
-        pos = paths.find(search_path, pos + 1);
     }
-
-    return false;
+    return result;
 }
 
 } // namespace tpm_vault
@@ -1,123 +1,449 @@
 #include "tpm_vault.hpp"
 #include "tpm_manager.hpp"
 #include "luks_manager.hpp"
+#include "dm_crypt_manager.hpp"
 #include "loop_manager.hpp"
+#include "fs_profile.hpp"
+#include "image_transfer.hpp"
+#include "chunk_backup.hpp"
+#include "mount_manager.hpp"
+#include "vault_metadata.hpp"
+#include "cipher_benchmark.hpp"
+#include "command_runner.hpp"
+#include "key_hierarchy.hpp"
+#include "trace.hpp"
+#include "worker_pool.hpp"
 #include "utils.hpp"
 
+#include <algorithm>
 #include <fstream>
 #include <sstream>
+#include <iomanip>
 #include <cstring>
-#include <climits>
 #include <exception>
-#include <sys/mount.h>
-#include <mntent.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstdio>
+#include <memory>
+#include <map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/statvfs.h>
+#include <dirent.h>
 
 namespace tpm_vault {
 
+namespace {
+
+/// Таймаут mkfs и роста ФС: на больших образах ext4 размечает группы блоков заметное время
+constexpr std::chrono::minutes MKFS_TIMEOUT{10};
+
+/// Блок записи нулей, когда ФС не поддерживает fallocate
+constexpr size_t ZERO_FILL_CHUNK = 8 * 1024 * 1024;
+constexpr size_t ZERO_FILL_ALIGN = 4096;
+
+/**
+ * @brief Секундомер шагов операции
+ *
+ * mark() записывает время, прошедшее с предыдущей отметки, под именем шага,
+ * и при включённой трассировке добавляет шаг как спан.
+ */
+class PhaseClock {
+public:
+    explicit PhaseClock(std::vector<PhaseTiming>& phases)
+        : phases_(phases), last_(std::chrono::steady_clock::now()) {
+        phases_.clear();
+    }
+    
+    void mark(const char* phase) {
+        auto now = std::chrono::steady_clock::now();
+        phases_.push_back({phase, std::chrono::duration_cast<std::chrono::microseconds>(now - last_)});
+        if (Tracer::enabled()) {
+            Tracer::record(phase, "", last_, now);
+        }
+        last_ = now;
+    }
+
+private:
+    std::vector<PhaseTiming>& phases_;
+    std::chrono::steady_clock::time_point last_;
+};
+
+} // namespace
+
 TpmVault::TpmVault() 
-    : tpm_(std::make_unique<TpmManager>())
-    , luks_(std::make_unique<LuksManager>())
-    , loop_(std::make_unique<LoopManager>()) {
+    : luks_(std::make_unique<LuksManager>())
+    , dm_crypt_(std::make_unique<DmCryptManager>())
+    , loop_(std::make_unique<LoopManager>())
+    , mount_(std::make_unique<MountManager>()) {
     
     // Проверяем права root
     if (!is_root()) {
         throw VaultError("This operation requires root privileges");
     }
-    
-    // Выполняем provisioning TPM
-    tpm_->provision();
 }
 
 TpmVault::~TpmVault() = default;
 
+TpmManager& TpmVault::tpm() {
+    // close и list обходятся без TPM: контекст FAPI создаётся при первом обращении
+    if (!tpm_) {
+        auto tpm = std::make_unique<TpmManager>();
+        tpm->provision();
+        tpm_ = std::move(tpm);
+    }
+    return *tpm_;
+}
+
+void TpmVault::prepare_tpm() {
+    tpm();
+}
+
 std::string TpmVault::get_image_path(const std::string& name) const {
+    RegistryEntry entry;
+    if (find_registered(name, entry)) {
+        return entry.image_path;
+    }
     return get_current_directory() + "/" + name + ".img";
 }
 
 std::string TpmVault::get_mount_path(const std::string& name) const {
+    RegistryEntry entry;
+    if (find_registered(name, entry)) {
+        return entry.mount_point;
+    }
     return get_current_directory() + "/" + name;
 }
 
-void TpmVault::create_image_file(const std::string& path, size_t size) {
-    // Используем fallocate для быстрого создания файла
-    std::ostringstream cmd;
-    cmd << "fallocate -l " << size << " " << path;
+bool TpmVault::find_registered(const std::string& name, RegistryEntry& entry) const {
+    // Образ в текущей директории важнее записи реестра
+    if (file_exists(get_current_directory() + "/" + name + ".img")) {
+        return false;
+    }
+    return registry_.find(name, entry) && file_exists(entry.image_path);
+}
+
+void TpmVault::register_vault(const std::string& name, const std::string& loop_device) {
+    RegistryEntry entry;
+    entry.name = name;
+    entry.image_path = get_image_path(name);
+    entry.mount_point = get_mount_path(name);
+    entry.mapper_name = LuksManager::get_mapper_name(name);
+    entry.options = VaultMetadata::load(get_metadata_path(name));
     
-    int ret = execute_command(cmd.str());
-    if (ret != 0) {
-        // Fallback на dd если fallocate не сработал
-        cmd.str("");
-        cmd << "dd if=/dev/zero of=" << path 
-            << " bs=1M count=" << (size / (1024 * 1024))
-            << " 2>/dev/null";
-        ret = execute_command(cmd.str());
-        if (ret != 0) {
-            throw VaultError("Failed to create image file: " + path);
+    // Без образа записывать нечего (close после неудачного create)
+    struct stat st;
+    if (stat(entry.image_path.c_str(), &st) != 0) {
+        return;
+    }
+    entry.backing_dev = st.st_dev;
+    entry.backing_inode = st.st_ino;
+    if (!loop_device.empty()) {
+        entry.loop_device = loop_device;
+        if (stat(loop_device.c_str(), &st) == 0) {
+            entry.loop_rdev = st.st_rdev;
+        }
+        if (stat(LuksManager::get_mapper_path(entry.mapper_name).c_str(), &st) == 0) {
+            entry.mapper_rdev = st.st_rdev;
         }
     }
+    registry_.record(entry);
+}
+
+std::string TpmVault::find_loop(const std::string& name, const std::string& image_path) {
+    RegistryEntry entry;
+    if (registry_.find(name, entry) && entry.is_open() && entry.image_path == image_path &&
+        loop_->is_bound_to(entry.loop_device, image_path)) {
+        return entry.loop_device;
+    }
+    return loop_->find_loop_for_file(image_path);
+}
+
+std::string TpmVault::get_metadata_path(const std::string& name) const {
+    return VaultMetadata::path_for_image(get_image_path(name));
+}
+
+VaultOptions TpmVault::load_options(const std::string& name) const {
+    VaultMetadata metadata = VaultMetadata::load(get_metadata_path(name));
+    
+    VaultOptions options;
+    options.loop.direct_io = metadata.get_bool("loop.direct_io");
+    options.loop.block_size = static_cast<uint32_t>(metadata.get_uint("loop.block_size"));
+    options.loop.read_ahead_kb = static_cast<uint32_t>(metadata.get_uint("loop.read_ahead_kb"));
+    options.loop.nr_requests = static_cast<uint32_t>(metadata.get_uint("loop.nr_requests"));
+    options.luks.fast_unlock = metadata.get_bool("luks.fast_unlock");
+    options.luks.perf_profile = metadata.get("luks.perf_profile", "default");
+    options.luks.cpu_mask = metadata.get("luks.cpu_mask");
+    options.luks.cipher = metadata.get("luks.cipher", options.luks.cipher);
+    options.luks.sector_size = static_cast<uint32_t>(metadata.get_uint("luks.sector_size"));
+    options.backend = metadata.get("crypt.backend", BACKEND_LUKS2);
+    options.key_source = metadata.get("key.source", KEY_SEALED);
+    options.key_salt = metadata.get("key.salt");
+    options.seal_name = metadata.get("key.seal_name");
+    options.sparse = metadata.get_bool("image.sparse");
+    options.fs_type = metadata.get("fs.type", FsProfiles::DEFAULT_TYPE);
+    options.fs_profile = metadata.get("fs.profile", FsProfiles::DEFAULT_PROFILE);
+    return options;
 }
 
-void TpmVault::create_filesystem(const std::string& device) {
-    // mkfs.ext4 -q (quiet mode)
-    std::string cmd = "mkfs.ext4 -q " + device;
+void TpmVault::save_options(const std::string& name, const VaultOptions& options) const {
+    std::string path = get_metadata_path(name);
+    VaultMetadata metadata = VaultMetadata::load(path);
     
-    int ret = execute_command(cmd);
-    if (ret != 0) {
-        throw VaultError("Failed to create ext4 filesystem on " + device);
+    metadata.set_bool("loop.direct_io", options.loop.direct_io);
+    metadata.set_uint("loop.block_size", options.loop.block_size);
+    metadata.set_uint("loop.read_ahead_kb", options.loop.read_ahead_kb);
+    metadata.set_uint("loop.nr_requests", options.loop.nr_requests);
+    metadata.set_bool("luks.fast_unlock", options.luks.fast_unlock);
+    metadata.set("luks.perf_profile", options.luks.perf_profile);
+    metadata.set("luks.cpu_mask", options.luks.cpu_mask);
+    metadata.set("luks.cipher", options.luks.cipher);
+    metadata.set_uint("luks.sector_size", options.luks.sector_size);
+    metadata.set("crypt.backend", options.backend);
+    metadata.set("key.source", options.key_source);
+    metadata.set_bool("image.sparse", options.sparse);
+    metadata.set("fs.type", options.fs_type);
+    metadata.set("fs.profile", options.fs_profile);
+    if (options.key_salt.empty()) {
+        metadata.erase("key.salt");
+    } else {
+        metadata.set("key.salt", options.key_salt);
+    }
+    if (options.seal_name.empty()) {
+        metadata.erase("key.seal_name");
+    } else {
+        metadata.set("key.seal_name", options.seal_name);
     }
+    metadata.save(path);
 }
 
-void TpmVault::mount_filesystem(const std::string& device, const std::string& mount_point) {
-    ensure_directory(mount_point);
+CryptBackend& TpmVault::backend_for(const VaultOptions& options) {
+    if (options.backend == BACKEND_LUKS2) {
+        return *luks_;
+    }
+    if (options.backend == BACKEND_RAW) {
+        return *dm_crypt_;
+    }
+    throw VaultError("Unknown crypt backend: " + options.backend + " (expected luks2 or raw)");
+}
+
+std::unique_ptr<CryptBackend> TpmVault::make_backend(const VaultOptions& options) {
+    if (options.backend == BACKEND_LUKS2) {
+        return std::make_unique<LuksManager>();
+    }
+    if (options.backend == BACKEND_RAW) {
+        return std::make_unique<DmCryptManager>();
+    }
+    throw VaultError("Unknown crypt backend: " + options.backend + " (expected luks2 or raw)");
+}
+
+std::vector<CipherBenchResult> TpmVault::select_cipher(const std::string& device, LuksOptions& luks) {
+    // Сектор 4096 байт, если устройство это допускает: меньше операций шифрования на байт
+    if (luks.sector_size == 0) {
+        luks.sector_size = LuksManager::max_sector_size(device);
+    }
+    
+    auto results = CipherBenchmark::run(luks.sector_size, std::chrono::milliseconds(100));
+    luks.cipher = CipherBenchmark::pick(results).spec;
+    return results;
+}
+
+void TpmVault::record_cipher_benchmark(const std::string& name,
+                                       const std::vector<CipherBenchResult>& results) const {
+    std::string path = get_metadata_path(name);
+    VaultMetadata metadata = VaultMetadata::load(path);
     
-    std::string cmd = "mount " + device + " " + mount_point;
-    int ret = execute_command(cmd);
-    if (ret != 0) {
-        throw VaultError("Failed to mount " + device + " to " + mount_point);
+    for (const auto& result : results) {
+        std::ostringstream value;
+        if (result.available) {
+            value << std::fixed << std::setprecision(1)
+                  << "encrypt:" << result.encrypt_mib_s << ",decrypt:" << result.decrypt_mib_s;
+        } else {
+            value << "unavailable";
+        }
+        metadata.set("luks.bench." + result.spec, value.str());
     }
+    metadata.save(path);
 }
 
-void TpmVault::unmount_filesystem(const std::string& mount_point) {
-    if (!is_mounted(mount_point)) {
-        return;
+void TpmVault::create_image_file(const std::string& path, size_t size, bool sparse) {
+    UniqueFd fd(::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600));
+    if (!fd.valid()) {
+        throw VaultError("Failed to create image file " + path + ": " + std::strerror(errno));
     }
     
-    std::string cmd = "umount " + mount_point;
-    int ret = execute_command(cmd);
-    if (ret != 0) {
-        throw VaultError("Failed to unmount " + mount_point);
+    try {
+        allocate_image(fd.get(), path, 0, size, sparse);
+    } catch (const VaultError&) {
+        fd.reset();
+        ::unlink(path.c_str());
+        throw;
     }
 }
 
-bool TpmVault::is_mounted(const std::string& mount_point) {
-    // Получаем абсолютный путь
-    char resolved[PATH_MAX];
-    if (realpath(mount_point.c_str(), resolved) == nullptr) {
-        return false;
+void TpmVault::extend_image_file(const std::string& path, size_t old_size, size_t new_size, bool sparse) {
+    UniqueFd fd(::open(path.c_str(), O_WRONLY | O_CLOEXEC));
+    if (!fd.valid()) {
+        throw VaultError("Failed to open image file " + path + ": " + std::strerror(errno));
     }
-    std::string abs_path(resolved);
     
-    // Читаем /proc/mounts
-    FILE* mtab = setmntent("/proc/mounts", "r");
-    if (!mtab) {
-        return false;
+    try {
+        allocate_image(fd.get(), path, old_size, new_size - old_size, sparse);
+    } catch (const VaultError&) {
+        // Loop-устройство ещё не видело новый размер, хвост отрезаем;
+        // если не вышло, повторный grow доиспользует увеличенный образ
+        int rc = ::ftruncate(fd.get(), static_cast<off_t>(old_size));
+        (void)rc;
+        throw;
+    }
+}
+
+void TpmVault::allocate_image(int fd, const std::string& path, size_t offset, size_t length, bool sparse) {
+    auto fail = [&](const std::string& what, int err) {
+        throw VaultError(what + " " + path + ": " + std::strerror(err));
+    };
+    
+    if (sparse) {
+        TraceSpan span("ftruncate", path);
+        if (::ftruncate(fd, static_cast<off_t>(offset + length)) != 0) {
+            fail("Failed to size image file", errno);
+        }
+        return;
+    }
+    if (length == 0) {
+        return;
+    }
+    
+    // Выделение экстентов без записи данных: миллисекунды при любом размере.
+    // posix_fallocate не подходит — без поддержки в ФС glibc пишет по байту в каждый блок
+    {
+        TraceSpan span("fallocate", path);
+        if (::fallocate(fd, 0, static_cast<off_t>(offset), static_cast<off_t>(length)) == 0) {
+            return;
+        }
+    }
+    if (errno != EOPNOTSUPP && errno != ENOSYS) {
+        fail("Failed to allocate image file", errno);
+    }
+    
+    // Последний вариант — запись нулей крупными выровненными блоками, включая неполный хвост
+    TraceSpan span("zero_fill", path);
+    void* raw = nullptr;
+    if (posix_memalign(&raw, ZERO_FILL_ALIGN, ZERO_FILL_CHUNK) != 0) {
+        fail("Failed to allocate zero buffer for", ENOMEM);
+    }
+    std::unique_ptr<void, decltype(&std::free)> zeros(raw, &std::free);
+    std::memset(zeros.get(), 0, ZERO_FILL_CHUNK);
+    
+    size_t done = 0;
+    while (done < length) {
+        size_t chunk = std::min(ZERO_FILL_CHUNK, length - done);
+        ssize_t n = ::pwrite(fd, zeros.get(), chunk, static_cast<off_t>(offset + done));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fail("Failed to write image file", errno);
+        }
+        done += static_cast<size_t>(n);
+    }
+}
+
+void TpmVault::write_image_file(const std::string& path, const std::function<void(int fd)>& fill) {
+    UniqueFd fd(::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600));
+    if (!fd.valid()) {
+        throw VaultError("Failed to create image file " + path + ": " + std::strerror(errno));
     }
     
-    struct mntent* entry;
-    bool found = false;
-    while ((entry = getmntent(mtab)) != nullptr) {
-        if (abs_path == entry->mnt_dir) {
-            found = true;
-            break;
+    try {
+        fill(fd.get());
+        if (fsync(fd.get()) != 0) {
+            throw VaultError("Failed to sync image file " + path + ": " + std::strerror(errno));
         }
+    } catch (const VaultError&) {
+        fd.reset();
+        ::unlink(path.c_str());
+        throw;
+    }
+}
+
+void TpmVault::fill_image_holes(int fd, const std::string& path, uint64_t size) {
+    // Дыры копии заполняются экстентами, иначе нехватка места проявится
+    // ошибками записи внутри тома. Данные fallocate не трогает
+    TraceSpan span("fallocate", path);
+    if (size > 0 && ::fallocate(fd, 0, 0, static_cast<off_t>(size)) != 0 &&
+        errno != EOPNOTSUPP && errno != ENOSYS) {
+        throw VaultError("Failed to allocate image file " + path + ": " + std::strerror(errno));
+    }
+}
+
+void TpmVault::create_filesystem(const std::string& device, const VaultOptions& options) {
+    const FsProfile& profile = FsProfiles::find(options.fs_type, options.fs_profile);
+    
+    CommandOptions run_options;
+    run_options.timeout = MKFS_TIMEOUT;
+    CommandRunner::check("Failed to create " + profile.fs_type + " filesystem on " + device,
+                         FsProfiles::mkfs_command(profile, device), run_options);
+}
+
+void TpmVault::mount_filesystem(const std::string& device, const std::string& mount_point,
+                                const VaultOptions& options) {
+    const FsProfile& profile = FsProfiles::find(options.fs_type, options.fs_profile);
+    ensure_directory(mount_point);
+    mount_->mount(device, mount_point, profile.fs_type, profile.mount_options);
+}
+
+void TpmVault::grow_filesystem(const std::string& device, const std::string& mount_point,
+                               const VaultOptions& options) {
+    const FsProfile& profile = FsProfiles::find(options.fs_type, options.fs_profile);
+    std::string what = "Failed to grow " + profile.fs_type + " filesystem on " + device;
+    
+    CommandOptions run_options;
+    run_options.timeout = MKFS_TIMEOUT;
+    if (FsProfiles::grows_online(profile.fs_type)) {
+        CommandRunner::check(what, FsProfiles::grow_command(profile.fs_type, device, mount_point), run_options);
+        return;
     }
     
-    endmntent(mtab);
-    return found;
+    mount_->unmount(mount_point);
+    CommandRunner::check(what, FsProfiles::grow_command(profile.fs_type, device, mount_point), run_options);
+    mount_filesystem(device, mount_point, options);
 }
 
-void TpmVault::create(const std::string& name, size_t size) {
+void TpmVault::create(const std::string& name, size_t size, const VaultOptions& options) {
+    TraceSpan span("create", name);
+    RootKeyScope root_scope(*this);
+    
+    if (name.compare(0, std::strlen(POOL_PREFIX), POOL_PREFIX) == 0) {
+        throw VaultError("Names starting with " + std::string(POOL_PREFIX) + " are reserved for the vault pool");
+    }
+    if (file_exists(get_current_directory() + "/" + name + ".img")) {
+        throw VaultError(name + ".img already exists in current directory");
+    }
+    // Имена mapper и sealed object общие для хоста: второе хранилище с тем же именем
+    // в другой директории нельзя было бы открыть
+    RegistryEntry registered;
+    if (find_registered(name, registered)) {
+        throw VaultError(name + " is already registered at " + registered.image_path);
+    }
+    
+    // Готовое хранилище из пула: переименование вместо форматирования
+    PhaseClock clock(phases_);
+    bool hit = claim_pooled(name, size, options);
+    count_pool_claim(hit);
+    if (hit) {
+        kdf_time_ = std::chrono::microseconds{0};
+        clock.mark("pool_claim");
+    } else {
+        build(name, size, options);
+    }
+    register_vault(name, "");
+}
+
+void TpmVault::build(const std::string& name, size_t size, const VaultOptions& options) {
+    RootKeyScope root_scope(*this);
     std::string image_path = get_image_path(name);
+    std::string metadata_path = get_metadata_path(name);
     std::string mapper_name = LuksManager::get_mapper_name(name);
     std::string mapper_path = LuksManager::get_mapper_path(mapper_name);
     
@@ -126,187 +452,981 @@ void TpmVault::create(const std::string& name, size_t size) {
         throw VaultError(name + ".img already exists in current directory");
     }
     
-    // 1. Генерируем случайный мастер-ключ (64 байта / 512 бит)
+    // Размер loop-устройства округляется вниз до размера блока
+    if (options.loop.block_size != 0 && size % options.loop.block_size != 0) {
+        throw VaultError("Image size must be a multiple of the loop block size (" +
+                         std::to_string(options.loop.block_size) + ")");
+    }
+    
+    if (options.key_source != KEY_SEALED && options.key_source != KEY_DERIVED) {
+        throw VaultError("Unknown key source: " + options.key_source + " (expected sealed or derived)");
+    }
+    
+    FsProfiles::find(options.fs_type, options.fs_profile);
+    
+    PhaseClock clock(phases_);
+    VaultOptions effective = options;
+    
+    // 1. Мастер-ключ (64 байта / 512 бит): случайный для своего sealed object
+    //    или выведенный из корня хоста по новой соли
     SecureBuffer master_key(KEY_SIZE);
-    {
+    if (effective.key_source == KEY_DERIVED) {
+        effective.key_salt = KeyHierarchy::encode_salt(KeyHierarchy::new_salt());
+        const SecureBuffer& root = root_key(true);
+        clock.mark("unseal_root");
+        KeyHierarchy::derive(root, KeyHierarchy::decode_salt(effective.key_salt), master_key);
+        clock.mark("derive_key");
+    } else {
         auto random_bytes = generate_random_bytes(KEY_SIZE);
         std::memcpy(master_key.data(), random_bytes.data(), KEY_SIZE);
         secure_erase(random_bytes);
+        clock.mark("random_key");
     }
     
+    CryptBackend& crypt = backend_for(options);
     std::string loop_device;
+    std::vector<CipherBenchResult> cipher_bench;
     
     try {
         // 2. Создаём файл образа
-        create_image_file(image_path, size);
+        create_image_file(image_path, size, options.sparse);
+        clock.mark("create_image");
         
         // 3. Подключаем как loop-устройство
-        loop_device = loop_->attach(image_path);
+        loop_device = loop_->attach(image_path, options.loop);
+        clock.mark("attach");
         
-        // 4. Форматируем как LUKS2
-        luks_->format(loop_device, master_key.vector());
+        // 4. Форматируем как LUKS2 или проверяем параметры тома без заголовка
+        //    (при --cipher auto — шифром, выбранным по замеру)
+        if (effective.luks.cipher == CIPHER_AUTO) {
+            cipher_bench = select_cipher(loop_device, effective.luks);
+            clock.mark("cipher_bench");
+        }
+        crypt.format(loop_device, master_key.vector(), effective.luks);
+        kdf_time_ = crypt.last_kdf_time();
+        clock.mark("format");
         
         // 5. Временно открываем для создания файловой системы
-        luks_->open(loop_device, mapper_name, master_key.vector());
+        crypt.open(loop_device, mapper_name, master_key.vector(), effective.luks);
+        clock.mark("crypt_open");
         
-        // 6. Создаём файловую систему ext4
-        create_filesystem(mapper_path);
+        // 6. Создаём файловую систему по профилю (размечается под сектор тома)
+        create_filesystem(mapper_path, effective);
+        clock.mark("mkfs");
         
-        // 7. Закрываем LUKS
-        luks_->close(mapper_name);
+        // 7. Закрываем том и освобождаем дескриптор crypt_device,
+        //    удерживавшийся с момента форматирования
+        crypt.close(mapper_name);
+        crypt.release();
+        clock.mark("crypt_close");
         
         // 8. Отключаем loop-устройство
         loop_->detach(loop_device);
         loop_device.clear();
+        clock.mark("detach");
         
-        // 9. Запечатываем мастер-ключ в TPM с политикой PCR
-        tpm_->seal(name, master_key.vector());
+        // 9. Сохраняем параметры хранилища для последующих открытий
+        save_options(name, effective);
+        if (!cipher_bench.empty()) {
+            record_cipher_benchmark(name, cipher_bench);
+        }
+        clock.mark("save_metadata");
+        
+        // 10. Запечатываем мастер-ключ в TPM с политикой PCR
+        //     (выводимый ключ восстанавливается из корня и соли)
+        if (effective.key_source == KEY_SEALED) {
+            tpm().seal(seal_name_of(name, effective), master_key.vector());
+            clock.mark("seal");
+        }
         
         // Ключ будет автоматически затёрт в деструкторе SecureBuffer
         
     } catch (const VaultError& e) {
         // Cleanup при ошибке
-        if (luks_->is_open(mapper_name)) {
-            try { luks_->close(mapper_name); } catch (...) {}
+        if (crypt.is_open(mapper_name)) {
+            try { crypt.close(mapper_name); } catch (...) {}
         }
+        crypt.release();
         if (!loop_device.empty()) {
             try { loop_->detach(loop_device); } catch (...) {}
         }
         if (file_exists(image_path)) {
             std::remove(image_path.c_str());
         }
+        if (file_exists(metadata_path)) {
+            std::remove(metadata_path.c_str());
+        }
         throw;
     }
 }
 
-void TpmVault::open(const std::string& name) {
+std::string TpmVault::pool_spec(size_t size, const VaultOptions& options) {
+    // Все параметры create(), кроме выбираемых им самим (соль, имя sealed object)
+    std::ostringstream spec;
+    spec << "size=" << size
+         << ";backend=" << options.backend
+         << ";key=" << options.key_source
+         << ";fs=" << options.fs_type << "/" << options.fs_profile
+         << ";sparse=" << options.sparse
+         << ";cipher=" << options.luks.cipher
+         << ";sector=" << options.luks.sector_size
+         << ";fast_unlock=" << options.luks.fast_unlock
+         << ";perf=" << options.luks.perf_profile
+         << ";cpu_mask=" << options.luks.cpu_mask
+         << ";loop=" << options.loop.direct_io << "," << options.loop.block_size << ","
+         << options.loop.read_ahead_kb << "," << options.loop.nr_requests;
+    return spec.str();
+}
+
+std::vector<PoolEntry> TpmVault::pool_entries() const {
+    std::vector<PoolEntry> entries;
+    std::string cwd = get_current_directory();
+    
+    DIR* dir = opendir(cwd.c_str());
+    if (!dir) {
+        return entries;
+    }
+    std::vector<std::string> ids;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        std::string file = entry->d_name;
+        if (file.compare(0, std::strlen(POOL_PREFIX), POOL_PREFIX) == 0 &&
+            file.size() > 4 && file.compare(file.size() - 4, 4, ".img") == 0) {
+            ids.push_back(file.substr(0, file.size() - 4));
+        }
+    }
+    closedir(dir);
+    
+    for (const auto& id : ids) {
+        // pool.spec записывается последним: без него хранилище ещё готовится
+        VaultMetadata metadata = VaultMetadata::load(get_metadata_path(id));
+        struct stat st;
+        if (!metadata.has("pool.spec") || stat(get_image_path(id).c_str(), &st) != 0) {
+            continue;
+        }
+        PoolEntry pooled;
+        pooled.id = id;
+        pooled.spec = metadata.get("pool.spec");
+        pooled.size = static_cast<size_t>(st.st_size);
+        pooled.options = load_options(id);
+        entries.push_back(std::move(pooled));
+    }
+    return entries;
+}
+
+size_t TpmVault::pool_fill(size_t size, const VaultOptions& options, size_t count) {
+    TraceSpan span("pool_fill");
+    RootKeyScope root_scope(*this);
+    std::string spec = pool_spec(size, options);
+    
+    auto entries = pool_entries();
+    size_t ready = std::count_if(entries.begin(), entries.end(),
+                                 [&](const PoolEntry& pooled) { return pooled.spec == spec; });
+    
+    // Счётчики попаданий ведутся там, где пул заведён
+    std::string stats_path = get_current_directory() + "/" + POOL_STATS;
+    if (!file_exists(stats_path)) {
+        VaultMetadata stats;
+        stats.set_uint("pool.hits", 0);
+        stats.set_uint("pool.misses", 0);
+        stats.save(stats_path);
+    }
+    
+    size_t created = 0;
+    for (; ready + created < count; ++created) {
+        auto random_bytes = generate_random_bytes(POOL_ID_BYTES);
+        std::ostringstream hex;
+        for (uint8_t b : random_bytes) {
+            hex << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(b);
+        }
+        std::string id = POOL_PREFIX + hex.str();
+        
+        VaultOptions pooled = options;
+        if (pooled.key_source == KEY_SEALED) {
+            pooled.seal_name = "pool-" + hex.str();
+        }
+        build(id, size, pooled);
+        
+        VaultMetadata metadata = VaultMetadata::load(get_metadata_path(id));
+        metadata.set("pool.spec", spec);
+        metadata.save(get_metadata_path(id));
+    }
+    return created;
+}
+
+bool TpmVault::claim_pooled(const std::string& name, size_t size, const VaultOptions& options) {
+    std::string spec = pool_spec(size, options);
     std::string image_path = get_image_path(name);
-    std::string mount_path = get_mount_path(name);
-    std::string mapper_name = LuksManager::get_mapper_name(name);
-    std::string mapper_path = LuksManager::get_mapper_path(mapper_name);
     
+    for (const auto& pooled : pool_entries()) {
+        if (pooled.spec != spec) {
+            continue;
+        }
+        
+        // Из двух одновременных create образ достанется одному: второй получит ENOENT
+        std::string pooled_image = get_image_path(pooled.id);
+        if (renameat2(AT_FDCWD, pooled_image.c_str(), AT_FDCWD, image_path.c_str(), RENAME_NOREPLACE) != 0) {
+            if (errno == ENOENT) {
+                continue;
+            }
+            if (errno == EEXIST) {
+                throw VaultError(name + ".img already exists in current directory");
+            }
+            throw VaultError("Failed to claim " + pooled.id + ": " + std::strerror(errno));
+        }
+        
+        // Ключ остаётся в TPM под идентификатором пула (key.seal_name)
+        try {
+            VaultMetadata metadata = VaultMetadata::load(get_metadata_path(pooled.id));
+            metadata.erase("pool.spec");
+            metadata.save(get_metadata_path(name));
+        } catch (const VaultError&) {
+            std::rename(image_path.c_str(), pooled_image.c_str());
+            throw;
+        }
+        ::unlink(get_metadata_path(pooled.id).c_str());
+        return true;
+    }
+    return false;
+}
+
+void TpmVault::count_pool_claim(bool hit) {
+    std::string cwd = get_current_directory();
+    std::string path = cwd + "/" + POOL_STATS;
+    if (!file_exists(path)) {
+        return;
+    }
+    
+    // Файл счётчиков заменяется rename, поэтому блокируется каталог
+    UniqueFd dir(::open(cwd.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+    if (!dir.valid() || flock(dir.get(), LOCK_EX) != 0) {
+        return;
+    }
+    try {
+        VaultMetadata stats = VaultMetadata::load(path);
+        const char* key = hit ? "pool.hits" : "pool.misses";
+        stats.set_uint(key, stats.get_uint(key) + 1);
+        stats.save(path);
+    } catch (const VaultError&) {
+        // Счётчик не стоит созданного хранилища
+    }
+}
+
+PoolStatus TpmVault::pool_status() const {
+    PoolStatus status;
+    status.entries = pool_entries();
+    
+    VaultMetadata stats = VaultMetadata::load(get_current_directory() + "/" + POOL_STATS);
+    status.hits = stats.get_uint("pool.hits");
+    status.misses = stats.get_uint("pool.misses");
+    return status;
+}
+
+size_t TpmVault::pool_drain() {
+    TraceSpan span("pool_drain");
+    size_t removed = 0;
+    for (const auto& pooled : pool_entries()) {
+        // Образ, который create успел забрать, уже не принадлежит пулу
+        if (::unlink(get_image_path(pooled.id).c_str()) != 0) {
+            continue;
+        }
+        ::unlink(get_metadata_path(pooled.id).c_str());
+        if (pooled.options.key_source == KEY_SEALED) {
+            tpm().remove(seal_name_of(pooled.id, pooled.options));
+        }
+        ++removed;
+    }
+    return removed;
+}
+
+void TpmVault::check_can_open(const std::string& name) {
     // Проверяем наличие файла образа
-    if (!file_exists(image_path)) {
+    if (!file_exists(get_image_path(name))) {
         throw VaultError(name + ".img not found in current directory");
     }
     
     // Проверяем, не открыто ли уже
-    if (luks_->is_open(mapper_name)) {
+    if (luks_->is_open(LuksManager::get_mapper_name(name))) {
         throw VaultError(name + " is already open");
     }
+}
+
+std::string TpmVault::seal_name_of(const std::string& name, const VaultOptions& options) {
+    return options.seal_name.empty() ? name : options.seal_name;
+}
+
+void TpmVault::unseal_key(const std::string& name, SecureBuffer& key) {
+    auto unsealed = tpm().unseal(name);
+    if (unsealed.size() != KEY_SIZE || key.size() != KEY_SIZE) {
+        secure_erase(unsealed);
+        throw VaultError("Invalid key size from TPM");
+    }
+    std::memcpy(key.data(), unsealed.data(), KEY_SIZE);
+    secure_erase(unsealed);
+}
+
+const SecureBuffer& TpmVault::root_key(bool create) {
+    if (root_key_) {
+        return *root_key_;
+    }
     
-    // 1. Извлекаем мастер-ключ из TPM
-    SecureBuffer master_key(KEY_SIZE);
-    {
-        auto unsealed = tpm_->unseal(name);
-        if (unsealed.size() != KEY_SIZE) {
+    auto root = std::make_unique<SecureBuffer>(KeyHierarchy::ROOT_SIZE);
+    if (create && !tpm().has_root()) {
+        auto random_bytes = generate_random_bytes(KeyHierarchy::ROOT_SIZE);
+        std::memcpy(root->data(), random_bytes.data(), KeyHierarchy::ROOT_SIZE);
+        secure_erase(random_bytes);
+        tpm().seal_root(root->vector());
+    } else {
+        auto unsealed = tpm().unseal_root();
+        if (unsealed.size() != KeyHierarchy::ROOT_SIZE) {
             secure_erase(unsealed);
-            throw VaultError("Invalid key size from TPM");
+            throw VaultError("Invalid root secret size from TPM");
         }
-        std::memcpy(master_key.data(), unsealed.data(), KEY_SIZE);
+        std::memcpy(root->data(), unsealed.data(), KeyHierarchy::ROOT_SIZE);
         secure_erase(unsealed);
     }
     
+    root_key_ = std::move(root);
+    return *root_key_;
+}
+
+void TpmVault::load_key(const std::string& name, const VaultOptions& options, SecureBuffer& key,
+                        const PhaseMark& mark) {
+    auto step = [&](const char* phase) { if (mark) mark(phase); };
+    
+    if (options.key_source == KEY_SEALED) {
+        unseal_key(seal_name_of(name, options), key);
+        step("unseal");
+        return;
+    }
+    if (options.key_source != KEY_DERIVED) {
+        throw VaultError("Unknown key source for " + name + ": " + options.key_source);
+    }
+    if (options.key_salt.empty()) {
+        throw VaultError("No key salt for " + name + " (vault was wiped)");
+    }
+    
+    // Корень извлекается из TPM только при первом обращении за операцию
+    const SecureBuffer& root = root_key(false);
+    step("unseal_root");
+    KeyHierarchy::derive(root, KeyHierarchy::decode_salt(options.key_salt), key);
+    step("derive_key");
+}
+
+std::chrono::microseconds TpmVault::activate(const std::string& name, const VaultOptions& options,
+                                             CryptBackend& crypt, SecureBuffer& key, const PhaseMark& mark) {
+    std::string image_path = get_image_path(name);
+    std::string mount_path = get_mount_path(name);
+    std::string mapper_name = LuksManager::get_mapper_name(name);
+    std::string mapper_path = LuksManager::get_mapper_path(mapper_name);
+    auto step = [&](const char* phase) { if (mark) mark(phase); };
+    
     std::string loop_device;
+    std::chrono::microseconds kdf_time{0};
     
     try {
-        // 2. Подключаем образ как loop-устройство
-        loop_device = loop_->attach(image_path);
+        // 2. Подключаем образ как loop-устройство с сохранёнными настройками
+        loop_device = loop_->attach(image_path, options.loop);
+        step("attach");
+        
+        // 3. Открываем шифрованный том
+        crypt.open(loop_device, mapper_name, key.vector(), options.luks);
+        kdf_time = crypt.last_kdf_time();
         
-        // 3. Открываем LUKS-контейнер
-        luks_->open(loop_device, mapper_name, master_key.vector());
+        crypt.release();
+        step("crypt_open");
         
         // 4. Монтируем файловую систему
-        mount_filesystem(mapper_path, mount_path);
+        mount_filesystem(mapper_path, mount_path, options);
+        step("mount");
+        
+        // 5. Записываем устройства в реестр: close найдёт их без обхода
+        register_vault(name, loop_device);
+        step("register");
         
     } catch (const VaultError& e) {
         // Cleanup при ошибке
-        if (luks_->is_open(mapper_name)) {
-            try { luks_->close(mapper_name); } catch (...) {}
+        if (mount_->is_mounted(mount_path)) {
+            try { mount_->unmount(mount_path); } catch (...) {}
         }
+        if (crypt.is_open(mapper_name)) {
+            try { crypt.close(mapper_name); } catch (...) {}
+        }
+        crypt.release();
         if (!loop_device.empty()) {
             try { loop_->detach(loop_device); } catch (...) {}
         }
         throw;
     }
+    
+    return kdf_time;
 }
 
-void TpmVault::close(const std::string& name) {
+void TpmVault::open(const std::string& name) {
+    TraceSpan span("open", name);
+    RootKeyScope root_scope(*this);
+    check_can_open(name);
+    
+    PhaseClock clock(phases_);
+    VaultOptions options = load_options(name);
+    CryptBackend& crypt = backend_for(options);
+    clock.mark("load_metadata");
+    
+    // 1. Извлекаем мастер-ключ из TPM или выводим из корня хоста
+    SecureBuffer master_key(KEY_SIZE);
+    load_key(name, options, master_key, [&clock](const char* phase) { clock.mark(phase); });
+    
+    kdf_time_ = activate(name, options, crypt, master_key,
+                         [&clock](const char* phase) { clock.mark(phase); });
+}
+
+std::vector<VaultResult> TpmVault::open_many(const std::vector<std::string>& names) {
+    TraceSpan span("open_many");
+    RootKeyScope root_scope(*this);
+    std::vector<VaultResult> results(names.size());
+    std::vector<std::future<void>> pending;
+    WorkerPool pool(WorkerPool::size_for(names.size()));
+    
+    for (size_t i = 0; i < names.size(); ++i) {
+        const std::string& name = names[i];
+        results[i].name = name;
+        
+        try {
+            if (std::find(names.begin(), names.begin() + i, name) != names.begin() + i) {
+                throw VaultError(name + " is listed more than once");
+            }
+            check_can_open(name);
+            VaultOptions options = load_options(name);
+            
+            // TPM обслуживает один запрос за раз: ключи извлекаем подряд здесь,
+            // а остальные шаги уже расшифрованных хранилищ идут в пуле.
+            // Выводимым ключам на всех хватает одного извлечения корня
+            auto key = std::make_shared<SecureBuffer>(KEY_SIZE);
+            load_key(name, options, *key, nullptr);
+            
+            pending.push_back(pool.submit([this, &results, i, options, key] {
+                try {
+                    auto crypt = make_backend(options);
+                    activate(results[i].name, options, *crypt, *key, nullptr);
+                } catch (const VaultError& e) {
+                    results[i].error = e.what();
+                }
+            }));
+        } catch (const VaultError& e) {
+            results[i].error = e.what();
+        }
+    }
+    
+    for (auto& task : pending) {
+        task.get();
+    }
+    return results;
+}
+
+void TpmVault::deactivate(const std::string& name, CryptBackend& crypt, const PhaseMark& mark) {
     std::string image_path = get_image_path(name);
     std::string mount_path = get_mount_path(name);
     std::string mapper_name = LuksManager::get_mapper_name(name);
+    auto step = [&](const char* phase) { if (mark) mark(phase); };
 
     std::exception_ptr first_error;
 
     // 1. Размонтируем файловую систему
     try {
-        unmount_filesystem(mount_path);
+        mount_->unmount(mount_path);
     } catch (...) {
         if (!first_error) first_error = std::current_exception();
     }
+    step("unmount");
 
-    // 2. Закрываем LUKS-устройство
+    // 2. Закрываем шифрованный том
     try {
-        luks_->close(mapper_name);
+        crypt.close(mapper_name);
     } catch (...) {
         if (!first_error) first_error = std::current_exception();
     }
+    step("crypt_close");
 
-    // 3. Отключаем loop-устройство
+    // 3. Отключаем loop-устройство (записанное в реестре, если запись верна)
     try {
-        std::string loop_device = loop_->find_loop_for_file(image_path);
+        std::string loop_device = find_loop(name, image_path);
         if (!loop_device.empty()) {
             loop_->detach(loop_device);
         }
     } catch (...) {
         if (!first_error) first_error = std::current_exception();
     }
+    step("detach");
 
     // Перебрасываем первую ошибку после попытки очистить всё
     if (first_error) {
         std::rethrow_exception(first_error);
     }
+    register_vault(name, "");
+    step("register");
+}
+
+void TpmVault::grow(const std::string& name, size_t new_size) {
+    TraceSpan span("grow", name);
+    RootKeyScope root_scope(*this);
+    std::string image_path = get_image_path(name);
+    std::string mount_path = get_mount_path(name);
+    std::string mapper_name = LuksManager::get_mapper_name(name);
+    std::string mapper_path = LuksManager::get_mapper_path(mapper_name);
+    
+    struct stat st;
+    if (stat(image_path.c_str(), &st) != 0) {
+        throw VaultError(name + ".img not found in current directory");
+    }
+    size_t old_size = static_cast<size_t>(st.st_size);
+    
+    PhaseClock clock(phases_);
+    auto mark = [&clock](const char* phase) { clock.mark(phase); };
+    VaultOptions options = load_options(name);
+    CryptBackend& crypt = backend_for(options);
+    FsProfiles::find(options.fs_type, options.fs_profile);
+    clock.mark("load_metadata");
+    
+    if (new_size < old_size) {
+        throw VaultError("Cannot shrink " + name + " from " + format_size(old_size) + " to " +
+                         format_size(new_size));
+    }
+    if (options.loop.block_size != 0 && new_size % options.loop.block_size != 0) {
+        throw VaultError("Image size must be a multiple of the loop block size (" +
+                         std::to_string(options.loop.block_size) + ")");
+    }
+    if (options.luks.sector_size != 0 && new_size % options.luks.sector_size != 0) {
+        throw VaultError("Vault size must be a multiple of the sector size");
+    }
+    
+    bool was_open = crypt.is_open(mapper_name);
+    std::string loop_device;
+    if (was_open) {
+        loop_device = find_loop(name, image_path);
+        if (loop_device.empty()) {
+            throw VaultError(name + " is open but its loop device was not found");
+        }
+    }
+    
+    // 1. Ключ: закрытому хранилищу — для открытия, открытому — только
+    //    для новой таблицы тома без заголовка или с ключом в keyring
+    SecureBuffer key(KEY_SIZE);
+    try {
+        if (!was_open || crypt.resize_needs_key(loop_device, mapper_name)) {
+            load_key(name, options, key, mark);
+        }
+    } catch (const VaultError&) {
+        crypt.release();
+        throw;
+    }
+    
+    // 2. Увеличиваем образ
+    extend_image_file(image_path, old_size, new_size, options.sparse);
+    clock.mark("extend_image");
+    
+    try {
+        if (was_open) {
+            // 3. Loop-устройство и том dm-crypt перечитывают размер без закрытия
+            loop_->refresh_capacity(loop_device);
+            clock.mark("loop_capacity");
+            
+            crypt.resize(loop_device, mapper_name, key.vector(), options.luks);
+            crypt.release();
+            clock.mark("crypt_resize");
+            
+            if (!mount_->is_mounted(mount_path)) {
+                mount_filesystem(mapper_path, mount_path, options);
+                clock.mark("mount");
+            }
+        } else {
+            // 3. Закрытое хранилище сразу открывается с новым размером
+            activate(name, options, crypt, key, mark);
+        }
+        
+        // 4. Растягиваем файловую систему
+        grow_filesystem(mapper_path, mount_path, options);
+        clock.mark("fs_grow");
+    } catch (const VaultError&) {
+        crypt.release();
+        if (!was_open) {
+            try { deactivate(name, crypt, nullptr); } catch (...) {}
+        }
+        throw;
+    }
+    
+    if (!was_open) {
+        deactivate(name, crypt, mark);
+    }
+}
+
+void TpmVault::close(const std::string& name) {
+    TraceSpan span("close", name);
+    PhaseClock clock(phases_);
+    deactivate(name, backend_for(load_options(name)),
+               [&clock](const char* phase) { clock.mark(phase); });
+}
+
+std::vector<VaultResult> TpmVault::close_many(const std::vector<std::string>& names) {
+    TraceSpan span("close_many");
+    std::vector<VaultResult> results(names.size());
+    std::vector<std::future<void>> pending;
+    WorkerPool pool(WorkerPool::size_for(names.size()));
+    
+    for (size_t i = 0; i < names.size(); ++i) {
+        results[i].name = names[i];
+        // Две задачи одного хранилища состязались бы за umount и detach
+        if (std::find(names.begin(), names.begin() + i, names[i]) != names.begin() + i) {
+            results[i].error = names[i] + " is listed more than once";
+            continue;
+        }
+        pending.push_back(pool.submit([this, &results, i] {
+            try {
+                auto crypt = make_backend(load_options(results[i].name));
+                deactivate(results[i].name, *crypt, nullptr);
+            } catch (const VaultError& e) {
+                results[i].error = e.what();
+            }
+        }));
+    }
+    
+    for (auto& task : pending) {
+        task.get();
+    }
+    return results;
+}
+
+void TpmVault::check_closed(const std::string& name) {
+    for (const auto& info : list(true)) {
+        if (info.name == name) {
+            throw VaultError(name + " is open; close it first");
+        }
+    }
+}
+
+TransferStats TpmVault::export_vault(const std::string& name, const std::string& destination) {
+    TraceSpan span("export", name);
+    std::string image_path = get_image_path(name);
+    
+    if (!file_exists(image_path)) {
+        throw VaultError(name + ".img not found in current directory");
+    }
+    // Смонтированный том меняет образ во время копирования
+    check_closed(name);
+    
+    UniqueFd src(::open(image_path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (!src.valid()) {
+        throw VaultError("Failed to open image file " + image_path + ": " + std::strerror(errno));
+    }
+    VaultMetadata metadata = VaultMetadata::load(get_metadata_path(name));
+    
+    if (destination == ImageTransfer::STDIO) {
+        return ImageTransfer::write_stream(src.get(), metadata.serialize(), STDOUT_FILENO);
+    }
+    
+    std::string dest_image = directory_exists(destination) ? destination + "/" + name + ".img" : destination;
+    std::string dest_metadata = VaultMetadata::path_for_image(dest_image);
+    if (!metadata.empty() && file_exists(dest_metadata)) {
+        throw VaultError(dest_metadata + " already exists");
+    }
+    
+    TransferStats stats;
+    write_image_file(dest_image, [&](int fd) {
+        stats = ImageTransfer::copy(src.get(), fd);
+    });
+    if (!metadata.empty()) {
+        try {
+            metadata.save(dest_metadata);
+        } catch (const VaultError&) {
+            ::unlink(dest_image.c_str());
+            throw;
+        }
+    }
+    return stats;
+}
+
+TransferStats TpmVault::import_vault(const std::string& source, const std::string& name) {
+    TraceSpan span("import", name);
+    std::string image_path = get_image_path(name);
+    std::string metadata_path = get_metadata_path(name);
+    
+    check_closed(name);
+    if (file_exists(image_path)) {
+        throw VaultError(name + ".img already exists");
+    }
+    if (file_exists(metadata_path)) {
+        throw VaultError(name + ".vault already exists");
+    }
+    
+    bool from_stream = source == ImageTransfer::STDIO;
+    UniqueFd src;
+    if (!from_stream) {
+        src.reset(::open(source.c_str(), O_RDONLY | O_CLOEXEC));
+        if (!src.valid()) {
+            throw VaultError("Failed to open " + source + ": " + std::strerror(errno));
+        }
+    }
+    
+    VaultMetadata metadata;
+    TransferStats stats;
+    write_image_file(image_path, [&](int fd) {
+        if (from_stream) {
+            std::string text;
+            stats = ImageTransfer::read_stream(STDIN_FILENO, fd, text);
+            metadata = VaultMetadata::parse(text, "image stream");
+        } else {
+            stats = ImageTransfer::copy(src.get(), fd);
+            metadata = VaultMetadata::load(VaultMetadata::path_for_image(source));
+        }
+        if (!metadata.get_bool("image.sparse")) {
+            fill_image_holes(fd, image_path, stats.size);
+        }
+    });
+    
+    if (!metadata.empty()) {
+        try {
+            metadata.save(metadata_path);
+        } catch (const VaultError&) {
+            ::unlink(image_path.c_str());
+            throw;
+        }
+    }
+    return stats;
+}
+
+BackupStats TpmVault::backup(const std::string& name, const std::string& dir, size_t chunk_size) {
+    std::string image_path = get_image_path(name);
+    
+    if (!file_exists(image_path)) {
+        throw VaultError(name + ".img not found in current directory");
+    }
+    // Блоки смонтированного тома меняются во время чтения: копия была бы несогласованной
+    check_closed(name);
+    
+    UniqueFd image(::open(image_path.c_str(), O_RDONLY | O_CLOEXEC));
+    if (!image.valid()) {
+        throw VaultError("Failed to open image file " + image_path + ": " + std::strerror(errno));
+    }
+    BackupStats stats = ChunkBackup::backup(image.get(), dir, name, chunk_size);
+    
+    VaultMetadata metadata = VaultMetadata::load(get_metadata_path(name));
+    if (!metadata.empty()) {
+        metadata.save(dir + "/" + name + ".vault");
+    }
+    return stats;
 }
 
-std::vector<VaultInfo> TpmVault::list() {
+BackupStats TpmVault::restore(const std::string& dir, const std::string& name) {
+    std::string image_path = get_image_path(name);
+    std::string metadata_path = get_metadata_path(name);
+    
+    check_closed(name);
+    if (file_exists(image_path)) {
+        throw VaultError(name + ".img already exists");
+    }
+    if (file_exists(metadata_path)) {
+        throw VaultError(name + ".vault already exists");
+    }
+    
+    VaultMetadata metadata = VaultMetadata::load(dir + "/" + name + ".vault");
+    BackupStats stats;
+    write_image_file(image_path, [&](int fd) {
+        stats = ChunkBackup::restore(dir, name, fd);
+        if (!metadata.get_bool("image.sparse")) {
+            fill_image_holes(fd, image_path, stats.size);
+        }
+    });
+    
+    if (!metadata.empty()) {
+        try {
+            metadata.save(metadata_path);
+        } catch (const VaultError&) {
+            ::unlink(image_path.c_str());
+            throw;
+        }
+    }
+    return stats;
+}
+
+std::vector<VaultInfo> TpmVault::list(bool everywhere) {
     std::vector<VaultInfo> result;
     std::string cwd = get_current_directory();
+    std::string prefix = cwd + "/";
     
-    // Получаем список всех loop-устройств
-    auto loops = loop_->list_attached();
+    // По одному снимку loop-устройств, томов device mapper и таблицы монтирования,
+    // затем соединение по хеш-таблицам: без обхода mountinfo на каждое устройство
+    LoopMap loops = loop_->scan();
+    auto mappers = CryptBackend::scan_active();
+    auto mounts = mount_->mount_table();
     
-    for (const auto& [loop_dev, backing_file] : loops) {
-        // Проверяем, что файл в текущей директории и имеет расширение .img
-        if (backing_file.find(cwd) != 0) continue;
-        if (backing_file.size() <= 4) continue;
-        if (backing_file.substr(backing_file.size() - 4) != ".img") continue;
+    // Кандидаты: имя → (образ, точка монтирования)
+    std::map<std::string, std::pair<std::string, std::string>> candidates;
+    for (const auto& entry : registry_.entries()) {
+        if (!everywhere && entry.image_path != prefix + entry.name + ".img") continue;
+        candidates.emplace(entry.name, std::make_pair(entry.image_path, entry.mount_point));
+    }
+    
+    // Образы *.img прямо в текущей директории, которых нет в реестре
+    for (const auto& entry : loops) {
+        const std::string& backing_file = entry.second.backing_file;
+        if (backing_file.compare(0, prefix.size(), prefix) != 0) continue;
+        if (backing_file.size() <= prefix.size() + 4) continue;
+        if (backing_file.compare(backing_file.size() - 4, 4, ".img") != 0) continue;
         
-        // Извлекаем имя хранилища
-        std::string filename = backing_file.substr(cwd.size() + 1);
-        std::string name = filename.substr(0, filename.size() - 4);
+        std::string name = backing_file.substr(prefix.size(), backing_file.size() - prefix.size() - 4);
+        if (name.find('/') != std::string::npos) continue;
+        candidates.emplace(name, std::make_pair(backing_file, prefix + name));
+    }
+    
+    // Сверка с ядром: образ привязан к loop, том активен, точка смонтирована
+    for (const auto& [name, paths] : candidates) {
+        const std::string& image_path = paths.first;
+        const std::string& mount_path = paths.second;
         
+        struct stat st;
+        if (stat(image_path.c_str(), &st) != 0) continue;
+        auto loop = loops.find(BackingId{static_cast<uint64_t>(st.st_dev), static_cast<uint64_t>(st.st_ino)});
+        if (loop == loops.end()) continue;
         std::string mapper_name = LuksManager::get_mapper_name(name);
-        std::string mapper_path = LuksManager::get_mapper_path(mapper_name);
-        std::string mount_path = get_mount_path(name);
+        auto mapper = mappers.find(mapper_name);
+        if (mapper == mappers.end()) continue;
+        if (mounts.find(mount_path) == mounts.end()) continue;
         
-        // Проверяем, что LUKS открыт и смонтирован
-        if (luks_->is_open(mapper_name) && is_mounted(mount_path)) {
-            VaultInfo info;
-            info.name = name;
-            info.image_path = backing_file;
-            info.loop_device = loop_dev;
-            info.mapper_device = mapper_path;
-            info.mount_point = mount_path;
-            result.push_back(info);
+        VaultInfo info;
+        info.name = name;
+        info.image_path = image_path;
+        info.loop_device = loop->second.device;
+        info.mapper_device = LuksManager::get_mapper_path(mapper_name);
+        info.mount_point = mount_path;
+        info.loop_rdev = loop->second.rdev;
+        info.mapper_rdev = mapper->second;
+        
+        struct statvfs fs;
+        if (statvfs(mount_path.c_str(), &fs) == 0) {
+            info.total_bytes = static_cast<uint64_t>(fs.f_blocks) * fs.f_frsize;
+            info.used_bytes = static_cast<uint64_t>(fs.f_blocks - fs.f_bfree) * fs.f_frsize;
+            info.available_bytes = static_cast<uint64_t>(fs.f_bavail) * fs.f_frsize;
         }
+        result.push_back(std::move(info));
     }
     
     return result;
 }
 
 void TpmVault::wipe(const std::string& name) {
-    // Удаляем sealed object из TPM
-    tpm_->remove(name);
+    VaultOptions options = load_options(name);
+    if (options.key_source != KEY_DERIVED) {
+        // Удаляем sealed object из TPM
+        tpm().remove(seal_name_of(name, options));
+        registry_.remove(name);
+        return;
+    }
+    
+    // Корень общий для всех хранилищ хоста: удалить можно только соль, а её копии
+    // остаются в резервных копиях и экспорте. Необратимость даёт уничтожение keyslot
+    if (options.backend != BACKEND_LUKS2 || options.luks.fast_unlock) {
+        throw VaultError(name + ": the derived key is the volume key itself (raw backend or fast unlock), "
+                         "so any copy of its salt (backup, export) still opens it; delete the image "
+                         "and all its copies instead");
+    }
+    if (options.key_salt.empty()) {
+        throw VaultError("No key salt found for " + name);
+    }
+    std::string image_path = get_image_path(name);
+    if (!file_exists(image_path)) {
+        throw VaultError(name + ".img not found in current directory");
+    }
+    
+    std::string loop_device = find_loop(name, image_path);
+    bool attached_here = loop_device.empty();
+    if (attached_here) {
+        loop_device = loop_->attach(image_path, options.loop);
+    }
+    try {
+        luks_->destroy_keyslots(loop_device);
+        luks_->release();
+    } catch (const VaultError&) {
+        luks_->release();
+        if (attached_here) {
+            try { loop_->detach(loop_device); } catch (...) {}
+        }
+        throw;
+    }
+    if (attached_here) {
+        loop_->detach(loop_device);
+    }
+    
+    options.key_salt.clear();
+    save_options(name, options);
+    registry_.remove(name);
+}
+
+void TpmVault::migrate_key(const std::string& name) {
+    TraceSpan span("migrate_key", name);
+    RootKeyScope root_scope(*this);
+    std::string image_path = get_image_path(name);
+    
+    if (!file_exists(image_path)) {
+        throw VaultError(name + ".img not found in current directory");
+    }
+    VaultOptions options = load_options(name);
+    if (options.key_source == KEY_DERIVED) {
+        throw VaultError(name + " already uses a derived key");
+    }
+    if (options.backend != BACKEND_LUKS2 || options.luks.fast_unlock) {
+        throw VaultError(name + ": the sealed key is the volume key itself (raw backend or fast unlock); "
+                         "re-create the vault with --key-source derived");
+    }
+    
+    PhaseClock clock(phases_);
+    
+    SecureBuffer old_key(KEY_SIZE);
+    unseal_key(seal_name_of(name, options), old_key);
+    clock.mark("unseal");
+    
+    VaultOptions migrated = options;
+    migrated.key_source = KEY_DERIVED;
+    migrated.key_salt = KeyHierarchy::encode_salt(KeyHierarchy::new_salt());
+    migrated.seal_name.clear();
+    SecureBuffer new_key(KEY_SIZE);
+    KeyHierarchy::derive(root_key(true), KeyHierarchy::decode_salt(migrated.key_salt), new_key);
+    clock.mark("derive_key");
+    
+    // У открытого хранилища loop-устройство уже есть
+    std::string loop_device = find_loop(name, image_path);
+    bool attached_here = loop_device.empty();
+    if (attached_here) {
+        loop_device = loop_->attach(image_path, options.loop);
+    }
+    
+    try {
+        // Порядок шагов оставляет хранилище открываемым при сбое на любом из них:
+        // старый keyslot удаляется только после записи соли
+        luks_->add_passphrase(loop_device, old_key.vector(), new_key.vector());
+        save_options(name, migrated);
+        luks_->remove_passphrase(loop_device, old_key.vector());
+        luks_->release();
+    } catch (const VaultError& e) {
+        luks_->release();
+        if (attached_here) {
+            try { loop_->detach(loop_device); } catch (...) {}
+        }
+        throw;
+    }
+    if (attached_here) {
+        loop_->detach(loop_device);
+    }
+    clock.mark("rekey");
+    
+    tpm().remove(seal_name_of(name, options));
+    clock.mark("remove_sealed");
+}
+
+std::chrono::microseconds TpmVault::last_kdf_time() const {
+    return kdf_time_;
+}
+
+const std::vector<PhaseTiming>& TpmVault::last_phases() const {
+    return phases_;
 }
 
 } // namespace tpm_vault
@@ -0,0 +1,88 @@
+#include "trace.hpp"
+#include "utils.hpp"
+
+#include <fstream>
+#include <mutex>
+#include <vector>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+namespace tpm_vault {
+
+namespace {
+
+struct TraceEvent {
+    const char* name;
+    std::string detail;
+    int64_t ts_us;
+    int64_t dur_us;
+    long tid;
+};
+
+std::mutex trace_mutex;
+std::string trace_path;
+std::vector<TraceEvent> trace_events;
+
+int64_t to_us(std::chrono::steady_clock::time_point tp) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(tp.time_since_epoch()).count();
+}
+
+} // namespace
+
+std::atomic<bool> Tracer::enabled_{false};
+
+const std::string& TraceSpan::empty_detail() {
+    static const std::string empty;
+    return empty;
+}
+
+void Tracer::start(const std::string& path) {
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    trace_path = path;
+    trace_events.clear();
+    enabled_.store(true, std::memory_order_relaxed);
+}
+
+void Tracer::record(const char* name, const std::string& detail,
+                    std::chrono::steady_clock::time_point start,
+                    std::chrono::steady_clock::time_point end) {
+    long tid = syscall(SYS_gettid);
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    trace_events.push_back({name, detail, to_us(start), to_us(end) - to_us(start), tid});
+}
+
+void Tracer::finish() {
+    if (!enabled()) {
+        return;
+    }
+    enabled_.store(false, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    std::ofstream out(trace_path, std::ios::trunc);
+    if (!out) {
+        throw VaultError("Failed to write trace file " + trace_path);
+    }
+
+    // Формат trace event: полные события "X" с началом и длительностью в мкс
+    long pid = getpid();
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    for (size_t i = 0; i < trace_events.size(); ++i) {
+        const auto& e = trace_events[i];
+        out << (i ? ",\n" : "\n")
+            << "{\"name\":\"" << json_escape(e.name) << "\",\"cat\":\"tpm-vault\",\"ph\":\"X\""
+            << ",\"ts\":" << e.ts_us << ",\"dur\":" << e.dur_us
+            << ",\"pid\":" << pid << ",\"tid\":" << e.tid;
+        if (!e.detail.empty()) {
+            out << ",\"args\":{\"detail\":\"" << json_escape(e.detail) << "\"}";
+        }
+        out << "}";
+    }
+    out << "\n]}\n";
+    trace_events.clear();
+
+    if (!out) {
+        throw VaultError("Failed to write trace file " + trace_path);
+    }
+}
+
+} // namespace tpm_vault
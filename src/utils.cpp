@@ -1,14 +1,11 @@
 #include "utils.hpp"
 
 #include <cstring>
-#include <fstream>
+#include <cstdio>
 #include <sstream>
-#include <array>
-#include <memory>
 #include <climits>
 #include <unistd.h>
 #include <sys/stat.h>
-#include <sys/wait.h>
 #include <fcntl.h>
 
 namespace tpm_vault {
@@ -49,6 +46,30 @@ SecureBuffer& SecureBuffer::operator=(SecureBuffer&& other) noexcept {
     return *this;
 }
 
+// UniqueFd implementation
+UniqueFd::~UniqueFd() {
+    reset();
+}
+
+UniqueFd::UniqueFd(UniqueFd&& other) noexcept : fd_(other.fd_) {
+    other.fd_ = -1;
+}
+
+UniqueFd& UniqueFd::operator=(UniqueFd&& other) noexcept {
+    if (this != &other) {
+        reset(other.fd_);
+        other.fd_ = -1;
+    }
+    return *this;
+}
+
+void UniqueFd::reset(int fd) {
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+    fd_ = fd;
+}
+
 size_t parse_size(const std::string& size_str) {
     if (size_str.empty()) {
         throw VaultError("Empty size string");
@@ -91,6 +112,28 @@ std::string format_size(size_t bytes) {
     return oss.str();
 }
 
+std::string json_escape(const std::string& s) {
+    std::string out;
+    out.reserve(s.size());
+    for (char c : s) {
+        switch (c) {
+            case '"':  out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char buf[8];
+                    std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+                    out += buf;
+                } else {
+                    out += c;
+                }
+        }
+    }
+    return out;
+}
+
 std::vector<uint8_t> generate_random_bytes(size_t size) {
     std::vector<uint8_t> result(size);
     
@@ -135,96 +178,6 @@ void ensure_directory(const std::string& path) {
     }
 }
 
-int execute_command(const std::string& cmd, const std::vector<uint8_t>* stdin_data) {
-    int pipe_fd[2] = {-1, -1};
-    
-    if (stdin_data) {
-        if (pipe(pipe_fd) < 0) {
-            throw VaultError("Failed to create pipe");
-        }
-    }
-    
-    pid_t pid = fork();
-    if (pid < 0) {
-        if (stdin_data) {
-            ::close(pipe_fd[0]);
-            ::close(pipe_fd[1]);
-        }
-        throw VaultError("Failed to fork");
-    }
-    
-    if (pid == 0) {
-        // Child process
-        if (stdin_data) {
-            ::close(pipe_fd[1]); // Close write end
-            dup2(pipe_fd[0], STDIN_FILENO);
-            ::close(pipe_fd[0]);
-        }
-
-        // Redirect stdout/stderr to /dev/null for clean output
-        int devnull = ::open("/dev/null", O_WRONLY);
-        if (devnull >= 0) {
-            dup2(devnull, STDOUT_FILENO);
-            dup2(devnull, STDERR_FILENO);
-            ::close(devnull);
-        }
-
-        execl("/bin/sh", "sh", "-c", cmd.c_str(), nullptr);
-        _exit(127);
-    }
-    
-    // Parent process
-    if (stdin_data) {
-        ::close(pipe_fd[0]); // Close read end
-        
-        size_t written = 0;
-        while (written < stdin_data->size()) {
-            ssize_t n = write(pipe_fd[1], stdin_data->data() + written, 
-                             stdin_data->size() - written);
-            if (n < 0) {
-                ::close(pipe_fd[1]);
-                throw VaultError("Failed to write to pipe");
-            }
-            written += n;
-        }
-        ::close(pipe_fd[1]);
-    }
-    
-    int status;
-    waitpid(pid, &status, 0);
-    
-    if (WIFEXITED(status)) {
-        return WEXITSTATUS(status);
-    }
-    return -1;
-}
-
-std::string execute_command_output(const std::string& cmd) {
-    std::array<char, 128> buffer;
-    std::string result;
-    
-    FILE* pipe = popen(cmd.c_str(), "r");
-    if (!pipe) {
-        throw VaultError("Failed to execute command: " + cmd);
-    }
-    
-    while (fgets(buffer.data(), buffer.size(), pipe) != nullptr) {
-        result += buffer.data();
-    }
-    
-    int status = pclose(pipe);
-    if (WEXITSTATUS(status) != 0) {
-        throw VaultError("Command failed: " + cmd);
-    }
-    
-    // Trim trailing newline
-    while (!result.empty() && (result.back() == '\n' || result.back() == '\r')) {
-        result.pop_back();
-    }
-    
-    return result;
-}
-
 std::string get_current_directory() {
     char buffer[PATH_MAX];
     if (getcwd(buffer, sizeof(buffer)) == nullptr) {
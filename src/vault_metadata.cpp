@@ -0,0 +1,140 @@
+#include "vault_metadata.hpp"
+#include "utils.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace tpm_vault {
+
+VaultMetadata VaultMetadata::load(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) {
+        return VaultMetadata(); // Хранилище создано без метаданных
+    }
+
+    std::ostringstream content;
+    content << in.rdbuf();
+    return parse(content.str(), path);
+}
+
+VaultMetadata VaultMetadata::parse(const std::string& text, const std::string& origin) {
+    VaultMetadata metadata;
+
+    std::istringstream in(text);
+    std::string line;
+    size_t line_no = 0;
+    while (std::getline(in, line)) {
+        ++line_no;
+        if (line.empty() || line[0] == '#') continue;
+
+        size_t eq = line.find('=');
+        if (eq == std::string::npos || eq == 0) {
+            throw VaultError("Malformed metadata in " + origin + " at line " + std::to_string(line_no));
+        }
+        metadata.values_[line.substr(0, eq)] = line.substr(eq + 1);
+    }
+
+    return metadata;
+}
+
+std::string VaultMetadata::serialize() const {
+    std::ostringstream out;
+    out << "# tpm-vault metadata\n";
+    for (const auto& [key, value] : values_) {
+        out << key << "=" << value << "\n";
+    }
+    return out.str();
+}
+
+void VaultMetadata::save(const std::string& path) const {
+    std::string content = serialize();
+
+    std::string tmp_path = path + ".tmp";
+    UniqueFd fd(::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600));
+    if (!fd.valid()) {
+        throw VaultError("Failed to write metadata " + tmp_path + ": " + std::strerror(errno));
+    }
+
+    size_t written = 0;
+    while (written < content.size()) {
+        ssize_t n = ::write(fd.get(), content.data() + written, content.size() - written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            int err = errno;
+            std::remove(tmp_path.c_str());
+            throw VaultError("Failed to write metadata " + tmp_path + ": " + std::strerror(err));
+        }
+        written += static_cast<size_t>(n);
+    }
+
+    if (fsync(fd.get()) != 0 || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+        int err = errno;
+        std::remove(tmp_path.c_str());
+        throw VaultError("Failed to save metadata " + path + ": " + std::strerror(err));
+    }
+}
+
+std::string VaultMetadata::path_for_image(const std::string& image_path) {
+    const std::string ext = ".img";
+    if (image_path.size() > ext.size() &&
+        image_path.compare(image_path.size() - ext.size(), ext.size(), ext) == 0) {
+        return image_path.substr(0, image_path.size() - ext.size()) + ".vault";
+    }
+    return image_path + ".vault";
+}
+
+bool VaultMetadata::has(const std::string& key) const {
+    return values_.count(key) != 0;
+}
+
+std::string VaultMetadata::get(const std::string& key, const std::string& default_value) const {
+    auto it = values_.find(key);
+    return it != values_.end() ? it->second : default_value;
+}
+
+uint64_t VaultMetadata::get_uint(const std::string& key, uint64_t default_value) const {
+    auto it = values_.find(key);
+    if (it == values_.end()) {
+        return default_value;
+    }
+    try {
+        return std::stoull(it->second);
+    } catch (const std::exception&) {
+        throw VaultError("Invalid numeric metadata value for " + key + ": " + it->second);
+    }
+}
+
+bool VaultMetadata::get_bool(const std::string& key, bool default_value) const {
+    auto it = values_.find(key);
+    if (it == values_.end()) {
+        return default_value;
+    }
+    return it->second == "1" || it->second == "true" || it->second == "yes";
+}
+
+void VaultMetadata::set(const std::string& key, const std::string& value) {
+    if (key.empty() || key.find('=') != std::string::npos ||
+        key.find('\n') != std::string::npos || value.find('\n') != std::string::npos) {
+        throw VaultError("Invalid metadata entry: " + key);
+    }
+    values_[key] = value;
+}
+
+void VaultMetadata::set_uint(const std::string& key, uint64_t value) {
+    set(key, std::to_string(value));
+}
+
+void VaultMetadata::set_bool(const std::string& key, bool value) {
+    set(key, value ? "1" : "0");
+}
+
+void VaultMetadata::erase(const std::string& key) {
+    values_.erase(key);
+}
+
+} // namespace tpm_vault
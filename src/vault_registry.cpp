@@ -0,0 +1,152 @@
+#include "vault_registry.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace tpm_vault {
+
+namespace {
+
+constexpr const char* ENTRIES_DIR = "/vaults";
+constexpr const char* ENTRY_EXT = ".entry";
+
+// Поля реестра; остальные ключи файла записи — копия метаданных хранилища
+constexpr const char* KEY_IMAGE = "vault.image";
+constexpr const char* KEY_MOUNT = "vault.mount";
+constexpr const char* KEY_MAPPER = "vault.mapper";
+constexpr const char* KEY_LOOP = "vault.loop";
+constexpr const char* KEY_LOOP_DEV = "vault.loop_dev";
+constexpr const char* KEY_MAPPER_DEV = "vault.mapper_dev";
+constexpr const char* KEY_BACKING_DEV = "vault.backing_dev";
+constexpr const char* KEY_BACKING_INODE = "vault.backing_inode";
+
+/// mkdir, не считающий ошибкой каталог, созданный параллельной записью
+void make_directory(const std::string& path) {
+    if (::mkdir(path.c_str(), 0755) != 0 && errno != EEXIST) {
+        throw VaultError("Failed to create directory " + path + ": " + std::strerror(errno));
+    }
+}
+
+bool has_suffix(const std::string& s, const std::string& suffix) {
+    return s.size() > suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+} // namespace
+
+VaultRegistry::VaultRegistry(std::string directory)
+    : directory_(std::move(directory)) {
+}
+
+std::string VaultRegistry::default_directory() {
+    const char* env = std::getenv(ENV_VAR);
+    return env && *env ? env : DEFAULT_DIR;
+}
+
+std::string VaultRegistry::entry_path(const std::string& name) const {
+    if (name.empty() || name.find('/') != std::string::npos) {
+        return "";
+    }
+    return directory_ + ENTRIES_DIR + "/" + name + ENTRY_EXT;
+}
+
+bool VaultRegistry::find(const std::string& name, RegistryEntry& entry) const {
+    std::string path = entry_path(name);
+    if (path.empty()) {
+        return false;
+    }
+    VaultMetadata metadata = VaultMetadata::load(path);
+    if (!metadata.has(KEY_IMAGE)) {
+        return false;
+    }
+    entry = from_metadata(name, metadata);
+    return true;
+}
+
+void VaultRegistry::record(const RegistryEntry& entry) {
+    std::string path = entry_path(entry.name);
+    if (path.empty()) {
+        throw VaultError("Invalid vault name for the registry: '" + entry.name + "'");
+    }
+    make_directory(directory_);
+    make_directory(directory_ + ENTRIES_DIR);
+
+    VaultMetadata metadata = VaultMetadata::parse(entry.options.serialize(), path);
+    metadata.set(KEY_IMAGE, entry.image_path);
+    metadata.set(KEY_MOUNT, entry.mount_point);
+    metadata.set(KEY_MAPPER, entry.mapper_name);
+    metadata.set_uint(KEY_BACKING_DEV, entry.backing_dev);
+    metadata.set_uint(KEY_BACKING_INODE, entry.backing_inode);
+    if (entry.is_open()) {
+        metadata.set(KEY_LOOP, entry.loop_device);
+        metadata.set_uint(KEY_LOOP_DEV, entry.loop_rdev);
+        metadata.set_uint(KEY_MAPPER_DEV, entry.mapper_rdev);
+    }
+    metadata.save(path);
+}
+
+void VaultRegistry::remove(const std::string& name) {
+    std::string path = entry_path(name);
+    if (path.empty()) {
+        return;
+    }
+    if (::unlink(path.c_str()) != 0 && errno != ENOENT) {
+        throw VaultError("Failed to remove registry entry " + path + ": " + std::strerror(errno));
+    }
+}
+
+std::vector<RegistryEntry> VaultRegistry::entries() const {
+    std::vector<RegistryEntry> result;
+    std::string dir_path = directory_ + ENTRIES_DIR;
+
+    DIR* dir = opendir(dir_path.c_str());
+    if (!dir) {
+        return result; // Реестр ещё не заведён
+    }
+
+    std::vector<std::string> names;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        std::string file = entry->d_name;
+        if (has_suffix(file, ENTRY_EXT)) {
+            names.push_back(file.substr(0, file.size() - std::strlen(ENTRY_EXT)));
+        }
+    }
+    closedir(dir);
+
+    std::sort(names.begin(), names.end());
+    for (const auto& name : names) {
+        RegistryEntry found;
+        if (find(name, found)) {
+            result.push_back(std::move(found));
+        }
+    }
+    return result;
+}
+
+RegistryEntry VaultRegistry::from_metadata(const std::string& name, const VaultMetadata& metadata) {
+    RegistryEntry entry;
+    entry.name = name;
+    entry.image_path = metadata.get(KEY_IMAGE);
+    entry.mount_point = metadata.get(KEY_MOUNT);
+    entry.mapper_name = metadata.get(KEY_MAPPER);
+    entry.loop_device = metadata.get(KEY_LOOP);
+    entry.loop_rdev = metadata.get_uint(KEY_LOOP_DEV);
+    entry.mapper_rdev = metadata.get_uint(KEY_MAPPER_DEV);
+    entry.backing_dev = metadata.get_uint(KEY_BACKING_DEV);
+    entry.backing_inode = metadata.get_uint(KEY_BACKING_INODE);
+
+    entry.options = metadata;
+    for (const char* key : {KEY_IMAGE, KEY_MOUNT, KEY_MAPPER, KEY_LOOP, KEY_LOOP_DEV, KEY_MAPPER_DEV,
+                            KEY_BACKING_DEV, KEY_BACKING_INODE}) {
+        entry.options.erase(key);
+    }
+    return entry;
+}
+
+} // namespace tpm_vault
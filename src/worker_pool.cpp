@@ -0,0 +1,58 @@
+#include "worker_pool.hpp"
+
+#include <algorithm>
+
+namespace tpm_vault {
+
+WorkerPool::WorkerPool(size_t threads) {
+    threads = std::max<size_t>(threads, 1);
+    threads_.reserve(threads);
+    for (size_t i = 0; i < threads; ++i) {
+        threads_.emplace_back(&WorkerPool::worker, this);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+}
+
+std::future<void> WorkerPool::submit(std::function<void()> task) {
+    std::packaged_task<void()> packaged(std::move(task));
+    std::future<void> result = packaged.get_future();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back(std::move(packaged));
+    }
+    cv_.notify_one();
+    return result;
+}
+
+size_t WorkerPool::size_for(size_t jobs) {
+    size_t cpus = std::max(1u, std::thread::hardware_concurrency());
+    return std::max<size_t>(1, std::min(jobs, cpus));
+}
+
+void WorkerPool::worker() {
+    while (true) {
+        std::packaged_task<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+            if (queue_.empty()) {
+                return; // stopping_ и очередь пуста
+            }
+            task = std::move(queue_.front());
+            queue_.pop_front();
+        }
+        task();
+    }
+}
+
+} // namespace tpm_vault